@@ -3,25 +3,65 @@
 #define GLFW_INCLUDE_VULKAN
 #define _POSIX_C_SOURCE (199309L)
 
+#include "cpu-features.h"
 #include "features.h"
+#include "frame-stats.h"
+#include "frustum-cull.h"
+#include "mipmap.h"
+#include "parallel-record.h"
 #include "rutils/debug.h"
 #include "rutils/file.h"
 #include "rutils/math.h"
 #include "rutils/string.h"
-#include "stb_image.h"
+#include "simd-math.h"
+#include "texture-decode.h"
+#include "texture-file.h"
 #include "vk-basic.h"
 #include <GLFW/glfw3.h>
 #include <limits.h>
-#include <time.h>
+#include <math.h>
+#include <unistd.h>
 
 #define WIDTH 800
 #define HEIGHT 600
 
 #define VERT_SHADER_LOC "shaders/basic-shader.vert.spv"
 #define FRAG_SHADER_LOC "shaders/basic-shader.frag.spv"
-#define MAX_CONCURRENT_FRAMES 10
+#define INSTANCED_VERT_SHADER_LOC "shaders/instanced-shader.vert.spv"
+#define CULL_SHADER_LOC "shaders/cull.comp.spv"
+#define TEXTURE_LOC "textures/container.jpg"
+/* Written from TEXTURE_LOC by texture-cook, see deps.mk */
+#define COOKED_TEXTURE_LOC "textures/container.tex"
+#define TEXTURE_CACHE_LOC "texture-cache"
+/* Must match local_size_x in cull.comp */
+#define CULL_WORKGROUP_SIZE 64
+/* Half the side of the instance grid with --gpu-cull, big enough that a good
+   part of it is off screen */
+#define CULL_GRID_EXTENT 4
+/* Instances per job when updating or culling them on the CPU. Fewer run on
+   the calling thread alone. A multiple of 64 so every culling slice owns
+   whole words of the mask */
+#define INSTANCE_JOB_GRAIN 4096
+#define PIPELINE_CACHE_LOC "pipeline.cache"
+/* How many frames the CPU may get ahead of the GPU. Overridden with
+   --frames-in-flight */
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+/* Frames per configuration for --latency-sweep when --frames isn't given */
+#define DEFAULT_SWEEP_FRAMES 500
+/* Draws recorded per image by --bench-recording when --draws isn't given */
+#define DEFAULT_BENCH_DRAWS 10000
+#define BENCH_RECORDING_REPEATS 20
+#define OFFSCREEN_IMAGE_COUNT 3
+#define DEFAULT_HEADLESS_FRAMES 1000
+/* Frame time samples kept when no frame limit is given */
+#define DEFAULT_BENCH_CAPACITY (1 << 18)
+/* How deep --config can nest, which also stops a config including itself */
+#define MAX_CONFIG_DEPTH 8
 
 local bool resizeOccurred;
+/* Set by the P key, the main loop picks it up through swapchain recreation */
+local bool presentModeChanged;
+local VkPresentModeKHR requestedPresentMode;
 
 typedef enum DrawResult
 {
@@ -30,6 +70,17 @@ typedef enum DrawResult
     NO_SUBMIT
 } DrawResult;
 
+typedef enum CookedTextureResult
+{
+    COOKED_TEXTURE_LOADED,
+    /* These two fall back to decoding the source image */
+    COOKED_TEXTURE_MISSING,
+    COOKED_TEXTURE_UNSUPPORTED,
+    /* The file is there but isn't a texture-cook file */
+    COOKED_TEXTURE_INVALID,
+    COOKED_TEXTURE_FAILED
+} CookedTextureResult;
+
 typedef struct Vertex
 {
     Vec3f pos;
@@ -37,30 +88,187 @@ typedef struct Vertex
     Vec2f uv;
 } Vertex;
 
+/* viewProj and mvp are premultiplied on the CPU once a frame so the shaders
+   don't redo the matrix products for every vertex */
 typedef struct Uniform
 {
     Mat4f model;
     Mat4f view;
     Mat4f proj;
+    Mat4f viewProj;
+    Mat4f mvp;
 } Uniform;
 
-typedef struct Semaphores
+/* Frame slot i is reused every framesInFlight frames and waits on its fence
+   first, which caps how far the CPU can run ahead. imageFences holds the
+   fence of the last frame drawn to each swapchain image so an image, and its
+   uniform region, isn't written while a frame still uses it */
+typedef struct FrameScheduler
 {
+    u32 framesInFlight;
     VkSemaphore *imageAvailableSemaphores;
     VkSemaphore *renderFinishedSemaphores;
     VkFence *fences;
+    /* When each slot's frame started. pending is cleared once its fence has
+       been seen signaled, which is when latency gets recorded */
+    double *startTimes;
+    bool *pending;
+    u32 imageCount;
+    VkFence *imageFences;
+} FrameScheduler;
+
+typedef struct Options
+{
+    bool benchMapping;
+    /* No window or surface. Renders frameLimit frames offscreen and reports
+       throughput */
+    bool headless;
+    /* Frames measured, warmupFrames more run before them. 0 means run until
+       the window closes */
+    u32 frameLimit;
+    /* Frame time statistics, printed at exit */
+    bool bench;
+    u32 warmupFrames;
+    const char *benchCSV;
+    const char *benchJSON;
+    /* GPU render pass times, one row per sampled frame */
+    const char *gpuCSV;
+    /* Start from an empty pipeline cache to get cold startup timings. The
+       cache is still written at exit */
+    bool coldPipelineCache;
+    u32 framesInFlight;
+    /* A preference, see CreateRenderContext for the fallbacks */
+    VkPresentModeKHR presentMode;
+    /* Runs frameLimit frames with 1, 2 and 3 frames in flight and reports
+       frame time against latency for each */
+    bool latencySweep;
+    /* Times of the cube drawn per image. Only there to give recording
+       something to chew on */
+    u32 drawCount;
+    /* 0 records inline on the main thread, otherwise into that many
+       secondary command buffers, recorded in parallel on the job system */
+    u32 recordThreads;
+    /* Times recording drawCount draws into 1 to recordThreads secondaries,
+       then exits */
+    bool benchRecording;
+    /* 0 draws the single cube from Uniform.model, otherwise a grid of that
+       many cubes through the instanced pipeline */
+    u32 instanceCount;
+    /* Runs frameLimit frames with 1k, 10k and 100k instances */
+    bool instanceSweep;
+    /* Frustum cull instances in a compute pass and draw the survivors
+       indirectly */
+    bool gpuCull;
+    /* Same, but culled with SIMD on the CPU for when compute isn't wanted */
+    bool cpuCull;
+    /* Upload textures as level 0 only, to compare the cost of sampling
+       without mips against the default full chain */
+    bool noMips;
+    /* Decode TEXTURE_LOC even when its cooked version is there */
+    bool rawTextures;
+    /* Threads in the job system, which everything that runs in parallel
+       shares. 0 means every online CPU */
+    u32 threads;
+    /* Where decoded textures are kept between runs, NULL decodes every
+       time */
+    const char *textureCache;
+} Options;
+
+/* Layout of binding 3 in cull.comp */
+typedef struct CullDraw
+{
+    VkDrawIndexedIndirectCommand draw;
+    u32 objectCount;
+    f32 boundingRadius;
+} CullDraw;
+
+/* Compute pass that tests every instance's bounding sphere against the
+   frustum and appends the survivors to visible. The instance count of the
+   indirect draw in draws is bumped once per survivor, so the draw picks up
+   whatever is visible without rerecording. Every buffer has one region per
+   swapchain image, MAX_SWAPCHAIN_IMAGES of them like the rest of the per
+   image state */
+typedef struct CullingPass
+{
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet *descriptorSets;
+    GPUBufferData visible;
+    VkDeviceSize visibleRegionSize;
+    /* Host visible so the visible count can be read back */
+    GPURingBuffer draws;
+    f32 boundingRadius;
+    /* The CPU fills bounds, culls them into mask and writes only the visible
+       instances and the indirect draw itself. Nothing but draws exists on the
+       GPU side then */
+    bool onCPU;
+    SphereBounds bounds;
+    u64 *mask;
+    /* Survivors of each INSTANCE_JOB_GRAIN slice, then where the slice's
+       survivors start once summed */
+    u32 *sliceVisible;
+} CullingPass;
+
+/* Per instance model matrices read through vertex binding 1. They're
+   rewritten every frame into the region of the image being drawn */
+typedef struct InstanceSet
+{
+    GPURingBuffer ring;
     u32 count;
-} Semaphores;
+    u32 capacity;
+    /* The grid covers [-extent, extent] */
+    f32 extent;
+    /* NULL draws every instance directly */
+    CullingPass *culling;
+    /* Where the CPU builds model matrices before turning them into MVPs, so
+       the mapped ring is only ever written. NULL when culling on the GPU,
+       which wants the models themselves */
+    Mat4f *models;
+} InstanceSet;
+
+/* Everything a slice of the draw list needs to record itself */
+typedef struct DrawListContext
+{
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    GPUBufferData *vertexBuffer;
+    VkDeviceSize *offsets;
+    GPUBufferData *indexBuffer;
+    VkDeviceSize indexOffset;
+    VkDescriptorSet descriptorSet;
+    u32 uniformOffset;
+    VkExtent2D extent;
+    /* NULL for the non instanced pipeline */
+    GPUBufferData *instanceBuffer;
+    VkDeviceSize instanceOffset;
+    u32 instanceCount;
+    /* Set when the instance count comes from a CullingPass */
+    GPUBufferData *indirectBuffer;
+    VkDeviceSize indirectOffset;
+} DrawListContext;
 
 typedef struct Texture
 {
     VkImage image;
-    VkDeviceMemory texMem;
+    GPUAllocation texMem;
     VkImageView imageView;
     VkSampler sampler;
     u32 x;
     u32 y;
     int bytesPerPixel;
+    u32 mipLevels;
+    /* The format couldn't be blitted, so the chain was filtered on the CPU.
+       Never set for cooked textures, their chain comes from the file */
+    bool mipsOnCPU;
+    VkFormat format;
+    /* Size of every level in the image */
+    VkDeviceSize bytes;
+    /* Loaded from a texture-cook file rather than decoded */
+    bool cooked;
+    /* Copied out of the texture cache rather than decoded */
+    bool cached;
 } Texture;
 
 local Vertex vertices[] = {
@@ -78,116 +286,699 @@ local u16 indices[] = {0, 1, 2, 2, 3, 0,
 
 local const char *validationLayers[] = {"VK_LAYER_LUNARG_standard_validation"};
 
-local void CopyBufferToImage(LogicalDevice *ld, VkCommandPool bufferCommandPool, GPUBufferData *texBuf, Texture *tex)
+local bool CreateTextureSampler(LogicalDevice *ld, Texture *tex)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommandBuffer(ld, bufferCommandPool);
-    VkBufferImageCopy region = {0};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
+    VkSamplerCreateInfo samplerInfo = {0};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_TRUE;
+    samplerInfo.maxAnisotropy = 16;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = (float)tex->mipLevels;
+
+    return vkCreateSampler(ld->dev, &samplerInfo, NULL, &tex->sampler) == VK_SUCCESS;
+}
+
+/* Records the upload of an image DecodeImages wrote to staging at
+   image->offset. With mips the whole chain is uploaded, blitted on the GPU
+   from level 0 when the format allows it and already filtered on the CPU
+   otherwise */
+local errcode CreateDecodedTexture(LogicalDevice *ld, UploadBatch *batch, GPUBufferData *texBuf,
+                                   const DecodedImage *image, bool mips, bool mipsOnCPU, Texture *tex)
+{
+    tex->x = image->x;
+    tex->y = image->y;
+    tex->bytesPerPixel = image->channels;
+    tex->cached = image->cache.hit;
+    tex->mipLevels = mips ? MipLevelCount(tex->x, tex->y) : 1;
+    tex->mipsOnCPU = tex->mipLevels > 1 && mipsOnCPU;
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (tex->mipLevels > 1 && !tex->mipsOnCPU)
+    {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    if (!CreateVkImage(ld, tex->x, tex->y, tex->mipLevels, VK_FORMAT_R8G8B8A8_UNORM, usage,
+                       &tex->image, &tex->texMem))
+    {
+        return ERROR_EXTERNAL_LIB;
+    }
+
+    UploadBatchTransitionImage(ld, batch, tex->image,
+                               VK_FORMAT_R8G8B8A8_UNORM,
+                               VK_IMAGE_LAYOUT_UNDEFINED,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
+    u32 copiedLevels = tex->mipsOnCPU ? tex->mipLevels : 1;
+    for (u32 level = 0; level < copiedLevels; level++)
+    {
+        UploadBatchCopyBufferToImage(batch, texBuf, image->offset + MipLevelOffset(tex->x, tex->y, 4, level),
+                                     tex->image, level, MipExtent(tex->x, level), MipExtent(tex->y, level));
+    }
 
-    region.imageOffset = (VkOffset3D){0, 0, 0};
-    region.imageExtent = (VkExtent3D){tex->x,
-                                      tex->y,
-                                      1};
+    if (tex->mipLevels > 1 && !tex->mipsOnCPU)
+    {
+        UploadBatchGenerateMips(ld, batch, tex->image, tex->x, tex->y, tex->mipLevels);
+    }
+    else
+    {
+        UploadBatchTransitionImage(ld, batch, tex->image, VK_FORMAT_R8G8B8A8_UNORM,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
 
-    vkCmdCopyBufferToImage(commandBuffer, texBuf->buffer, tex->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    if (!CreateImageView(ld, tex->image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, tex->mipLevels,
+                         &tex->imageView))
+    {
+        return ERROR_EXTERNAL_LIB;
+    }
+    tex->format = VK_FORMAT_R8G8B8A8_UNORM;
+    tex->bytes = MipLevelOffset(tex->x, tex->y, 4, tex->mipLevels);
 
-    EndSingleTimeCommandBuffer(ld, bufferCommandPool, commandBuffer);
+    return CreateTextureSampler(ld, tex) ? ERROR_SUCCESS : ERROR_EXTERNAL_LIB;
 }
 
-local errcode LoadTexture(LogicalDevice *ld,
-                          const char *path, VkCommandPool bufferCommandPool,
-                          Texture *tex)
+/* Decodes every path at once on js into one staging buffer and records all
+   the uploads into batch, so startup pays for the slowest thread rather than
+   the sum of every image. JPEGs are decoded straight into staging. With a
+   cacheDir images decoded by an earlier run are copied from there instead.
+   Fails with ERROR_INVAL_PARAMETER when any image can't be read */
+local errcode LoadTextures(LogicalDevice *ld, JobSystem *js, const char **paths, u32 count, const char *cacheDir,
+                           UploadBatch *batch, bool mips, Texture *out)
 {
-    int x, y;
-    void *image = stbi_load(path, &x, &y, &tex->bytesPerPixel, STBI_rgb_alpha);
+    bool mipsOnCPU = mips && !FormatSupportsMipBlits(ld, VK_FORMAT_R8G8B8A8_UNORM);
+    DecodedImage *images = calloc(count, sizeof(images[0]));
+    if (!images)
+    {
+        return ERROR_NO_MEMORY;
+    }
+    for (u32 i = 0; i < count; i++)
+    {
+        images[i].path = paths[i];
+    }
 
-    tex->x = x;
-    tex->y = y;
-    size_t imageSize = tex->x * tex->y * 4;
+    usize size = ReadImageHeaders(js, images, count, mipsOnCPU, cacheDir);
+    for (u32 i = 0; i < count; i++)
+    {
+        if (!images[i].ok)
+        {
+            free(images);
+            return ERROR_INVAL_PARAMETER;
+        }
+    }
 
-    if (!image)
+    GPUBufferData texBuf;
+    if (!UploadBatchAllocateStaging(ld, batch, size, &texBuf))
     {
+        free(images);
         return ERROR_NO_MEMORY;
     }
 
+    u32 decoded;
+    if (mipsOnCPU)
+    {
+        /* Built in ordinary memory since the filter reads back every level it
+           writes, staging memory is only ever written */
+        u8 *chains = malloc(size);
+        if (!chains)
+        {
+            free(images);
+            return ERROR_NO_MEMORY;
+        }
+        decoded = DecodeImages(js, images, count, chains, false);
+        memcpy(texBuf.mapped, chains, size);
+        free(chains);
+    }
+    else
+    {
+        decoded = DecodeImages(js, images, count, texBuf.mapped, true);
+    }
+
+    errcode result = decoded == count ? ERROR_SUCCESS : ERROR_INVAL_PARAMETER;
+    for (u32 i = 0; i < count && result == ERROR_SUCCESS; i++)
+    {
+        result = CreateDecodedTexture(ld, batch, &texBuf, &images[i], mips, mipsOnCPU, &out[i]);
+    }
+    free(images);
+    return result;
+}
+
+/* Loads a texture-cook file as is: every level is already there in its
+   final format, so this is a copy into staging and one copy per level. Fails
+   without touching the batch when the file is missing, malformed or in a
+   format the device can't sample. Only a malformed file is reported here */
+local CookedTextureResult LoadCookedTexture(LogicalDevice *ld, const char *path, UploadBatch *batch, bool mips,
+                                            Texture *tex)
+{
+    local const VkFormat formats[] = {
+        [TEXTURE_FILE_RGBA8] = VK_FORMAT_R8G8B8A8_UNORM,
+        [TEXTURE_FILE_BC1] = VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+        [TEXTURE_FILE_BC3] = VK_FORMAT_BC3_UNORM_BLOCK,
+        [TEXTURE_FILE_BC7] = VK_FORMAT_BC7_UNORM_BLOCK,
+    };
+
+    if (access(path, F_OK) != 0)
+    {
+        return COOKED_TEXTURE_MISSING;
+    }
+    isize fileSize;
+    void *data = MapFileToROBuffer(path, NULL, &fileSize);
+    TextureFile file;
+    if (!data || !ParseTextureFile(data, fileSize, &file))
+    {
+        if (data)
+        {
+            UnmapMappedBuffer(data, fileSize);
+        }
+        printf("%s is unreadable or not a texture-cook file, delete it or cook it again\n", path);
+        return COOKED_TEXTURE_INVALID;
+    }
+    VkFormat format = formats[file.header.format];
+    if (!FindSupportedFormat(ld, 1, &format, VK_IMAGE_TILING_OPTIMAL,
+                             VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT,
+                             &format))
+    {
+        UnmapMappedBuffer(data, fileSize);
+        return COOKED_TEXTURE_UNSUPPORTED;
+    }
+
+    tex->x = file.header.x;
+    tex->y = file.header.y;
+    tex->mipLevels = mips ? file.header.mipLevels : 1;
+    tex->format = format;
+    tex->cooked = true;
+
+    /* Levels are packed in staging, keeping the file's 16 byte alignment
+       which covers every format's block size */
+    u32 last = tex->mipLevels - 1;
+    VkDeviceSize first = file.levels[0].offset;
+    tex->bytes = file.levels[last].offset + file.levels[last].size - first;
     GPUBufferData texBuf;
+    if (!UploadBatchAllocateStaging(ld, batch, tex->bytes, &texBuf))
+    {
+        UnmapMappedBuffer(data, fileSize);
+        return COOKED_TEXTURE_FAILED;
+    }
+    memcpy(texBuf.mapped, TextureFileLevelData(&file, 0), tex->bytes);
+    UnmapMappedBuffer(data, fileSize);
 
-    if (CreateGPUBufferData(ld, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                            &texBuf) != VK_SUCCESS)
+    if (!CreateVkImage(ld, tex->x, tex->y, tex->mipLevels, format,
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, &tex->image, &tex->texMem))
     {
-        return ERROR_NO_MEMORY;
+        return COOKED_TEXTURE_FAILED;
     }
+    UploadBatchTransitionImage(ld, batch, tex->image, format,
+                               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    for (u32 level = 0; level < tex->mipLevels; level++)
+    {
+        UploadBatchCopyBufferToImage(batch, &texBuf, file.levels[level].offset - first, tex->image, level,
+                                     MipExtent(tex->x, level), MipExtent(tex->y, level));
+    }
+    UploadBatchTransitionImage(ld, batch, tex->image, format,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    OutputDataToBuffer(ld, &texBuf, image, imageSize, 0);
+    if (!CreateImageView(ld, tex->image, format, VK_IMAGE_ASPECT_COLOR_BIT, tex->mipLevels, &tex->imageView))
+    {
+        return COOKED_TEXTURE_FAILED;
+    }
 
-    if (!CreateVkImage(ld, tex->x, tex->y, VK_FORMAT_R8G8B8A8_UNORM,
-                       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                       &tex->image, &tex->texMem))
+    return CreateTextureSampler(ld, tex) ? COOKED_TEXTURE_LOADED : COOKED_TEXTURE_FAILED;
+}
+
+local void ApplicationRecordDrawSlice(VkCommandBuffer commandBuffer, u32 firstDraw, u32 drawCount, void *user)
+{
+    ignore firstDraw;
+    DrawListContext *ctx = user;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipeline);
+    RecordViewportAndScissor(commandBuffer, ctx->extent);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &ctx->vertexBuffer->buffer, ctx->offsets);
+    if (ctx->instanceBuffer)
     {
-        return ERROR_EXTERNAL_LIB;
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &ctx->instanceBuffer->buffer, &ctx->instanceOffset);
+    }
+    vkCmdBindIndexBuffer(commandBuffer, ctx->indexBuffer->buffer, ctx->indexOffset, VK_INDEX_TYPE_UINT16);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->layout,
+                            0, 1, &ctx->descriptorSet, 1, &ctx->uniformOffset);
+    for (u32 i = 0; i < drawCount; i++)
+    {
+        if (ctx->indirectBuffer)
+        {
+            vkCmdDrawIndexedIndirect(commandBuffer, ctx->indirectBuffer->buffer, ctx->indirectOffset, 1, 0);
+        }
+        else
+        {
+            vkCmdDrawIndexed(commandBuffer, countof(indices), ctx->instanceCount, 0, 0, 0);
+        }
     }
+}
 
-    TransitionImageLayout(ld, bufferCommandPool, tex->image,
-                          VK_FORMAT_R8G8B8A8_UNORM,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+/* count cubes on a square grid over [-extent, extent] on the z = 0 plane,
+   all spinning like the single cube does. The whole grid turns slowly too,
+   so with culling on the visible set changes every frame */
+typedef struct InstanceGrid
+{
+    u32 side;
+    f32 extent;
+    f32 spacing;
+    f32 orbitSin;
+    f32 orbitCos;
+    /* Spin and scale, shared by every instance */
+    Mat4f rotation;
+} InstanceGrid;
+
+local InstanceGrid ApplicationInstanceGrid(u32 count, f32 extent, f32 time)
+{
+    InstanceGrid grid = {0};
+    grid.side = (u32)ceilf(sqrtf((float)count));
+    grid.extent = extent;
+    grid.spacing = 2 * extent / grid.side;
+    grid.rotation = RotateMat4f(&IdMat4f, time * DegToRad(90), vec3f(0, 0, 1));
+    for (u32 c = 0; c < 3; c++)
+    {
+        for (u32 r = 0; r < 3; r++)
+        {
+            grid.rotation.e[c][r] *= grid.spacing * .8f;
+        }
+    }
+    grid.orbitSin = sinf(time * DegToRad(10));
+    grid.orbitCos = cosf(time * DegToRad(10));
+    return grid;
+}
 
-    CopyBufferToImage(ld, bufferCommandPool, &texBuf, tex);
+local void ApplicationInstancePosition(const InstanceGrid *grid, u32 i, f32 *outX, f32 *outY)
+{
+    f32 x = -grid->extent + grid->spacing * (i % grid->side + .5f);
+    f32 y = -grid->extent + grid->spacing * (i / grid->side + .5f);
+    *outX = x * grid->orbitCos - y * grid->orbitSin;
+    *outY = x * grid->orbitSin + y * grid->orbitCos;
+}
 
-    TransitionImageLayout(ld, bufferCommandPool, tex->image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+/* What the per frame instance jobs share. out is indexed by instance, or by
+   survivor when culling on the CPU */
+typedef struct InstanceJobContext
+{
+    InstanceSet *instances;
+    InstanceGrid grid;
+    const Uniform *u;
+    Mat4f *out;
+    FrustumPlanes planes;
+    f32 radius;
+} InstanceJobContext;
+
+local void ApplicationWriteModelSlice(u32 first, u32 count, void *user)
+{
+    InstanceJobContext *ctx = user;
+    for (u32 i = first; i < first + count; i++)
+    {
+        Mat4f m = ctx->grid.rotation;
+        ApplicationInstancePosition(&ctx->grid, i, &m.e[3][0], &m.e[3][1]);
+        ctx->out[i] = m;
+    }
+}
 
-    DestroyGPUBufferInfo(ld, &texBuf);
+local void ApplicationWriteMVPSlice(u32 first, u32 count, void *user)
+{
+    InstanceJobContext *ctx = user;
+    Mat4f *models = ctx->instances->models;
+    for (u32 i = first; i < first + count; i++)
+    {
+        Mat4f m = ctx->grid.rotation;
+        ApplicationInstancePosition(&ctx->grid, i, &m.e[3][0], &m.e[3][1]);
+        models[i] = m;
+    }
+    CalcMVPBatch(&ctx->u->proj, &ctx->u->view, models + first, count, ctx->out + first);
+}
 
-    if (!CreateImageView(ld, tex->image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, &tex->imageView))
+/* Writes every instance to out on js. Without u out gets the model
+   matrices, with it the models go through instances->models and out gets
+   their MVPs */
+local void ApplicationWriteInstances(JobSystem *js, InstanceSet *instances, const Uniform *u, f32 time,
+                                     Mat4f *out)
+{
+    InstanceJobContext ctx = {0};
+    ctx.instances = instances;
+    ctx.grid = ApplicationInstanceGrid(instances->count, instances->extent, time);
+    ctx.u = u;
+    ctx.out = out;
+    JobSystemParallelFor(js, instances->count, INSTANCE_JOB_GRAIN,
+                         u ? ApplicationWriteMVPSlice : ApplicationWriteModelSlice, &ctx);
+}
+
+/* shader is only used when culling on the GPU */
+local bool ApplicationCreateCullingPass(LogicalDevice *ld, VkPipelineCache cache,
+                                        bool onCPU, VkShaderModule shader, GPURingBuffer *uniformRing,
+                                        InstanceSet *instances, CullingPass *out)
+{
+    *out = (CullingPass){0};
+    out->onCPU = onCPU;
+
+    /* Farthest vertex from the mesh origin */
+    for (u32 i = 0; i < countof(vertices); i++)
     {
-        return ERROR_EXTERNAL_LIB;
+        f32 p[3];
+        memcpy(p, &vertices[i].pos, sizeof(p));
+        f32 r = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        out->boundingRadius = r > out->boundingRadius ? r : out->boundingRadius;
     }
 
-    VkSamplerCreateInfo samplerInfo = {0};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = 16;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    if (onCPU)
+    {
+        out->mask = malloc(sizeof(out->mask[0]) * CullMaskWords(instances->capacity));
+        out->sliceVisible = malloc(sizeof(out->sliceVisible[0]) * (instances->capacity / INSTANCE_JOB_GRAIN + 1));
+        return out->mask && out->sliceVisible &&
+               CreateSphereBounds(instances->capacity, &out->bounds) &&
+               CreateGPURingBuffer(ld, sizeof(CullDraw), MAX_SWAPCHAIN_IMAGES,
+                                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &out->draws);
+    }
 
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.mipLodBias = 0.0f;
-    samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    VkDescriptorSetLayoutBinding bindings[4] = {0};
+    for (u32 i = 0; i < countof(bindings); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
 
-    if (vkCreateSampler(ld->dev, &samplerInfo, NULL, &tex->sampler) != VK_SUCCESS)
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {0};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = countof(bindings);
+    layoutInfo.pBindings = bindings;
+    if (vkCreateDescriptorSetLayout(ld->dev, &layoutInfo, NULL, &out->setLayout) != VK_SUCCESS)
     {
-        return ERROR_EXTERNAL_LIB;
+        return false;
     }
 
-    return ERROR_SUCCESS;
+    out->pipeline = CreateComputePipeline(ld, cache, shader, &out->setLayout, 1, &out->layout);
+    if (out->pipeline == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ld->physdev, &props);
+    VkDeviceSize alignment = props.limits.minStorageBufferOffsetAlignment;
+    VkDeviceSize matricesSize = sizeof(Mat4f) * instances->capacity;
+    out->visibleRegionSize = (matricesSize + alignment - 1) / alignment * alignment;
+    if (CreateGPUBufferData(ld, out->visibleRegionSize * MAX_SWAPCHAIN_IMAGES,
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &out->visible) != VK_SUCCESS)
+    {
+        return false;
+    }
+    if (!CreateGPURingBuffer(ld, sizeof(CullDraw), MAX_SWAPCHAIN_IMAGES,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             &out->draws))
+    {
+        return false;
+    }
+
+    VkDescriptorPoolSize poolSizes[2] = {0};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = MAX_SWAPCHAIN_IMAGES;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = MAX_SWAPCHAIN_IMAGES * 3;
+    out->descriptorPool = CreateDescriptorPool(ld, MAX_SWAPCHAIN_IMAGES, countof(poolSizes), poolSizes);
+    if (!out->descriptorPool)
+    {
+        return false;
+    }
+
+    out->descriptorSets = malloc(sizeof(out->descriptorSets[0]) * MAX_SWAPCHAIN_IMAGES);
+    VkDescriptorSetLayout setLayouts[MAX_SWAPCHAIN_IMAGES];
+    for (u32 i = 0; i < MAX_SWAPCHAIN_IMAGES; i++)
+    {
+        setLayouts[i] = out->setLayout;
+    }
+    VkDescriptorSetAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = out->descriptorPool;
+    allocInfo.descriptorSetCount = MAX_SWAPCHAIN_IMAGES;
+    allocInfo.pSetLayouts = setLayouts;
+    if (vkAllocateDescriptorSets(ld->dev, &allocInfo, out->descriptorSets) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    for (u32 i = 0; i < MAX_SWAPCHAIN_IMAGES; i++)
+    {
+        VkDescriptorBufferInfo bufferInfos[4] = {0};
+        bufferInfos[0].buffer = uniformRing->buffer.buffer;
+        bufferInfos[0].offset = GPURingBufferOffset(uniformRing, i);
+        bufferInfos[0].range = sizeof(Uniform);
+        bufferInfos[1].buffer = instances->ring.buffer.buffer;
+        bufferInfos[1].offset = GPURingBufferOffset(&instances->ring, i);
+        bufferInfos[1].range = matricesSize;
+        bufferInfos[2].buffer = out->visible.buffer;
+        bufferInfos[2].offset = out->visibleRegionSize * i;
+        bufferInfos[2].range = matricesSize;
+        bufferInfos[3].buffer = out->draws.buffer.buffer;
+        bufferInfos[3].offset = GPURingBufferOffset(&out->draws, i);
+        bufferInfos[3].range = sizeof(CullDraw);
+
+        VkWriteDescriptorSet writes[4] = {0};
+        for (u32 j = 0; j < countof(writes); j++)
+        {
+            writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[j].dstSet = out->descriptorSets[i];
+            writes[j].dstBinding = j;
+            writes[j].descriptorType = bindings[j].descriptorType;
+            writes[j].descriptorCount = 1;
+            writes[j].pBufferInfo = &bufferInfos[j];
+        }
+        vkUpdateDescriptorSets(ld->dev, countof(writes), writes, 0, NULL);
+    }
+    return true;
+}
+
+local void ApplicationDestroyCullingPass(LogicalDevice *ld, CullingPass *pass)
+{
+    if (pass->onCPU)
+    {
+        free(pass->mask);
+        free(pass->sliceVisible);
+        DestroySphereBounds(&pass->bounds);
+        DestroyGPURingBuffer(ld, &pass->draws);
+        return;
+    }
+    vkDestroyDescriptorPool(ld->dev, pass->descriptorPool, NULL);
+    free(pass->descriptorSets);
+    DestroyGPURingBuffer(ld, &pass->draws);
+    DestroyGPUBufferInfo(ld, &pass->visible);
+    vkDestroyPipeline(ld->dev, pass->pipeline, NULL);
+    vkDestroyPipelineLayout(ld->dev, pass->layout, NULL);
+    vkDestroyDescriptorSetLayout(ld->dev, pass->setLayout, NULL);
+}
+
+/* Goes before the render pass. Resets the image's indirect draw, culls into
+   its visible region and makes both visible to the draw */
+local void ApplicationRecordCulling(VkCommandBuffer commandBuffer, InstanceSet *instances, u32 image)
+{
+    CullingPass *pass = instances->culling;
+
+    CullDraw reset = {0};
+    reset.draw.indexCount = countof(indices);
+    reset.objectCount = instances->count;
+    reset.boundingRadius = pass->boundingRadius;
+    vkCmdUpdateBuffer(commandBuffer, pass->draws.buffer.buffer, GPURingBufferOffset(&pass->draws, image),
+                      sizeof(reset), &reset);
+
+    VkMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass->layout,
+                            0, 1, &pass->descriptorSets[image], 0, NULL);
+    vkCmdDispatch(commandBuffer, (instances->count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+/* Goes after the render pass. Makes the indirect draw the compute pass wrote
+   visible to the host, for ApplicationCulledInstanceCount */
+local void ApplicationRecordCullingReadback(VkCommandBuffer commandBuffer)
+{
+    VkMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
 }
 
+/* Fills the slice's bounds and culls them into its words of the mask. Slices
+   start on a multiple of 64, so no two share a word */
+local void ApplicationCullSlice(u32 first, u32 count, void *user)
+{
+    InstanceJobContext *ctx = user;
+    CullingPass *pass = ctx->instances->culling;
+    SphereBounds *bounds = &pass->bounds;
+    for (u32 i = first; i < first + count; i++)
+    {
+        ApplicationInstancePosition(&ctx->grid, i, &bounds->x[i], &bounds->y[i]);
+        bounds->z[i] = 0;
+        bounds->r[i] = ctx->radius;
+    }
+
+    SphereBounds slice = {bounds->x + first, bounds->y + first, bounds->z + first, bounds->r + first,
+                          count, bounds->capacity - first};
+    pass->sliceVisible[first / INSTANCE_JOB_GRAIN] = CullSpheres(&ctx->planes, &slice, pass->mask + first / 64);
+}
+
+/* Packs the slice's survivors from where its slice starts and writes their
+   MVPs */
+local void ApplicationCompactSlice(u32 first, u32 count, void *user)
+{
+    InstanceJobContext *ctx = user;
+    CullingPass *pass = ctx->instances->culling;
+    SphereBounds *bounds = &pass->bounds;
+    u32 start = pass->sliceVisible[first / INSTANCE_JOB_GRAIN];
+    u32 visible = start;
+    for (u32 w = first / 64; w < CullMaskWords(first + count); w++)
+    {
+        for (u64 bits = pass->mask[w]; bits; bits &= bits - 1)
+        {
+            u32 i = w * 64 + __builtin_ctzll(bits);
+            Mat4f m = ctx->grid.rotation;
+            m.e[3][0] = bounds->x[i];
+            m.e[3][1] = bounds->y[i];
+            ctx->instances->models[visible++] = m;
+        }
+    }
+    CalcMVPBatch(&ctx->u->proj, &ctx->u->view, ctx->instances->models + start, visible - start,
+                 ctx->out + start);
+}
+
+/* Culls into the mask, then writes MVPs for only the visible instances to
+   out and points the image's indirect draw at them. Both passes run on js,
+   with the survivor counts summed between them */
+local void ApplicationCullInstancesOnCPU(JobSystem *js, InstanceSet *instances, const Uniform *u, f32 time,
+                                         Mat4f *out, CullDraw *draw)
+{
+    CullingPass *pass = instances->culling;
+    InstanceJobContext ctx = {0};
+    ctx.instances = instances;
+    ctx.grid = ApplicationInstanceGrid(instances->count, instances->extent, time);
+    ctx.u = u;
+    ctx.out = out;
+    ctx.radius = pass->boundingRadius * ctx.grid.spacing * .8f;
+    ExtractFrustumPlanes(&u->proj, &u->view, &ctx.planes);
+
+    pass->bounds.count = instances->count;
+    JobSystemParallelFor(js, instances->count, INSTANCE_JOB_GRAIN, ApplicationCullSlice, &ctx);
+    u32 visible = 0;
+    for (u32 i = 0; i < (instances->count + INSTANCE_JOB_GRAIN - 1) / INSTANCE_JOB_GRAIN; i++)
+    {
+        u32 sliceVisible = pass->sliceVisible[i];
+        pass->sliceVisible[i] = visible;
+        visible += sliceVisible;
+    }
+    JobSystemParallelFor(js, instances->count, INSTANCE_JOB_GRAIN, ApplicationCompactSlice, &ctx);
+
+    CullDraw result = {0};
+    result.draw.indexCount = countof(indices);
+    result.draw.instanceCount = visible;
+    result.objectCount = instances->count;
+    *draw = result;
+}
+
+/* What the last frame drawn to image kept. Returns false while that frame
+   hasn't retired, or when nothing was drawn to image yet */
+local bool ApplicationCulledInstanceCount(LogicalDevice *ld, FrameScheduler *fs, InstanceSet *instances,
+                                          u32 image, u32 *out)
+{
+    VkFence fence = fs->imageFences[image];
+    if (fence == VK_NULL_HANDLE || vkGetFenceStatus(ld->dev, fence) != VK_SUCCESS)
+    {
+        return false;
+    }
+    CullDraw *draw = GPURingBufferRegion(&instances->culling->draws, image);
+    *out = draw->draw.instanceCount;
+    return true;
+}
+
+local void ApplicationFillDrawListContext(DrawListContext *ctx, RenderContext *rc, u32 image,
+                                          VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout,
+                                          GPUBufferData *vertexBuffer, VkDeviceSize *offsets,
+                                          GPUBufferData *indexBuffer, VkDeviceSize indexOffset,
+                                          VkDescriptorSet *descriptorSets, GPURingBuffer *uniformRing,
+                                          InstanceSet *instances)
+{
+    *ctx = (DrawListContext){0};
+    ctx->pipeline = graphicsPipeline;
+    ctx->layout = pipelineLayout;
+    ctx->vertexBuffer = vertexBuffer;
+    ctx->offsets = offsets;
+    ctx->indexBuffer = indexBuffer;
+    ctx->indexOffset = indexOffset;
+    ctx->descriptorSet = descriptorSets[image];
+    ctx->uniformOffset = GPURingBufferOffset(uniformRing, image);
+    ctx->extent = rc->e;
+    ctx->instanceCount = 1;
+    if (instances && instances->culling)
+    {
+        CullingPass *pass = instances->culling;
+        if (pass->onCPU)
+        {
+            ctx->instanceBuffer = &instances->ring.buffer;
+            ctx->instanceOffset = GPURingBufferOffset(&instances->ring, image);
+        }
+        else
+        {
+            ctx->instanceBuffer = &pass->visible;
+            ctx->instanceOffset = pass->visibleRegionSize * image;
+        }
+        ctx->indirectBuffer = &pass->draws.buffer;
+        ctx->indirectOffset = GPURingBufferOffset(&pass->draws, image);
+    }
+    else if (instances)
+    {
+        ctx->instanceBuffer = &instances->ring.buffer;
+        ctx->instanceOffset = GPURingBufferOffset(&instances->ring, image);
+        ctx->instanceCount = instances->count;
+    }
+}
+
+/* With a recorder the draws go into recorder->sliceCount secondaries per
+   image, returned through outSecondaries with image i's at
+   i * sliceCount. Without one they're recorded inline */
 local VkCommandBuffer *ApplicationSetupCommandBuffers(LogicalDevice *ld, RenderContext *rc,
                                                       VkCommandPool commandPool, VkRenderPass renderpass,
                                                       VkPipeline graphicsPipeline, VkFramebuffer *framebuffers,
                                                       GPUBufferData *vertexBuffer, VkDeviceSize *offsets,
                                                       GPUBufferData *indexBuffer, VkDeviceSize indexOffset,
-                                                      VkPipelineLayout pipelineLayout, VkDescriptorSet *descriptorSets)
+                                                      VkPipelineLayout pipelineLayout, VkDescriptorSet *descriptorSets,
+                                                      GPURingBuffer *uniformRing, InstanceSet *instances,
+                                                      GPUTimer *timer,
+                                                      u32 drawCount, ParallelRecorder *recorder,
+                                                      VkCommandBuffer **outSecondaries)
 {
     VkCommandBuffer *ret = malloc(sizeof(VkCommandBuffer) * rc->imageCount);
+    VkCommandBuffer *secondaries = NULL;
+    if (recorder)
+    {
+        secondaries = calloc(rc->imageCount * recorder->sliceCount, sizeof(secondaries[0]));
+    }
+    *outSecondaries = secondaries;
 
     VkCommandBufferAllocateInfo allocInfo = {0};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -226,16 +1017,47 @@ local VkCommandBuffer *ApplicationSetupCommandBuffers(LogicalDevice *ld, RenderC
         renderPassInfo.clearValueCount = countof(clearValues);
         renderPassInfo.pClearValues = clearValues;
 
-        vkCmdBeginRenderPass(ret[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        DrawListContext ctx;
+        ApplicationFillDrawListContext(&ctx, rc, i, graphicsPipeline, pipelineLayout,
+                                       vertexBuffer, offsets, indexBuffer, indexOffset,
+                                       descriptorSets, uniformRing, instances);
+
+        /* Timer scope i belongs to image i */
+        GPUTimerReset(timer, ret[i], i);
+        GPUTimerBegin(timer, ret[i], i);
+        if (instances && instances->culling && !instances->culling->onCPU)
+        {
+            ApplicationRecordCulling(ret[i], instances, i);
+        }
+        if (recorder)
+        {
+            VkCommandBuffer *imageSecondaries = &secondaries[i * recorder->sliceCount];
+            if (!RecordParallelSecondaries(recorder, renderpass, framebuffers[i], drawCount,
+                                           ApplicationRecordDrawSlice, &ctx, imageSecondaries))
+            {
+                for (u32 j = 0; j < i; j++)
+                {
+                    FreeParallelSecondaries(recorder, &secondaries[j * recorder->sliceCount]);
+                }
+                free(secondaries);
+                *outSecondaries = NULL;
+                free(ret);
+                return NULL;
+            }
+            vkCmdBeginRenderPass(ret[i], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(ret[i], recorder->sliceCount, imageSecondaries);
+        }
+        else
         {
-            vkCmdBindPipeline(ret[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-            vkCmdBindVertexBuffers(ret[i], 0, 1, &vertexBuffer->buffer, offsets);
-            vkCmdBindIndexBuffer(ret[i], indexBuffer->buffer, indexOffset, VK_INDEX_TYPE_UINT16);
-            vkCmdBindDescriptorSets(ret[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-                                    0, 1, &descriptorSets[i], 0, NULL);
-            vkCmdDrawIndexed(ret[i], countof(indices), 1, 0, 0, 0);
+            vkCmdBeginRenderPass(ret[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            ApplicationRecordDrawSlice(ret[i], 0, drawCount, &ctx);
         }
         vkCmdEndRenderPass(ret[i]);
+        if (instances && instances->culling && !instances->culling->onCPU)
+        {
+            ApplicationRecordCullingReadback(ret[i]);
+        }
+        GPUTimerEnd(timer, ret[i], i);
 
         if (vkEndCommandBuffer(ret[i]) != VK_SUCCESS)
         {
@@ -247,38 +1069,144 @@ local VkCommandBuffer *ApplicationSetupCommandBuffers(LogicalDevice *ld, RenderC
     return ret;
 }
 
+/* Records drawCount draws for every image BENCH_RECORDING_REPEATS times into
+   1 to maxSlices secondaries on js and prints the time per pass. Slices go
+   one per job, so they only all run at once when js has the threads */
+local bool ApplicationBenchmarkRecording(LogicalDevice *ld, JobSystem *js, RenderContext *rc,
+                                         VkRenderPass renderpass,
+                                         VkPipeline graphicsPipeline, VkFramebuffer *framebuffers,
+                                         GPUBufferData *vertexBuffer, VkDeviceSize *offsets,
+                                         GPUBufferData *indexBuffer, VkDeviceSize indexOffset,
+                                         VkPipelineLayout pipelineLayout, VkDescriptorSet *descriptorSets,
+                                         GPURingBuffer *uniformRing, InstanceSet *instances,
+                                         u32 drawCount, u32 maxSlices)
+{
+    double singleSliceMs = 0;
+    printf("Recording %" PRIu32 " draws per image, %" PRIu32 " images, %" PRIu32 " job threads\n", drawCount,
+           rc->imageCount, js->threadCount);
+    for (u32 slices = 1; slices <= maxSlices; slices++)
+    {
+        ParallelRecorder recorder;
+        if (!CreateParallelRecorder(ld, js, slices, &recorder))
+        {
+            return false;
+        }
+        VkCommandBuffer *secondaries = malloc(sizeof(secondaries[0]) * slices);
+
+        bool ok = true;
+        double start = GetTimeSeconds();
+        for (u32 repeat = 0; ok && repeat < BENCH_RECORDING_REPEATS; repeat++)
+        {
+            for (u32 i = 0; ok && i < rc->imageCount; i++)
+            {
+                DrawListContext ctx;
+                ApplicationFillDrawListContext(&ctx, rc, i, graphicsPipeline, pipelineLayout,
+                                               vertexBuffer, offsets, indexBuffer, indexOffset,
+                                               descriptorSets, uniformRing, instances);
+
+                ok = RecordParallelSecondaries(&recorder, renderpass, framebuffers[i], drawCount,
+                                               ApplicationRecordDrawSlice, &ctx, secondaries);
+                if (ok)
+                {
+                    FreeParallelSecondaries(&recorder, secondaries);
+                }
+            }
+        }
+        double ms = (GetTimeSeconds() - start) * 1000 / BENCH_RECORDING_REPEATS;
+
+        free(secondaries);
+        DestroyParallelRecorder(&recorder);
+        if (!ok)
+        {
+            return false;
+        }
+
+        if (slices == 1)
+        {
+            singleSliceMs = ms;
+        }
+        printf("%2" PRIu32 " slices: %f ms per pass, %.2fx\n", slices, ms, singleSliceMs / ms);
+    }
+    return true;
+}
+
 local DrawResult ApplicationDrawImage(LogicalDevice *ld, RenderContext *rc,
                                       Uniform *u,
-                                      GPUBufferData *uniformBuffers,
-                                      GPUBufferData *uniformStagingBuffer,
-                                      VkCommandPool bufferCommandPool,
-                                      VkCommandBuffer *commandBuffers, VkSemaphore imageSemaphore,
-                                      VkSemaphore renderSemaphore, VkFence fence)
+                                      GPURingBuffer *uniformRing,
+                                      InstanceSet *instances, float time, JobSystem *js,
+                                      FrameScheduler *fs, u32 slot, double frameStartTime,
+                                      GPUTimer *timer, FrameStats *gpuStats, FrameStats *latencyStats,
+                                      VkCommandBuffer *commandBuffers)
 {
+    VkFence fence = fs->fences[slot];
+    VkSemaphore imageSemaphore = fs->imageAvailableSemaphores[slot];
+    VkSemaphore renderSemaphore = fs->renderFinishedSemaphores[slot];
+    VkFence *imageFences = fs->imageFences;
+
     vkWaitForFences(ld->dev, 1, &fence, VK_TRUE, UINT64_MAX);
+    if (fs->pending[slot])
+    {
+        FrameStatsRecord(latencyStats, (GetTimeSeconds() - fs->startTimes[slot]) * 1000);
+        fs->pending[slot] = false;
+    }
 
+    bool offscreen = rc->swapchain == VK_NULL_HANDLE;
     u32 imageIndex;
-    VkResult result = vkAcquireNextImageKHR(ld->dev, rc->swapchain, UINT64_MAX, imageSemaphore, NULL, &imageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    if (offscreen)
     {
-        return SWAP_CHAIN_OUT_OF_DATE;
+        imageIndex = rc->nextImage;
+        rc->nextImage = (rc->nextImage + 1) % rc->imageCount;
+    }
+    else
+    {
+        VkResult result = vkAcquireNextImageKHR(ld->dev, rc->swapchain, UINT64_MAX, imageSemaphore, NULL, &imageIndex);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            return SWAP_CHAIN_OUT_OF_DATE;
+        }
     }
-    OutputDataToBuffer(ld, uniformStagingBuffer, u, sizeof(*u), 0);
 
-    CopyGPUBuffer(ld, &uniformBuffers[imageIndex], uniformStagingBuffer, sizeof(*u), 0, 0, bufferCommandPool);
+    /* The image's uniform region is only free once the last frame drawn to
+       this image has retired */
+    if (imageFences[imageIndex] != VK_NULL_HANDLE && imageFences[imageIndex] != fence)
+    {
+        vkWaitForFences(ld->dev, 1, &imageFences[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+
+    /* Last time this image was drawn is done, so its timestamps can be read
+       before the command buffer resets them */
+    double gpuMs;
+    if (imageFences[imageIndex] != VK_NULL_HANDLE && GPUTimerCollect(ld, timer, imageIndex, &gpuMs))
+    {
+        FrameStatsRecord(gpuStats, gpuMs);
+    }
+    imageFences[imageIndex] = fence;
+
+    memcpy(GPURingBufferRegion(uniformRing, imageIndex), u, sizeof(*u));
+    if (instances && instances->culling && instances->culling->onCPU)
+    {
+        ApplicationCullInstancesOnCPU(js, instances, u, time, GPURingBufferRegion(&instances->ring, imageIndex),
+                                      GPURingBufferRegion(&instances->culling->draws, imageIndex));
+    }
+    else if (instances)
+    {
+        /* The GPU culls the models itself */
+        ApplicationWriteInstances(js, instances, instances->culling ? NULL : u, time,
+                                  GPURingBufferRegion(&instances->ring, imageIndex));
+    }
 
     VkSubmitInfo submitInfo = {0};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = offscreen ? 0 : 1;
     submitInfo.pWaitSemaphores = &imageSemaphore;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
 
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = offscreen ? 0 : 1;
     submitInfo.pSignalSemaphores = &renderSemaphore;
     vkResetFences(ld->dev, 1, &fence);
 
@@ -286,6 +1214,13 @@ local DrawResult ApplicationDrawImage(LogicalDevice *ld, RenderContext *rc,
     {
         return NO_SUBMIT;
     }
+    fs->startTimes[slot] = frameStartTime;
+    fs->pending[slot] = true;
+
+    if (offscreen)
+    {
+        return NO_ERROR;
+    }
 
     VkPresentInfoKHR presentInfo = {0};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -296,7 +1231,7 @@ local DrawResult ApplicationDrawImage(LogicalDevice *ld, RenderContext *rc,
     presentInfo.pSwapchains = &rc->swapchain;
     presentInfo.pImageIndices = &imageIndex;
 
-    result = vkQueuePresentKHR(ld->presentQueue, &presentInfo);
+    VkResult result = vkQueuePresentKHR(ld->presentQueue, &presentInfo);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
     {
@@ -305,12 +1240,18 @@ local DrawResult ApplicationDrawImage(LogicalDevice *ld, RenderContext *rc,
     return NO_ERROR;
 }
 
-local bool ApplicationCreateSemaphores(LogicalDevice *ld, Semaphores *out, u32 semaphoreCount)
+local bool ApplicationCreateFrameScheduler(LogicalDevice *ld, u32 framesInFlight, u32 imageCount,
+                                          FrameScheduler *out)
 {
-    out->count = semaphoreCount;
-    out->imageAvailableSemaphores = malloc(sizeof(out->imageAvailableSemaphores[0]) * semaphoreCount);
-    out->renderFinishedSemaphores = malloc(sizeof(out->renderFinishedSemaphores[0]) * semaphoreCount);
-    out->fences = malloc(sizeof(out->fences[0]) * semaphoreCount);
+    *out = (FrameScheduler){0};
+    out->framesInFlight = framesInFlight;
+    out->imageAvailableSemaphores = calloc(framesInFlight, sizeof(out->imageAvailableSemaphores[0]));
+    out->renderFinishedSemaphores = calloc(framesInFlight, sizeof(out->renderFinishedSemaphores[0]));
+    out->fences = calloc(framesInFlight, sizeof(out->fences[0]));
+    out->startTimes = calloc(framesInFlight, sizeof(out->startTimes[0]));
+    out->pending = calloc(framesInFlight, sizeof(out->pending[0]));
+    out->imageCount = imageCount;
+    out->imageFences = calloc(imageCount, sizeof(out->imageFences[0]));
 
     VkSemaphoreCreateInfo semaphoreInfo = {0};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -319,7 +1260,7 @@ local bool ApplicationCreateSemaphores(LogicalDevice *ld, Semaphores *out, u32 s
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (u32 i = 0; i < semaphoreCount; i++)
+    for (u32 i = 0; i < framesInFlight; i++)
     {
         if (vkCreateSemaphore(ld->dev, &semaphoreInfo, NULL,
                               &out->imageAvailableSemaphores[i]) != VK_SUCCESS)
@@ -341,6 +1282,39 @@ local bool ApplicationCreateSemaphores(LogicalDevice *ld, Semaphores *out, u32 s
     return true;
 }
 
+/* Nothing may be in flight */
+local void ApplicationDestroyFrameScheduler(LogicalDevice *ld, FrameScheduler *fs)
+{
+    for (u32 i = 0; i < fs->framesInFlight; i++)
+    {
+        vkDestroySemaphore(ld->dev, fs->renderFinishedSemaphores[i], NULL);
+        vkDestroySemaphore(ld->dev, fs->imageAvailableSemaphores[i], NULL);
+        vkDestroyFence(ld->dev, fs->fences[i], NULL);
+    }
+    free(fs->imageAvailableSemaphores);
+    free(fs->renderFinishedSemaphores);
+    free(fs->fences);
+    free(fs->startTimes);
+    free(fs->pending);
+    free(fs->imageFences);
+    *fs = (FrameScheduler){0};
+}
+
+/* Latency is measured from the start of a frame, when input is read, to when
+   its fence is first seen signaled. Polling every frame keeps that close to
+   the real completion time even when nobody waits on the fence */
+local void ApplicationPollFrameLatency(LogicalDevice *ld, FrameScheduler *fs, FrameStats *latencyStats)
+{
+    for (u32 i = 0; i < fs->framesInFlight; i++)
+    {
+        if (fs->pending[i] && vkGetFenceStatus(ld->dev, fs->fences[i]) == VK_SUCCESS)
+        {
+            FrameStatsRecord(latencyStats, (GetTimeSeconds() - fs->startTimes[i]) * 1000);
+            fs->pending[i] = false;
+        }
+    }
+}
+
 local bool CheckValidationLayerSupport()
 {
     u32 layerCount;
@@ -370,7 +1344,8 @@ local bool CheckValidationLayerSupport()
     return true;
 }
 
-local errcode glfwCreateVkInstance(VkInstance *instance, const char *appName, u32 appVer, u32 apiVer)
+local errcode glfwCreateVkInstance(VkInstance *instance, const char *appName, u32 appVer, u32 apiVer,
+                                   bool headless)
 {
     VkApplicationInfo appInfo = {0};
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -381,7 +1356,11 @@ local errcode glfwCreateVkInstance(VkInstance *instance, const char *appName, u3
     appInfo.apiVersion = apiVer;
 
     u32 glfwExtensionCount = 0;
-    const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    const char **glfwExtensions = NULL;
+    if (!headless)
+    {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     VkInstanceCreateInfo cinfo = {0};
     cinfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -397,7 +1376,7 @@ local errcode glfwCreateVkInstance(VkInstance *instance, const char *appName, u3
         cinfo.ppEnabledLayerNames = validationLayers;
     }
 
-    const char **extensions = malloc(sizeof(*extensions) * glfwExtensionCount + 1);
+    const char **extensions = malloc(sizeof(*extensions) * (glfwExtensionCount + 1));
     memcpy(extensions, glfwExtensions, glfwExtensionCount * sizeof(*glfwExtensions));
     extensions[glfwExtensionCount] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
     u32 extensionCount = glfwExtensionCount + 1;
@@ -433,151 +1412,563 @@ local int ApplicationCheckDevice(VkPhysicalDevice dev,
     VkPhysicalDeviceFeatures features;
     vkGetPhysicalDeviceFeatures(dev, &features);
 
-    if (!(devProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
-          devProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU))
+    /* CPU implementations like lavapipe are only picked when there's no GPU */
+    int score;
+    switch (devProps.deviceType)
     {
-        return false;
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score = 3;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score = 2;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        score = 1;
+        break;
+    default:
+        return 0;
     }
 
     if (properIndices &&
-        CheckDeviceExtensionSupport(dev, extensionList, extensionCount) &&
+        (extensionCount == 0 || CheckDeviceExtensionSupport(dev, extensionList, extensionCount)) &&
         features.samplerAnisotropy)
     {
+        if (surf == VK_NULL_HANDLE)
+        {
+            return score;
+        }
         SwapChainSupportDetails sd = QuerySwapChainSupport(dev, surf);
 
         bool validSwapChain = sd.formats && sd.presentModes;
 
         DeleteSwapChainSupportDetails(sd);
-        return validSwapChain;
+        return validSwapChain ? score : 0;
     }
-    return false;
+    return 0;
+}
+
+/* Everything sized to or made from the swapchain images. Any of it may be
+   missing after a failed recreate */
+/* Nothing recorded into them may still be pending */
+local void ApplicationFreeCommandBuffers(LogicalDevice *ld, RenderContext *rc,
+                                         VkCommandPool cpool, VkCommandBuffer *cbuffers,
+                                         ParallelRecorder *recorder, VkCommandBuffer *secondaries)
+{
+    if (recorder && secondaries)
+    {
+        for (u32 i = 0; i < rc->imageCount; i++)
+        {
+            FreeParallelSecondaries(recorder, &secondaries[i * recorder->sliceCount]);
+        }
+        free(secondaries);
+    }
+    if (cbuffers)
+    {
+        vkFreeCommandBuffers(ld->dev, cpool, rc->imageCount, cbuffers);
+        free(cbuffers);
+    }
+}
+
+local void ApplicationDestroySwapchainDependents(LogicalDevice *ld, RenderContext *rc,
+                                                 VkCommandPool cpool,
+                                                 VkCommandBuffer *cbuffers,
+                                                 ParallelRecorder *recorder, VkCommandBuffer *secondaries,
+                                                 VkFramebuffer *framebuffers,
+                                                 DepthResources *dr)
+{
+    ApplicationFreeCommandBuffers(ld, rc, cpool, cbuffers, recorder, secondaries);
+    for (u32 i = 0; framebuffers && i < rc->imageCount; i++)
+    {
+        vkDestroyFramebuffer(ld->dev, framebuffers[i], NULL);
+    }
+    free(framebuffers);
+    DestroyDepthResources(ld, dr);
+    DestroySwapChainData(ld, rc);
 }
 
 local void ApplicationDestroyRenderContextAndRelatedData(LogicalDevice *ld, RenderContext *rc,
                                                          VkCommandPool cpool,
                                                          VkCommandBuffer *cbuffers,
+                                                         ParallelRecorder *recorder, VkCommandBuffer *secondaries,
                                                          VkFramebuffer *framebuffers,
                                                          VkPipeline pipeline, VkPipelineLayout layout,
                                                          VkRenderPass renderpass,
                                                          DepthResources *dr)
 {
+    ApplicationDestroySwapchainDependents(ld, rc, cpool, cbuffers, recorder, secondaries, framebuffers, dr);
+    vkDestroyPipeline(ld->dev, pipeline, NULL);
+    vkDestroyPipelineLayout(ld->dev, layout, NULL);
+    vkDestroyRenderPass(ld->dev, renderpass, NULL);
+}
+
+local void ApplicationDeferSwapchainDependents(DeletionQueue *queue, RenderContext *rc,
+                                               VkCommandPool cpool,
+                                               VkCommandBuffer *cbuffers,
+                                               ParallelRecorder *recorder, VkCommandBuffer *secondaries,
+                                               VkFramebuffer *framebuffers,
+                                               DepthResources *dr)
+{
+    if (recorder)
+    {
+        for (u32 i = 0; i < rc->imageCount; i++)
+        {
+            DeferFreeParallelSecondaries(queue, recorder, &secondaries[i * recorder->sliceCount]);
+        }
+        free(secondaries);
+    }
     for (u32 i = 0; i < rc->imageCount; i++)
     {
-        vkDestroyFramebuffer(ld->dev, framebuffers[i], NULL);
+        DeferDestroyFramebuffer(queue, framebuffers[i]);
     }
     free(framebuffers);
-    vkFreeCommandBuffers(ld->dev, cpool, rc->imageCount, cbuffers);
-    free(cbuffers);
-    vkDestroyPipeline(ld->dev, pipeline, NULL);
-    vkDestroyPipelineLayout(ld->dev, layout, NULL);
-    vkDestroyRenderPass(ld->dev, renderpass, NULL);
-    DestroyDepthResources(ld, dr);
-    DestroySwapChainData(ld, rc);
+    DeferFreeCommandBuffers(queue, cpool, rc->imageCount, cbuffers);
+    DeferDestroyDepthResources(queue, dr);
+    DeferDestroySwapChainData(queue, rc);
+}
+
+/* A minimized window has no size to make a swapchain for. Returns false
+   when the window was closed instead */
+local bool ApplicationWaitWhileMinimized(GLFWwindow *win)
+{
+    int width, height;
+    glfwGetFramebufferSize(win, &width, &height);
+    while ((width == 0 || height == 0) && !glfwWindowShouldClose(win))
+    {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(win, &width, &height);
+    }
+    return !glfwWindowShouldClose(win);
 }
 
+/* On failure nothing swapchain sized is left, the old objects are deferred
+   and whatever was made in their place is destroyed. Teardown is still safe,
+   but there is nothing to draw with */
 local bool ApplicationRecreateRenderContextData(LogicalDevice *ld, RenderContext *rc, GLFWwindow *win,
                                                 VkSurfaceKHR surf, GPUBufferData *vertexBuffers, VkDeviceSize *offsets,
                                                 GPUBufferData *indexBuffer, VkDeviceSize indexOffset,
                                                 VkCommandPool cpool,
-                                                VkCommandPool tempCommandPool,
+                                                VkPipelineCache pipelineCache,
                                                 VkShaderModule vertShader, VkShaderModule fragShader,
                                                 VkDescriptorSetLayout descriptorSetLayouts,
                                                 VkDescriptorSet *descriptorSets,
+                                                GPURingBuffer *uniformRing,
+                                                InstanceSet *instances,
+                                                GPUTimer *timer,
                                                 VkPipelineVertexInputStateCreateInfo *inputInfo,
                                                 VkCommandBuffer **cbuffers,
+                                                u32 drawCount, ParallelRecorder *recorder,
+                                                VkCommandBuffer **secondaries,
                                                 VkFramebuffer **framebuffers,
                                                 DepthResources *dr,
                                                 VkPipeline *pipeline, VkPipelineLayout *layout,
-                                                VkRenderPass *renderpass)
+                                                VkRenderPass *renderpass,
+                                                DeletionQueue *deletionQueue,
+                                                VkPresentModeKHR presentMode)
 {
     if (PROFILING)
     {
         puts("RECREATE SWAPCHAIN");
     }
-    vkDeviceWaitIdle(ld->dev);
-    ApplicationDestroyRenderContextAndRelatedData(ld, rc, cpool, *cbuffers,
-                                                  *framebuffers, *pipeline, *layout,
-                                                  *renderpass, dr);
+
+    /* No vkDeviceWaitIdle. Frames still in flight keep using the old objects,
+       so they go through the deletion queue. The scheduler's imageFences stay
+       as they are since they guard the uniform regions, which outlive the
+       swapchain */
+    RenderContext old = *rc;
+    VkFormat oldFormat = rc->format.format;
     int wwidth, wheight;
     glfwGetWindowSize(win, &wwidth, &wheight);
-    if (CreateRenderContext(ld, surf, wwidth, wheight, rc) != ERROR_SUCCESS)
+    errcode result = CreateRenderContext(ld, surf, wwidth, wheight, old.swapchain, presentMode, rc);
+    ApplicationDeferSwapchainDependents(deletionQueue, &old, cpool, *cbuffers, recorder, *secondaries,
+                                        *framebuffers, dr);
+    *cbuffers = NULL;
+    *secondaries = NULL;
+    *framebuffers = NULL;
+    *dr = (DepthResources){0};
+    if (result != ERROR_SUCCESS)
+    {
+        *rc = (RenderContext){0};
+        return false;
+    }
+
+    /* No upload batch, waiting on one here would stall behind the frames
+       still in flight */
+    if (!CreateDepthResources(ld, rc, NULL, dr))
+    {
+        *dr = (DepthResources){0};
+        DestroySwapChainData(ld, rc);
+        *rc = (RenderContext){0};
+        return false;
+    }
+
+    /* The render pass and pipeline only care about formats, and the depth
+       format doesn't change for a given device. Plain resizes keep them */
+    if (rc->format.format != oldFormat)
+    {
+        DeferDestroyPipeline(deletionQueue, *pipeline);
+        DeferDestroyPipelineLayout(deletionQueue, *layout);
+        DeferDestroyRenderPass(deletionQueue, *renderpass);
+        *renderpass = CreateRenderPass(ld, rc, dr);
+        *pipeline = CreateGraphicsPipeline(ld, pipelineCache,
+                                           vertShader, fragShader,
+                                           *renderpass,
+                                           &descriptorSetLayouts, 1,
+                                           inputInfo, dr, layout);
+    }
+
+    *framebuffers = CreateFrameBuffers(ld, rc, *renderpass, dr);
+    if (*framebuffers)
+    {
+        *cbuffers = ApplicationSetupCommandBuffers(ld, rc, cpool,
+                                                   *renderpass, *pipeline,
+                                                   *framebuffers, vertexBuffers, offsets,
+                                                   indexBuffer, indexOffset, *layout, descriptorSets,
+                                                   uniformRing, instances, timer, drawCount, recorder,
+                                                   secondaries);
+    }
+    if (!*cbuffers)
     {
+        /* None of it was ever submitted */
+        ApplicationDestroySwapchainDependents(ld, rc, cpool, NULL, recorder, *secondaries, *framebuffers, dr);
+        *secondaries = NULL;
+        *framebuffers = NULL;
+        *dr = (DepthResources){0};
+        *rc = (RenderContext){0};
         return false;
     }
+    return true;
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT messageType,
+    const VkDebugUtilsMessengerCallbackDataEXT *callbackData,
+    void *userData)
+{
+    ignore messageSeverity;
+    ignore messageType;
+    ignore userData;
+    if (!streq(callbackData->pMessage, "Added messenger"))
+    {
+        fprintf(stderr, "validation layer: %s\n\n", callbackData->pMessage);
+    }
+    return VK_FALSE;
+}
+
+static VkResult CreateDebugUtilsMessenger(VkInstance instance,
+                                          const VkDebugUtilsMessengerCreateInfoEXT *createInfo,
+                                          VkDebugUtilsMessengerEXT *callback)
+{
+    PFN_vkCreateDebugUtilsMessengerEXT func = (PFN_vkCreateDebugUtilsMessengerEXT)
+        vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+    if (func != NULL)
+    {
+        return func(instance, createInfo, NULL, callback);
+    }
+    else
+    {
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+}
+
+static VkResult ApplicationSetupDebugCallback(VkInstance instance,
+                                              VkDebugUtilsMessengerEXT *callback)
+{
+    VkDebugUtilsMessengerCreateInfoEXT createInfo = {0};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                             VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                             VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    createInfo.pfnUserCallback = DebugCallback;
+
+    return CreateDebugUtilsMessenger(instance, &createInfo, callback);
+}
+
+static void ResizeCallback(GLFWwindow *win, int width, int height)
+{
+    ignore win;
+    ignore width;
+    ignore height;
+    resizeOccurred = true;
+}
+
+local VkPresentModeKHR presentModeCycle[] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+                                             VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+local const char *presentModeNames[] = {"fifo", "fifo-relaxed", "mailbox", "immediate"};
+
+local const char *PresentModeName(VkPresentModeKHR mode)
+{
+    for (u32 i = 0; i < countof(presentModeCycle); i++)
+    {
+        if (presentModeCycle[i] == mode)
+        {
+            return presentModeNames[i];
+        }
+    }
+    return "unknown";
+}
 
-    if (!CreateDepthResources(ld, rc, tempCommandPool, dr))
+static void KeyCallback(GLFWwindow *win, int key, int scancode, int action, int mods)
+{
+    ignore win;
+    ignore scancode;
+    ignore mods;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        u32 next = 0;
+        for (u32 i = 0; i < countof(presentModeCycle); i++)
+        {
+            if (presentModeCycle[i] == requestedPresentMode)
+            {
+                next = (i + 1) % countof(presentModeCycle);
+            }
+        }
+        requestedPresentMode = presentModeCycle[next];
+        presentModeChanged = true;
+    }
+}
+
+local void ApplicationParseArgs(int argc, char **argv, u32 configDepth, Options *out);
+
+/* A config file holds the same options as the command line, separated by
+   whitespace. # starts a comment that runs to the end of the line. Options
+   can keep pointers into the file's text, so it is never freed. depth is
+   how many config files include this one */
+local bool ApplicationParseConfigFile(const char *path, u32 depth, Options *out)
+{
+    isize fileSize;
+    char *file = MapFileToROBuffer(path, NULL, &fileSize);
+    if (!file)
     {
         return false;
     }
-    *renderpass = CreateRenderPass(ld, rc, dr);
-    *pipeline = CreateGraphicsPipeline(ld, rc,
-                                       vertShader, fragShader,
-                                       *renderpass,
-                                       &descriptorSetLayouts, 1,
-                                       inputInfo, dr, layout);
-
-    *framebuffers = CreateFrameBuffers(ld, rc, *renderpass, dr);
-    *cbuffers = ApplicationSetupCommandBuffers(ld, rc, cpool,
-                                               *renderpass, *pipeline,
-                                               *framebuffers, vertexBuffers, offsets,
-                                               indexBuffer, indexOffset, *layout, descriptorSets);
-    return true;
+    char *text = malloc(fileSize + 1);
+    memcpy(text, file, fileSize);
+    text[fileSize] = 0;
+    UnmapMappedBuffer(file, fileSize);
+
+    /* argv[0] is skipped by ApplicationParseArgs */
+    int argc = 1;
+    char **argv = malloc(sizeof(*argv) * (fileSize / 2 + 2));
+    argv[0] = (char *)path;
+    char *c = text;
+    while (*c)
+    {
+        if (*c == '#')
+        {
+            while (*c && *c != '\n')
+            {
+                c++;
+            }
+        }
+        else if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+        {
+            *c++ = 0;
+        }
+        else
+        {
+            argv[argc++] = c;
+            while (*c && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+            {
+                c++;
+            }
+        }
+    }
+
+    ApplicationParseArgs(argc, argv, depth + 1, out);
+    free(argv);
+    return true;
+}
+
+local void ApplicationParseArgs(int argc, char **argv, u32 configDepth, Options *out)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (streq(argv[i], "--bench-mapping"))
+        {
+            out->benchMapping = true;
+        }
+        else if (streq(argv[i], "--headless"))
+        {
+            out->headless = true;
+        }
+        else if (streq(argv[i], "--frames") && i + 1 < argc)
+        {
+            out->frameLimit = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--bench"))
+        {
+            out->bench = true;
+        }
+        else if (streq(argv[i], "--warmup") && i + 1 < argc)
+        {
+            out->warmupFrames = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--bench-csv") && i + 1 < argc)
+        {
+            out->bench = true;
+            out->benchCSV = argv[++i];
+        }
+        else if (streq(argv[i], "--bench-json") && i + 1 < argc)
+        {
+            out->bench = true;
+            out->benchJSON = argv[++i];
+        }
+        else if (streq(argv[i], "--frames-in-flight") && i + 1 < argc)
+        {
+            out->framesInFlight = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--draws") && i + 1 < argc)
+        {
+            out->drawCount = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--record-threads") && i + 1 < argc)
+        {
+            out->recordThreads = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--bench-recording"))
+        {
+            out->benchRecording = true;
+        }
+        else if (streq(argv[i], "--instances") && i + 1 < argc)
+        {
+            out->instanceCount = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--instance-sweep"))
+        {
+            out->instanceSweep = true;
+        }
+        else if (streq(argv[i], "--gpu-cull"))
+        {
+            out->gpuCull = true;
+        }
+        else if (streq(argv[i], "--cpu-cull"))
+        {
+            out->cpuCull = true;
+        }
+        else if (streq(argv[i], "--no-mips"))
+        {
+            out->noMips = true;
+        }
+        else if (streq(argv[i], "--raw-textures"))
+        {
+            out->rawTextures = true;
+        }
+        else if (streq(argv[i], "--threads") && i + 1 < argc)
+        {
+            out->threads = strtoul(argv[++i], NULL, 10);
+        }
+        else if (streq(argv[i], "--texture-cache") && i + 1 < argc)
+        {
+            out->textureCache = argv[++i];
+        }
+        else if (streq(argv[i], "--no-texture-cache"))
+        {
+            out->textureCache = NULL;
+        }
+        else if (streq(argv[i], "--latency-sweep"))
+        {
+            out->latencySweep = true;
+        }
+        else if (streq(argv[i], "--present-mode") && i + 1 < argc)
+        {
+            i++;
+            bool found = false;
+            for (u32 j = 0; j < countof(presentModeNames); j++)
+            {
+                if (streq(argv[i], presentModeNames[j]))
+                {
+                    out->presentMode = presentModeCycle[j];
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                printf("Unknown present mode %s\n", argv[i]);
+            }
+        }
+        else if (streq(argv[i], "--config") && i + 1 < argc)
+        {
+            if (configDepth >= MAX_CONFIG_DEPTH)
+            {
+                printf("Not reading config %s, configs nest more than %d deep\n", argv[++i], MAX_CONFIG_DEPTH);
+            }
+            else if (!ApplicationParseConfigFile(argv[++i], configDepth, out))
+            {
+                printf("Could not read config %s\n", argv[i]);
+            }
+        }
+        else if (streq(argv[i], "--cold-pipeline-cache"))
+        {
+            out->coldPipelineCache = true;
+        }
+        else if (streq(argv[i], "--gpu-csv") && i + 1 < argc)
+        {
+            out->bench = true;
+            out->gpuCSV = argv[++i];
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+        }
+    }
 }
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
-    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-    VkDebugUtilsMessageTypeFlagsEXT messageType,
-    const VkDebugUtilsMessengerCallbackDataEXT *callbackData,
-    void *userData)
+/* Compares mapping on every write, only the range being written, against a
+   buffer mapped once at creation. Has to run before anything else maps host
+   visible memory, otherwise the block is already mapped and both paths end
+   up as a plain memcpy */
+local void ApplicationBenchmarkBufferWrites(LogicalDevice *ld)
 {
-    ignore messageSeverity;
-    ignore messageType;
-    ignore userData;
-    if (!streq(callbackData->pMessage, "Added messenger"))
-    {
-        fprintf(stderr, "validation layer: %s\n\n", callbackData->pMessage);
-    }
-    return VK_FALSE;
-}
+    size_t sizes[] = {sizeof(Uniform), 64 * 1024, 1024 * 1024};
+    size_t maxSize = sizes[countof(sizes) - 1];
+    u8 *data = malloc(maxSize);
+    memset(data, 0xab, maxSize);
 
-static VkResult CreateDebugUtilsMessenger(VkInstance instance,
-                                          const VkDebugUtilsMessengerCreateInfoEXT *createInfo,
-                                          VkDebugUtilsMessengerEXT *callback)
-{
-    PFN_vkCreateDebugUtilsMessengerEXT func = (PFN_vkCreateDebugUtilsMessengerEXT)
-        vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-    if (func != NULL)
-    {
-        return func(instance, createInfo, NULL, callback);
-    }
-    else
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (u32 i = 0; i < countof(sizes); i++)
     {
-        return VK_ERROR_EXTENSION_NOT_PRESENT;
-    }
-}
+        size_t size = sizes[i];
+        u32 iterations = size > 64 * 1024 ? 1000 : 10000;
 
-static VkResult ApplicationSetupDebugCallback(VkInstance instance,
-                                              VkDebugUtilsMessengerEXT *callback)
-{
-    VkDebugUtilsMessengerCreateInfoEXT createInfo = {0};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-                             VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-                             VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-    createInfo.pfnUserCallback = DebugCallback;
+        GPUBufferData buffer;
+        if (CreateGPUBufferData(ld, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, properties,
+                                &buffer) != VK_SUCCESS)
+        {
+            puts("Could not create benchmark buffer");
+            break;
+        }
+        double start = GetTimeSeconds();
+        for (u32 j = 0; j < iterations; j++)
+        {
+            OutputDataToBuffer(ld, &buffer, data, size, 0);
+        }
+        double mapPerWrite = GetTimeSeconds() - start;
+        DestroyGPUBufferInfo(ld, &buffer);
 
-    return CreateDebugUtilsMessenger(instance, &createInfo, callback);
-}
+        if (CreateMappedGPUBufferData(ld, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, properties,
+                                      &buffer) != VK_SUCCESS)
+        {
+            puts("Could not create benchmark buffer");
+            break;
+        }
+        start = GetTimeSeconds();
+        for (u32 j = 0; j < iterations; j++)
+        {
+            OutputDataToBuffer(ld, &buffer, data, size, 0);
+        }
+        double persistent = GetTimeSeconds() - start;
+        DestroyGPUBufferInfo(ld, &buffer);
 
-static void ResizeCallback(GLFWwindow *win, int width, int height)
-{
-    ignore win;
-    ignore width;
-    ignore height;
-    resizeOccurred = true;
+        printf("%8zu bytes: map per write %10.3f us, persistent %10.3f us\n", size,
+               mapPerWrite * 1000000 / iterations, persistent * 1000000 / iterations);
+    }
+    free(data);
 }
 
 static void DestroyDebugUtilsMessenger(VkInstance instance, VkDebugUtilsMessengerEXT callback)
@@ -591,26 +1982,81 @@ static void DestroyDebugUtilsMessenger(VkInstance instance, VkDebugUtilsMessenge
 
 int main(int argc, char **argv)
 {
+    double startupTime = GetTimeSeconds();
     int returnValue = ERROR_SUCCESS;
-    ignore argc, ignore argv;
+    Options options = {0};
+    options.bench = PROFILING;
+    options.presentMode = USE_MAILBOX_RENDERER ? VK_PRESENT_MODE_MAILBOX_KHR : VK_PRESENT_MODE_FIFO_KHR;
+    options.textureCache = TEXTURE_CACHE_LOC;
+    ApplicationParseArgs(argc, argv, 0, &options);
+    requestedPresentMode = options.presentMode;
+    if (options.latencySweep && options.instanceSweep)
+    {
+        puts("--latency-sweep and --instance-sweep don't combine, only sweeping latency");
+        options.instanceSweep = false;
+    }
+    bool sweep = options.latencySweep || options.instanceSweep;
+    if (sweep && options.frameLimit == 0)
+    {
+        options.frameLimit = DEFAULT_SWEEP_FRAMES;
+    }
+    if (options.headless && options.frameLimit == 0)
+    {
+        options.frameLimit = DEFAULT_HEADLESS_FRAMES;
+    }
+    if (options.framesInFlight == 0)
+    {
+        options.framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    }
+    if (options.drawCount == 0)
+    {
+        options.drawCount = options.benchRecording ? DEFAULT_BENCH_DRAWS : 1;
+    }
+    if (options.benchRecording && options.recordThreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        options.recordThreads = cpus > 0 ? cpus : 1;
+    }
 
-    glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    /* glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); */
+    /* Both sweeps have the same number of runs so they can share results */
+    u32 sweepFramesInFlight[] = {1, 2, 3};
+    u32 sweepInstanceCounts[countof(sweepFramesInFlight)] = {1000, 10000, 100000};
+    u32 instanceCapacity = options.instanceSweep ? sweepInstanceCounts[countof(sweepInstanceCounts) - 1]
+                                                 : options.instanceCount;
+    if ((options.gpuCull || options.cpuCull) && instanceCapacity == 0)
+    {
+        puts("Culling needs --instances or --instance-sweep, drawing without it");
+        options.gpuCull = false;
+        options.cpuCull = false;
+    }
+    if (options.gpuCull && options.cpuCull)
+    {
+        puts("--gpu-cull and --cpu-cull both given, culling on the GPU");
+        options.cpuCull = false;
+    }
 
-    GLFWwindow *win = glfwCreateWindow(WIDTH, HEIGHT, "vulkan", NULL, NULL);
-    if (win == NULL)
+    GLFWwindow *win = NULL;
+    if (!options.headless)
     {
-        puts("ERROR! Could not create window");
-        returnValue = ERROR_INITIALIZATION_FAILURE;
-        return returnValue;
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        /* glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); */
+
+        win = glfwCreateWindow(WIDTH, HEIGHT, "vulkan", NULL, NULL);
+        if (win == NULL)
+        {
+            puts("ERROR! Could not create window");
+            returnValue = ERROR_INITIALIZATION_FAILURE;
+            return returnValue;
+        }
+        glfwSetFramebufferSizeCallback(win, ResizeCallback);
+        glfwSetKeyCallback(win, KeyCallback);
     }
-    glfwSetFramebufferSizeCallback(win, ResizeCallback);
 
     VkInstance instance;
     if (glfwCreateVkInstance(&instance, "Vulkan tutorial",
                              VK_MAKE_VERSION(0, 0, 0),
-                             VK_API_VERSION_1_0))
+                             VK_API_VERSION_1_0, options.headless))
 
     {
         puts("ERROR! could not create instance");
@@ -620,8 +2066,8 @@ int main(int argc, char **argv)
     VkDebugUtilsMessengerEXT callback = VK_NULL_HANDLE;
 
     ApplicationSetupDebugCallback(instance, &callback);
-    VkSurfaceKHR surf;
-    if (glfwCreateWindowSurface(instance, win, NULL, &surf) != VK_SUCCESS)
+    VkSurfaceKHR surf = VK_NULL_HANDLE;
+    if (!options.headless && glfwCreateWindowSurface(instance, win, NULL, &surf) != VK_SUCCESS)
     {
         puts("NOT ABLE TO CREATE SURFACE");
         returnValue = ERROR_INITIALIZATION_FAILURE;
@@ -631,7 +2077,7 @@ int main(int argc, char **argv)
     const char *extensionList[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
     VkPhysicalDevice physdev = GetVkPhysicalDevice(instance, surf, extensionList,
-                                                   countof(extensionList),
+                                                   options.headless ? 0 : countof(extensionList),
                                                    ApplicationCheckDevice);
     if (physdev == VK_NULL_HANDLE)
     {
@@ -640,8 +2086,12 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physdev, &supportedFeatures);
     VkPhysicalDeviceFeatures features = {0};
     features.samplerAnisotropy = VK_TRUE;
+    /* For cooked textures, which fall back to decoding without it */
+    features.textureCompressionBC = supportedFeatures.textureCompressionBC;
     LogicalDevice ld;
     if (CreateLogicalDevice(physdev, &features, surf,
                             &ld) != ERROR_SUCCESS)
@@ -651,11 +2101,41 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
-    int wwidth, wheight;
-    glfwGetWindowSize(win, &wwidth, &wheight);
+    if (options.benchMapping)
+    {
+        ApplicationBenchmarkBufferWrites(&ld);
+        DestroyLogicalDevice(&ld);
+        vkDestroySurfaceKHR(instance, surf, NULL);
+        if (callback != VK_NULL_HANDLE)
+        {
+            DestroyDebugUtilsMessenger(instance, callback);
+        }
+        vkDestroyInstance(instance, NULL);
+        if (win)
+        {
+            glfwDestroyWindow(win);
+            glfwTerminate();
+        }
+        return returnValue;
+    }
 
     RenderContext rc = {0};
-    if (CreateRenderContext(&ld, surf, wwidth, wheight, &rc) != ERROR_SUCCESS)
+    errcode rcResult;
+    if (options.headless)
+    {
+        rcResult = CreateOffscreenRenderContext(&ld, WIDTH, HEIGHT, OFFSCREEN_IMAGE_COUNT, &rc);
+    }
+    else
+    {
+        int wwidth, wheight;
+        glfwGetWindowSize(win, &wwidth, &wheight);
+        rcResult = CreateRenderContext(&ld, surf, wwidth, wheight, VK_NULL_HANDLE, requestedPresentMode, &rc);
+        if (rcResult == ERROR_SUCCESS)
+        {
+            printf("Present mode %s\n", PresentModeName(rc.presentMode));
+        }
+    }
+    if (rcResult != ERROR_SUCCESS)
     {
         puts("NOT ABLE TO CREATE SWAPCHAIN");
         returnValue = ERROR_INITIALIZATION_FAILURE;
@@ -663,7 +2143,8 @@ int main(int argc, char **argv)
     }
 
     isize vertShaderSize;
-    void *vertShaderCode = MapFileToROBuffer(VERT_SHADER_LOC, NULL, &vertShaderSize);
+    void *vertShaderCode = MapFileToROBuffer(instanceCapacity ? INSTANCED_VERT_SHADER_LOC : VERT_SHADER_LOC,
+                                             NULL, &vertShaderSize);
     if (!vertShaderCode)
     {
         puts("Could not find vertex shader");
@@ -704,8 +2185,32 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
+    /* Stays VK_NULL_HANDLE on devices without a transfer only queue, which
+       keeps uploads on the graphics queue */
+    VkCommandPool transferCommandPool = CreateTransferCommandPool(&ld, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+    /* Scope i times the render pass of image i, for as many images as any
+       swapchain can have. The one after those times the startup uploads */
+    u32 uploadTimerScope = MAX_SWAPCHAIN_IMAGES;
+    GPUTimer gpuTimer = {0};
+    if ((options.bench || options.instanceSweep) &&
+        !CreateGPUTimer(&ld, MAX_SWAPCHAIN_IMAGES + 1, &gpuTimer))
+    {
+        puts("GPU timestamps not supported, only timing the CPU");
+    }
+
+    /* Every startup upload and layout transition goes into this one
+       submission */
+    UploadBatch uploadBatch;
+    if (!BeginUploadBatch(&ld, tempCommandPool, transferCommandPool, &uploadBatch))
+    {
+        puts("Could not begin upload batch");
+        return returnValue;
+    }
+    UploadBatchTimeWith(&ld, &uploadBatch, &gpuTimer, uploadTimerScope);
+
     DepthResources depthResources;
-    if (!CreateDepthResources(&ld, &rc, tempCommandPool, &depthResources))
+    if (!CreateDepthResources(&ld, &rc, &uploadBatch, &depthResources))
     {
         puts("Could not create depth resources");
     }
@@ -718,11 +2223,16 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
-    VkVertexInputBindingDescription bindingDescription = {0};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    VkVertexInputAttributeDescription attributeDescription[3] = {0};
+    VkVertexInputBindingDescription bindingDescription[2] = {0};
+    bindingDescription[0].binding = 0;
+    bindingDescription[0].stride = sizeof(Vertex);
+    bindingDescription[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    /* Instance model matrices, one vec4 column per location */
+    bindingDescription[1].binding = 1;
+    bindingDescription[1].stride = sizeof(Mat4f);
+    bindingDescription[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    VkVertexInputAttributeDescription attributeDescription[7] = {0};
 
     attributeDescription[0].binding = 0;
     attributeDescription[0].location = 0;
@@ -739,16 +2249,24 @@ int main(int argc, char **argv)
     attributeDescription[2].format = VK_FORMAT_R32G32_SFLOAT;
     attributeDescription[2].offset = offsetof(Vertex, uv);
 
+    for (u32 i = 0; i < 4; i++)
+    {
+        attributeDescription[3 + i].binding = 1;
+        attributeDescription[3 + i].location = 3 + i;
+        attributeDescription[3 + i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescription[3 + i].offset = sizeof(f32) * 4 * i;
+    }
+
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {0};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexAttributeDescriptionCount = countof(attributeDescription);
+    vertexInputInfo.vertexAttributeDescriptionCount = instanceCapacity ? 7 : 3;
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescription;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = instanceCapacity ? 2 : 1;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescription;
 
     VkDescriptorSetLayoutBinding layoutBindings[2] = {0};
     layoutBindings[0].binding = 0;
-    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     layoutBindings[0].descriptorCount = 1;
     layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -769,8 +2287,17 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    bool warmPipelineCache = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(&ld, options.coldPipelineCache ? NULL : PIPELINE_CACHE_LOC,
+                                                      &warmPipelineCache);
+    if (pipelineCache == VK_NULL_HANDLE)
+    {
+        puts("Could not create pipeline cache");
+    }
+
+    double pipelineStartTime = GetTimeSeconds();
     VkPipelineLayout layout;
-    VkPipeline pipeline = CreateGraphicsPipeline(&ld, &rc,
+    VkPipeline pipeline = CreateGraphicsPipeline(&ld, pipelineCache,
                                                  vertShader, fragShader, renderpass,
                                                  &descriptorSetLayout, 1,
                                                  &vertexInputInfo, &depthResources, &layout);
@@ -780,6 +2307,7 @@ int main(int argc, char **argv)
         returnValue = ERROR_INITIALIZATION_FAILURE;
         return returnValue;
     }
+    double pipelineTime = GetTimeSeconds() - pipelineStartTime;
 
     VkFramebuffer *framebuffers = CreateFrameBuffers(&ld, &rc, renderpass, &depthResources);
     if (framebuffers == NULL)
@@ -788,19 +2316,6 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
-    GPUBufferData stagingBuffer;
-
-    if (CreateGPUBufferData(&ld, sizeof(vertices),
-                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                            &stagingBuffer) != VK_SUCCESS)
-    {
-        puts("Could not set up staging buffer");
-        return 1;
-    }
-
-    OutputDataToBuffer(&ld, &stagingBuffer, vertices, sizeof(vertices), 0);
-
     GPUBufferData vertexBuffer;
     if (CreateGPUBufferData(&ld, sizeof(vertices),
                             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
@@ -811,21 +2326,12 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    CopyGPUBuffer(&ld, &vertexBuffer, &stagingBuffer, sizeof(vertices), 0, 0, tempCommandPool);
-
-    DestroyGPUBufferInfo(&ld, &stagingBuffer);
-
-    if (CreateGPUBufferData(&ld, sizeof(indices),
-                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                            &stagingBuffer) != VK_SUCCESS)
+    if (!UploadBatchStageBuffer(&ld, &uploadBatch, &vertexBuffer, vertices, sizeof(vertices), 0))
     {
-        puts("Could not set up staging buffer 2");
+        puts("Could not set up staging buffer");
         return 1;
     }
 
-    OutputDataToBuffer(&ld, &stagingBuffer, indices, sizeof(indices), 0);
-
     GPUBufferData indexBuffer;
     if (CreateGPUBufferData(&ld, sizeof(indices),
                             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
@@ -836,54 +2342,159 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    CopyGPUBuffer(&ld, &indexBuffer, &stagingBuffer, sizeof(indices), 0, 0, tempCommandPool);
-    DestroyGPUBufferInfo(&ld, &stagingBuffer);
+    if (!UploadBatchStageBuffer(&ld, &uploadBatch, &indexBuffer, indices, sizeof(indices), 0))
+    {
+        puts("Could not set up staging buffer 2");
+        return 1;
+    }
 
-    GPUBufferData *uniformBuffers = malloc(sizeof(*uniformBuffers) * rc.imageCount);
+    /* One uniform region per swapchain image. The command buffer for an image
+       always binds that image's region. This and the rest of the per image
+       state is sized for MAX_SWAPCHAIN_IMAGES, a recreated swapchain can
+       have more images than this one */
+    GPURingBuffer uniformRing;
+    if (!CreateGPURingBuffer(&ld, sizeof(Uniform), MAX_SWAPCHAIN_IMAGES,
+                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &uniformRing))
+    {
+        puts("could not set up uniform buffers");
+        return 1;
+    }
 
-    for (u32 i = 0; i < rc.imageCount; i++)
+    InstanceSet instanceSet = {0};
+    InstanceSet *instances = NULL;
+    if (instanceCapacity)
     {
-        if (CreateGPUBufferData(&ld, sizeof(Uniform),
-                                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &uniformBuffers[i]) !=
-            VK_SUCCESS)
+        /* With culling the compute pass reads them and the draw reads its
+           compacted copy instead */
+        VkBufferUsageFlags usage = options.gpuCull ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                                   : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        if (!CreateGPURingBuffer(&ld, sizeof(Mat4f) * instanceCapacity, MAX_SWAPCHAIN_IMAGES, usage,
+                                 &instanceSet.ring))
         {
-            puts("could not set up uniform buffers");
+            puts("could not set up instance buffers");
             return 1;
         }
+        instanceSet.capacity = instanceCapacity;
+        instanceSet.count = options.instanceSweep ? sweepInstanceCounts[0] : options.instanceCount;
+        instanceSet.extent = options.gpuCull || options.cpuCull ? CULL_GRID_EXTENT : 1;
+        if (!options.gpuCull)
+        {
+            instanceSet.models = malloc(sizeof(Mat4f) * instanceCapacity);
+            if (!instanceSet.models)
+            {
+                puts("could not set up instance buffers");
+                return 1;
+            }
+        }
+        instances = &instanceSet;
     }
 
-    GPUBufferData uniformStagingBuffer;
-    if (CreateGPUBufferData(&ld, sizeof(Uniform), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformStagingBuffer) != VK_SUCCESS)
+    CullingPass cullingPass = {0};
+    if (options.gpuCull)
     {
-        puts("could not set up uniform buffers");
-        return 1;
+        isize cullShaderSize;
+        void *cullShaderCode = MapFileToROBuffer(CULL_SHADER_LOC, NULL, &cullShaderSize);
+        if (!cullShaderCode)
+        {
+            puts("Could not find culling shader");
+            return 1;
+        }
+        VkShaderModule cullShader = CreateVkShaderModule(&ld, cullShaderCode, cullShaderSize - 1);
+        UnmapMappedBuffer(cullShaderCode, cullShaderSize);
+
+        bool created = cullShader != VK_NULL_HANDLE &&
+                       ApplicationCreateCullingPass(&ld, pipelineCache, false, cullShader,
+                                                    &uniformRing, &instanceSet, &cullingPass);
+        /* The pipeline keeps what it needs */
+        vkDestroyShaderModule(ld.dev, cullShader, NULL);
+        if (!created)
+        {
+            puts("Could not set up GPU culling");
+            return 1;
+        }
+        instanceSet.culling = &cullingPass;
+    }
+    else if (options.cpuCull)
+    {
+        if (!ApplicationCreateCullingPass(&ld, pipelineCache, true, VK_NULL_HANDLE,
+                                          &uniformRing, &instanceSet, &cullingPass))
+        {
+            puts("Could not set up CPU culling");
+            return 1;
+        }
+        printf("Culling on the CPU with %s\n", CPUHasAVX() ? "AVX" : "SSE");
+        instanceSet.culling = &cullingPass;
     }
 
     VkDescriptorPoolSize poolSizes[2] = {0};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = rc.imageCount;
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = MAX_SWAPCHAIN_IMAGES;
 
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = rc.imageCount;
+    poolSizes[1].descriptorCount = MAX_SWAPCHAIN_IMAGES;
 
-    VkDescriptorPool descriptorPool = CreateDescriptorPool(&ld, &rc, countof(poolSizes), poolSizes);
+    VkDescriptorPool descriptorPool = CreateDescriptorPool(&ld, MAX_SWAPCHAIN_IMAGES, countof(poolSizes),
+                                                           poolSizes);
     if (!descriptorPool)
     {
         puts("Error could not create descriptor pool");
         return 1;
     }
 
+    if (options.threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        options.threads = cpus > 0 ? cpus : 1;
+    }
+    if (options.textureCache && !CreateTextureCacheDir(options.textureCache))
+    {
+        printf("Couldn't create %s, decoding textures without a cache\n", options.textureCache);
+        options.textureCache = NULL;
+    }
+    /* The only thread pool. Texture decoding uses it now, the frame loop and
+       command recording later */
+    JobSystem jobs;
+    if (!CreateJobSystem(options.threads, &jobs))
+    {
+        puts("Couldn't start job system threads");
+        return 1;
+    }
+
+    double textureStart = GetTimeSeconds();
     Texture tex = {0};
-    if (LoadTexture(&ld, "textures/container.jpg", tempCommandPool, &tex) != ERROR_SUCCESS)
+    const char *texturePaths[] = {TEXTURE_LOC};
+    CookedTextureResult cookedResult = options.rawTextures
+                                           ? COOKED_TEXTURE_MISSING
+                                           : LoadCookedTexture(&ld, COOKED_TEXTURE_LOC, &uploadBatch,
+                                                               !options.noMips, &tex);
+    errcode textureResult = cookedResult == COOKED_TEXTURE_LOADED ? ERROR_SUCCESS : ERROR_EXTERNAL_LIB;
+    if (cookedResult == COOKED_TEXTURE_UNSUPPORTED)
+    {
+        printf("The device can't sample %s, decoding %s instead\n", COOKED_TEXTURE_LOC, TEXTURE_LOC);
+    }
+    if (cookedResult == COOKED_TEXTURE_MISSING || cookedResult == COOKED_TEXTURE_UNSUPPORTED)
+    {
+        textureResult = LoadTextures(&ld, &jobs, texturePaths, countof(texturePaths), options.textureCache,
+                                     &uploadBatch, !options.noMips, &tex);
+    }
+    if (textureResult != ERROR_SUCCESS)
     {
         puts("Couldn't load texture");
         return 1;
     }
+    printf("Texture %" PRIu32 "x%" PRIu32 "%s, %" PRIu32 " mip levels%s, %zu KiB in %.1f ms\n", tex.x, tex.y,
+           tex.cooked ? " cooked" : tex.cached ? " from the cache" : "", tex.mipLevels,
+           tex.mipLevels == 1 || tex.cooked ? "" : tex.mipsOnCPU ? " filtered on the CPU" : " blitted on the GPU",
+           (size_t)(tex.bytes / 1024), (GetTimeSeconds() - textureStart) * 1000);
+
+    if (!SubmitUploadBatch(&ld, &uploadBatch))
+    {
+        puts("Couldn't submit uploads");
+        return 1;
+    }
 
-    VkDescriptorSet *descriptorSets = AllocateDescriptorSets(&ld, &rc,
-                                                             descriptorPool, uniformBuffers,
+    VkDescriptorSet *descriptorSets = AllocateDescriptorSets(&ld, MAX_SWAPCHAIN_IMAGES,
+                                                             descriptorPool, &uniformRing,
                                                              descriptorSetLayout, sizeof(Uniform),
                                                              tex.imageView, tex.sampler);
 
@@ -894,13 +2505,28 @@ int main(int argc, char **argv)
     }
     VkDeviceSize offsets[1] = {0};
 
+    ParallelRecorder recorder = {0};
+    ParallelRecorder *activeRecorder = NULL;
+    if (options.recordThreads && !options.benchRecording)
+    {
+        if (!CreateParallelRecorder(&ld, &jobs, options.recordThreads, &recorder))
+        {
+            puts("Could not create command recording pools");
+            return returnValue;
+        }
+        activeRecorder = &recorder;
+    }
+
+    VkCommandBuffer *secondaryCommandBuffers;
     VkCommandBuffer *commandBuffers =
         ApplicationSetupCommandBuffers(
             &ld, &rc, commandPool,
             renderpass, pipeline,
             framebuffers,
             &vertexBuffer, offsets,
-            &indexBuffer, 0, layout, descriptorSets);
+            &indexBuffer, 0, layout, descriptorSets,
+            &uniformRing, instances, &gpuTimer,
+            options.drawCount, activeRecorder, &secondaryCommandBuffers);
 
     if (commandBuffers == NULL)
     {
@@ -908,86 +2534,293 @@ int main(int argc, char **argv)
         return returnValue;
     }
 
-    Semaphores s;
-    if (!ApplicationCreateSemaphores(&ld, &s, MAX_CONCURRENT_FRAMES))
+    /* The uploads ran while the rest of setup was going on. Staging memory can
+       go once they're done */
+    DestroyUploadBatch(&ld, &uploadBatch);
+
+    double uploadGPUMs;
+    if (GPUTimerCollect(&ld, &gpuTimer, uploadTimerScope, &uploadGPUMs))
+    {
+        printf("GPU upload %f ms\n", uploadGPUMs);
+    }
+
+    FrameStats frameStats = {0};
+    FrameStats gpuStats = {0};
+    FrameStats latencyStats = {0};
+    u32 statsCapacity = options.frameLimit ? options.frameLimit : DEFAULT_BENCH_CAPACITY;
+    if ((options.bench || sweep) &&
+        (!CreateFrameStats(statsCapacity, options.warmupFrames, &frameStats) ||
+         !CreateFrameStats(statsCapacity, options.warmupFrames, &gpuStats) ||
+         !CreateFrameStats(statsCapacity, options.warmupFrames, &latencyStats)))
     {
-        puts("Could not get semaphores");
-        return returnValue;
+        puts("Could not allocate frame statistics");
+        return 1;
     }
+
+    printf("Startup %f ms, pipeline creation %f ms with a %s pipeline cache\n",
+           (GetTimeSeconds() - startupTime) * 1000, pipelineTime * 1000,
+           warmPipelineCache ? "warm" : "cold");
+
+    /* Frame values are frameCount after it's been bumped for the frame. It
+       keeps counting across sweep runs so they only ever go up */
+    DeletionQueue deletionQueue = {0};
     u32 frameCount = 0;
 
-    double lastFrameTime = glfwGetTime();
+    FrameStatsSummary sweepFrameTimes[countof(sweepFramesInFlight)] = {0};
+    FrameStatsSummary sweepLatencies[countof(sweepFramesInFlight)] = {0};
+    FrameStatsSummary sweepGPUTimes[countof(sweepFramesInFlight)] = {0};
+    u32 runCount = sweep ? countof(sweepFramesInFlight) : 1;
+
+    if (options.benchRecording)
+    {
+        if (!ApplicationBenchmarkRecording(&ld, &jobs, &rc, renderpass, pipeline, framebuffers,
+                                           &vertexBuffer, offsets, &indexBuffer, 0,
+                                           layout, descriptorSets, &uniformRing, instances,
+                                           options.drawCount, options.recordThreads))
+        {
+            puts("Could not benchmark command recording");
+        }
+        runCount = 0;
+    }
+
     float totalTime = 0;
-    while (!glfwWindowShouldClose(win))
+    /* Set when a recreate failed, there's nothing left to draw with */
+    bool swapchainLost = false;
+    for (u32 run = 0; run < runCount; run++)
     {
-        /* Input */
-        double frameStartTime = glfwGetTime();
-        float dt = (float)frameStartTime - (float)lastFrameTime;
-        totalTime += dt;
-        lastFrameTime = frameStartTime;
+        FrameScheduler fs;
+        u32 framesInFlight = options.latencySweep ? sweepFramesInFlight[run] : options.framesInFlight;
+        if (!ApplicationCreateFrameScheduler(&ld, framesInFlight, MAX_SWAPCHAIN_IMAGES, &fs))
+        {
+            puts("Could not create frame scheduler");
+            return returnValue;
+        }
+        ResetFrameStats(&frameStats);
+        ResetFrameStats(&gpuStats);
+        ResetFrameStats(&latencyStats);
+
+        /* The device went idle at the end of the last run, so the command
+           buffers can be rerecorded with the new instance count in place */
+        if (options.instanceSweep && run > 0)
+        {
+            instanceSet.count = sweepInstanceCounts[run];
+            ApplicationFreeCommandBuffers(&ld, &rc, commandPool, commandBuffers,
+                                          activeRecorder, secondaryCommandBuffers);
+            commandBuffers = ApplicationSetupCommandBuffers(&ld, &rc, commandPool,
+                                                            renderpass, pipeline, framebuffers,
+                                                            &vertexBuffer, offsets,
+                                                            &indexBuffer, 0, layout, descriptorSets,
+                                                            &uniformRing, instances, &gpuTimer,
+                                                            options.drawCount, activeRecorder,
+                                                            &secondaryCommandBuffers);
+            if (commandBuffers == NULL)
+            {
+                puts("Could not properly set up command buffers");
+                return returnValue;
+            }
+        }
+
+        u32 runFrames = 0;
+        u32 runLength = options.frameLimit ? options.frameLimit + options.warmupFrames : 0;
+        double lastFrameTime = GetTimeSeconds();
+        double runStartTime = lastFrameTime;
+        while ((runLength == 0 || runFrames < runLength) &&
+               (options.headless || !glfwWindowShouldClose(win)))
+        {
+            /* Input */
+            double frameStartTime = GetTimeSeconds();
+            double frameTime = frameStartTime - lastFrameTime;
+            float dt = (float)frameTime;
+            totalTime += dt;
+            lastFrameTime = frameStartTime;
+
+            /* Each frame is recorded when the next one starts, the last one
+               after the loop. The first interval is just setup time */
+            if (runFrames > 0)
+            {
+                FrameStatsRecord(&frameStats, frameTime * 1000);
+            }
+            ApplicationPollFrameLatency(&ld, &fs, &latencyStats);
 
-        struct timespec start;
-        clock_gettime(CLOCK_REALTIME, &start);
+            u32 slot = frameCount++ % fs.framesInFlight;
+            runFrames++;
+            DeletionQueueSetFrame(&deletionQueue, frameCount);
 
-        u32 sindex = frameCount++ % s.count;
+            if (!options.headless)
+            {
+                glfwPollEvents();
+            }
+
+            /* Update */
+            Uniform u = {
+                .proj = CreatePerspectiveMat4f(DegToRad(45), rc.e.width / (float)rc.e.height, .1f, 10),
+                .view = CalcLookAtMat4f(vec3f(2, 2, 2), vec3f(0, 0, 0), vec3f(0, 0, 1)),
+                .model = RotateMat4f(&IdMat4f, totalTime * DegToRad(90), vec3f(0, 0, 1)),
+            };
+            u.proj.e[1][1] = -1;
+            MulMat4fSSE(&u.proj, &u.view, &u.viewProj);
+            MulMat4fSSE(&u.viewProj, &u.model, &u.mvp);
+
+            /* render */
+            DrawResult result = ApplicationDrawImage(&ld, &rc, &u,
+                                                     &uniformRing, instances, totalTime, &jobs,
+                                                     &fs, slot, frameStartTime,
+                                                     &gpuTimer, &gpuStats, &latencyStats,
+                                                     commandBuffers);
+
+            if (result == SWAP_CHAIN_OUT_OF_DATE || resizeOccurred || presentModeChanged)
+            {
+                if (!options.headless && !ApplicationWaitWhileMinimized(win))
+                {
+                    break;
+                }
+                if (!ApplicationRecreateRenderContextData(&ld, &rc, win, surf,
+                                                          &vertexBuffer, offsets,
+                                                          &indexBuffer, 0,
+                                                          commandPool, pipelineCache,
+                                                          vertShader, fragShader,
+                                                          descriptorSetLayout,
+                                                          descriptorSets,
+                                                          &uniformRing, instances, &gpuTimer,
+                                                          &vertexInputInfo, &commandBuffers,
+                                                          options.drawCount, activeRecorder,
+                                                          &secondaryCommandBuffers,
+                                                          &framebuffers, &depthResources, &pipeline,
+                                                          &layout, &renderpass, &deletionQueue,
+                                                          requestedPresentMode))
+                {
+                    puts("Could not recreate the swapchain");
+                    returnValue = ERROR_INITIALIZATION_FAILURE;
+                    swapchainLost = true;
+                    break;
+                }
+                if (presentModeChanged)
+                {
+                    printf("Present mode %s (asked for %s)\n", PresentModeName(rc.presentMode),
+                           PresentModeName(requestedPresentMode));
+                }
+                resizeOccurred = false;
+                presentModeChanged = false;
+            }
+
+            /* This frame waited on the fence submitted framesInFlight frames
+               ago */
+            if (frameCount > fs.framesInFlight)
+            {
+                CollectDeletionQueue(&ld, &deletionQueue, frameCount - fs.framesInFlight);
+            }
+        }
+        if (runFrames > 0)
+        {
+            FrameStatsRecord(&frameStats, (GetTimeSeconds() - lastFrameTime) * 1000);
+        }
 
-        glfwPollEvents();
+        /* Since drawing is async just because we fall out of the loop doesn't
+           mean the device isn't doing work which means deinitialization can
+           fail. Yeah. so uhhh... don't let that happen */
+        vkDeviceWaitIdle(ld.dev);
+        ApplicationPollFrameLatency(&ld, &fs, &latencyStats);
+        CollectDeletionQueue(&ld, &deletionQueue, frameCount);
 
-        /* Update */
-        Uniform u = {
-            .proj = CreatePerspectiveMat4f(DegToRad(45), rc.e.width / (float)rc.e.height, .1f, 10),
-            .view = CalcLookAtMat4f(vec3f(2, 2, 2), vec3f(0, 0, 0), vec3f(0, 0, 1)),
-            .model = RotateMat4f(&IdMat4f, totalTime * DegToRad(90), vec3f(0, 0, 1)),
-        };
-        u.proj.e[1][1] = -1;
+        u32 culledCount;
+        if (instances && instances->culling && ApplicationCulledInstanceCount(&ld, &fs, instances, 0, &culledCount))
+        {
+            printf("Culling kept %" PRIu32 " of %" PRIu32 " instances\n", culledCount, instances->count);
+        }
+        ApplicationDestroyFrameScheduler(&ld, &fs);
 
-        /* render */
-        DrawResult result = ApplicationDrawImage(&ld, &rc, &u,
-                                                 uniformBuffers, &uniformStagingBuffer, commandPool,
-                                                 commandBuffers, s.imageAvailableSemaphores[sindex],
-                                                 s.renderFinishedSemaphores[sindex], s.fences[sindex]);
+        if (swapchainLost)
+        {
+            runCount = run;
+            break;
+        }
 
-        if (result == SWAP_CHAIN_OUT_OF_DATE || resizeOccurred)
+        if (sweep)
         {
-            ApplicationRecreateRenderContextData(&ld, &rc, win, surf,
-                                                 &vertexBuffer, offsets,
-                                                 &indexBuffer, 0,
-                                                 commandPool, tempCommandPool,
-                                                 vertShader, fragShader,
-                                                 descriptorSetLayout,
-                                                 descriptorSets,
-                                                 &vertexInputInfo, &commandBuffers,
-                                                 &framebuffers, &depthResources, &pipeline,
-                                                 &layout, &renderpass);
-            resizeOccurred = false;
+            sweepFrameTimes[run] = SummarizeFrameStats(&frameStats);
+            sweepLatencies[run] = SummarizeFrameStats(&latencyStats);
+            sweepGPUTimes[run] = SummarizeFrameStats(&gpuStats);
+            if (!options.headless && glfwWindowShouldClose(win))
+            {
+                runCount = run + 1;
+            }
+            continue;
         }
 
-        struct timespec end;
-        clock_gettime(CLOCK_REALTIME, &end);
+        if (options.headless)
+        {
+            double runTime = GetTimeSeconds() - runStartTime;
+            printf("%" PRIu32 " frames at %" PRIu32 "x%" PRIu32 " in %f seconds: %f fps, %f ms per frame\n",
+                   runFrames, rc.e.width, rc.e.height, runTime,
+                   runFrames / runTime, runTime * 1000 / runFrames);
+        }
 
-        long timePassed;
-        if (PROFILING)
+        if (options.bench)
         {
-            if (end.tv_nsec > start.tv_nsec)
+            FrameStatsSummary summary = SummarizeFrameStats(&frameStats);
+            PrintFrameStatsSummary(stdout, &summary);
+            if (options.benchCSV && !WriteFrameStatsCSV(&frameStats, options.benchCSV))
+            {
+                printf("Could not write %s\n", options.benchCSV);
+            }
+            if (options.benchJSON && !WriteFrameStatsJSON(&frameStats, &summary, options.benchJSON))
+            {
+                printf("Could not write %s\n", options.benchJSON);
+            }
+
+            if (gpuStats.count)
             {
-                timePassed = end.tv_nsec - start.tv_nsec;
+                FrameStatsSummary gpuSummary = SummarizeFrameStats(&gpuStats);
+                puts("GPU render pass");
+                PrintFrameStatsSummary(stdout, &gpuSummary);
             }
-            else
+            if (options.gpuCSV && !WriteFrameStatsCSV(&gpuStats, options.gpuCSV))
             {
-                timePassed = 1000000000 - start.tv_nsec + end.tv_nsec;
+                printf("Could not write %s\n", options.gpuCSV);
             }
-            timePassed /= 1000;
-            double frameEndTime = glfwGetTime();
-            printf("frame %10" PRIu32 " took %f milliseconds\n",
-                   frameCount, (frameEndTime - frameStartTime) * 1000);
+
+            FrameStatsSummary latencySummary = SummarizeFrameStats(&latencyStats);
+            printf("latency: mean %f ms, p99 %f ms with %" PRIu32 " frames in flight\n",
+                   latencySummary.mean, latencySummary.p99, framesInFlight);
         }
     }
 
-    /* Since drawing is async just because we fall out of the loop doesn't mean
-       the device isn't doing work which means deinitialization can fail. Yeah.
-       so uhhh... don't let that happen */
+    if (options.latencySweep)
+    {
+        puts("in flight   frame mean   frame p99         fps   latency mean   latency p99");
+        for (u32 i = 0; i < runCount; i++)
+        {
+            printf("%9" PRIu32 " %9.3f ms %9.3f ms %11.1f %11.3f ms %10.3f ms\n",
+                   sweepFramesInFlight[i], sweepFrameTimes[i].mean, sweepFrameTimes[i].p99,
+                   sweepFrameTimes[i].mean > 0 ? 1000 / sweepFrameTimes[i].mean : 0,
+                   sweepLatencies[i].mean, sweepLatencies[i].p99);
+        }
+    }
+    if (options.instanceSweep)
+    {
+        puts("instances   frame mean   frame p99         fps   GPU mean   GPU p99");
+        for (u32 i = 0; i < runCount; i++)
+        {
+            printf("%9" PRIu32 " %9.3f ms %9.3f ms %11.1f %7.3f ms %7.3f ms\n",
+                   sweepInstanceCounts[i], sweepFrameTimes[i].mean, sweepFrameTimes[i].p99,
+                   sweepFrameTimes[i].mean > 0 ? 1000 / sweepFrameTimes[i].mean : 0,
+                   sweepGPUTimes[i].mean, sweepGPUTimes[i].p99);
+        }
+    }
+    DestroyFrameStats(&frameStats);
+    DestroyFrameStats(&gpuStats);
+    DestroyFrameStats(&latencyStats);
+    DestroyDeletionQueue(&ld, &deletionQueue);
+    DestroyGPUTimer(&ld, &gpuTimer);
 
-    vkDeviceWaitIdle(ld.dev);
+    if (pipelineCache != VK_NULL_HANDLE)
+    {
+        if (!SavePipelineCache(&ld, pipelineCache, PIPELINE_CACHE_LOC))
+        {
+            puts("Could not save pipeline cache");
+        }
+        vkDestroyPipelineCache(ld.dev, pipelineCache, NULL);
+    }
     /* Cleanup */
 
     vkDestroyDescriptorPool(ld.dev, descriptorPool, NULL);
@@ -995,38 +2828,42 @@ int main(int argc, char **argv)
     vkDestroyShaderModule(ld.dev, vertShader, NULL);
     vkDestroyShaderModule(ld.dev, fragShader, NULL);
 
-    for (u32 i = 0; i < s.count; i++)
-    {
-        vkDestroySemaphore(ld.dev, s.renderFinishedSemaphores[i], NULL);
-        vkDestroySemaphore(ld.dev, s.imageAvailableSemaphores[i], NULL);
-        vkDestroyFence(ld.dev, s.fences[i], NULL);
-    }
-    free(s.imageAvailableSemaphores);
-    free(s.renderFinishedSemaphores);
-    free(s.fences);
-    u32 imageCount = rc.imageCount;
-
     ApplicationDestroyRenderContextAndRelatedData(&ld, &rc, commandPool, commandBuffers,
+                                                  activeRecorder, secondaryCommandBuffers,
                                                   framebuffers, pipeline, layout,
                                                   renderpass, &depthResources);
+    if (activeRecorder)
+    {
+        DestroyParallelRecorder(activeRecorder);
+    }
+    DestroyJobSystem(&jobs);
 
     vkDestroyDescriptorSetLayout(ld.dev, descriptorSetLayout, NULL);
-    for (u32 i = 0; i < imageCount; i++)
+    DestroyGPURingBuffer(&ld, &uniformRing);
+    if (instances)
     {
-        DestroyGPUBufferInfo(&ld, &uniformBuffers[i]);
+        if (instances->culling)
+        {
+            ApplicationDestroyCullingPass(&ld, instances->culling);
+        }
+        DestroyGPURingBuffer(&ld, &instances->ring);
+        free(instances->models);
     }
-    DestroyGPUBufferInfo(&ld, &uniformStagingBuffer);
 
     DestroyGPUBufferInfo(&ld, &vertexBuffer);
     DestroyGPUBufferInfo(&ld, &indexBuffer);
 
     vkDestroySampler(ld.dev, tex.sampler, NULL);
     vkDestroyImageView(ld.dev, tex.imageView, NULL);
-    vkFreeMemory(ld.dev, tex.texMem, NULL);
     vkDestroyImage(ld.dev, tex.image, NULL);
+    FreeGPUMemory(&ld, &tex.texMem);
 
     vkDestroyCommandPool(ld.dev, commandPool, NULL);
     vkDestroyCommandPool(ld.dev, tempCommandPool, NULL);
+    if (transferCommandPool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(ld.dev, transferCommandPool, NULL);
+    }
 
     DestroyLogicalDevice(&ld);
 
@@ -1038,9 +2875,12 @@ int main(int argc, char **argv)
 
     vkDestroyInstance(instance, NULL);
 
-    glfwDestroyWindow(win);
+    if (win)
+    {
+        glfwDestroyWindow(win);
 
-    glfwTerminate();
+        glfwTerminate();
+    }
 
     return returnValue;
 }
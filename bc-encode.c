@@ -0,0 +1,344 @@
+#include "bc-encode.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define POWER_ITERATIONS 8
+
+/* Interpolation weights of BC7's 4 bit indices, out of 64 */
+local const u32 bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+local f32 Clamp255(f32 v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* Endpoints at the two ends of the block's spread along its principal axis,
+   found with power iteration on the covariance of the first channels
+   channels. A flat block gives both endpoints at its mean */
+local void BlockEndpoints(const u8 pixels[16][4], u32 channels, f32 *outLow, f32 *outHigh)
+{
+    f32 mean[4] = {0};
+    for (u32 i = 0; i < 16; i++)
+    {
+        for (u32 c = 0; c < channels; c++)
+        {
+            mean[c] += pixels[i][c] / 16.0f;
+        }
+    }
+
+    f32 cov[4][4] = {{0}};
+    for (u32 i = 0; i < 16; i++)
+    {
+        for (u32 a = 0; a < channels; a++)
+        {
+            for (u32 b = 0; b < channels; b++)
+            {
+                cov[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+            }
+        }
+    }
+
+    /* Starting from the row with the most variance can't be orthogonal to
+       the principal axis */
+    u32 start = 0;
+    for (u32 c = 1; c < channels; c++)
+    {
+        start = cov[c][c] > cov[start][start] ? c : start;
+    }
+    f32 axis[4] = {0};
+    memcpy(axis, cov[start], sizeof(f32) * channels);
+    for (u32 iteration = 0; iteration < POWER_ITERATIONS; iteration++)
+    {
+        f32 next[4] = {0};
+        f32 length = 0;
+        for (u32 a = 0; a < channels; a++)
+        {
+            for (u32 b = 0; b < channels; b++)
+            {
+                next[a] += cov[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+        if (length == 0)
+        {
+            break;
+        }
+        length = sqrtf(length);
+        for (u32 c = 0; c < channels; c++)
+        {
+            axis[c] = next[c] / length;
+        }
+    }
+
+    f32 low = 0, high = 0;
+    for (u32 i = 0; i < 16; i++)
+    {
+        f32 t = 0;
+        for (u32 c = 0; c < channels; c++)
+        {
+            t += (pixels[i][c] - mean[c]) * axis[c];
+        }
+        low = t < low ? t : low;
+        high = t > high ? t : high;
+    }
+    for (u32 c = 0; c < channels; c++)
+    {
+        outLow[c] = Clamp255(mean[c] + low * axis[c]);
+        outHigh[c] = Clamp255(mean[c] + high * axis[c]);
+    }
+}
+
+/* Index of the palette entry closest to pixel over the first channels
+   channels */
+local u32 NearestIndex(const u8 *pixel, const u32 (*palette)[4], u32 paletteSize, u32 channels)
+{
+    u32 best = 0;
+    u32 bestError = UINT32_MAX;
+    for (u32 i = 0; i < paletteSize; i++)
+    {
+        u32 error = 0;
+        for (u32 c = 0; c < channels; c++)
+        {
+            i32 d = (i32)pixel[c] - (i32)palette[i][c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            best = i;
+            bestError = error;
+        }
+    }
+    return best;
+}
+
+local u16 To565(const f32 *rgb)
+{
+    u32 r = (u32)(rgb[0] * 31 / 255 + .5f);
+    u32 g = (u32)(rgb[1] * 63 / 255 + .5f);
+    u32 b = (u32)(rgb[2] * 31 / 255 + .5f);
+    return (u16)(r << 11 | g << 5 | b);
+}
+
+local void From565(u16 c, u32 *out)
+{
+    u32 r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    out[0] = r << 3 | r >> 2;
+    out[1] = g << 2 | g >> 4;
+    out[2] = b << 3 | b >> 2;
+    out[3] = 255;
+}
+
+local void WriteLE(u8 *out, u64 value, u32 bytes)
+{
+    for (u32 i = 0; i < bytes; i++)
+    {
+        out[i] = (u8)(value >> (8 * i));
+    }
+}
+
+void EncodeBC1Block(const u8 pixels[16][4], u8 *out)
+{
+    f32 low[4], high[4];
+    BlockEndpoints(pixels, 3, low, high);
+    u16 c0 = To565(high);
+    u16 c1 = To565(low);
+    /* c0 > c1 selects the four colour mode */
+    if (c0 < c1)
+    {
+        u16 t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    u32 indices = 0;
+    if (c0 != c1)
+    {
+        u32 palette[4][4];
+        From565(c0, palette[0]);
+        From565(c1, palette[1]);
+        for (u32 c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (u32 i = 0; i < 16; i++)
+        {
+            indices |= NearestIndex(pixels[i], (const u32(*)[4])palette, 4, 3) << (2 * i);
+        }
+    }
+
+    WriteLE(out, c0, 2);
+    WriteLE(out + 2, c1, 2);
+    WriteLE(out + 4, indices, 4);
+}
+
+void EncodeBC3Block(const u8 pixels[16][4], u8 *out)
+{
+    u32 a0 = 0, a1 = 255;
+    for (u32 i = 0; i < 16; i++)
+    {
+        a0 = pixels[i][3] > a0 ? pixels[i][3] : a0;
+        a1 = pixels[i][3] < a1 ? pixels[i][3] : a1;
+    }
+
+    /* a0 > a1 selects the eight value mode, equal ones only need index 0 */
+    u64 indices = 0;
+    if (a0 != a1)
+    {
+        u32 palette[8][4] = {{a0}, {a1}};
+        for (u32 i = 1; i < 7; i++)
+        {
+            palette[i + 1][0] = ((7 - i) * a0 + i * a1) / 7;
+        }
+        for (u32 i = 0; i < 16; i++)
+        {
+            indices |= (u64)NearestIndex(&pixels[i][3], (const u32(*)[4])palette, 8, 1) << (3 * i);
+        }
+    }
+
+    out[0] = (u8)a0;
+    out[1] = (u8)a1;
+    WriteLE(out + 2, indices, 6);
+    EncodeBC1Block(pixels, out + 8);
+}
+
+/* Appends bits LSB first */
+typedef struct BitWriter
+{
+    u8 *out;
+    u32 position;
+} BitWriter;
+
+local void WriteBits(BitWriter *w, u32 value, u32 count)
+{
+    for (u32 i = 0; i < count; i++, w->position++)
+    {
+        w->out[w->position / 8] |= (u8)(((value >> i) & 1) << (w->position % 8));
+    }
+}
+
+/* 7 bits per channel plus a shared lowest bit p, whichever p is closer */
+local void QuantizeBC7Endpoint(const f32 *endpoint, u32 *outBits, u32 *outP)
+{
+    f32 bestError = INFINITY;
+    for (u32 p = 0; p < 2; p++)
+    {
+        u32 bits[4];
+        f32 error = 0;
+        for (u32 c = 0; c < 4; c++)
+        {
+            f32 q = roundf((endpoint[c] - p) / 2);
+            bits[c] = q < 0 ? 0 : q > 127 ? 127 : (u32)q;
+            f32 d = (f32)(bits[c] << 1 | p) - endpoint[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            memcpy(outBits, bits, sizeof(bits));
+            *outP = p;
+        }
+    }
+}
+
+void EncodeBC7Block(const u8 pixels[16][4], u8 *out)
+{
+    f32 ends[2][4];
+    BlockEndpoints(pixels, 4, ends[0], ends[1]);
+    u32 bits[2][4], p[2];
+    QuantizeBC7Endpoint(ends[0], bits[0], &p[0]);
+    QuantizeBC7Endpoint(ends[1], bits[1], &p[1]);
+
+    u32 palette[16][4];
+    for (u32 i = 0; i < 16; i++)
+    {
+        for (u32 c = 0; c < 4; c++)
+        {
+            u32 e0 = bits[0][c] << 1 | p[0];
+            u32 e1 = bits[1][c] << 1 | p[1];
+            palette[i][c] = ((64 - bc7Weights[i]) * e0 + bc7Weights[i] * e1 + 32) >> 6;
+        }
+    }
+    u32 indices[16];
+    for (u32 i = 0; i < 16; i++)
+    {
+        indices[i] = NearestIndex(pixels[i], (const u32(*)[4])palette, 16, 4);
+    }
+
+    /* Pixel 0's index is stored without its top bit, so it has to be below 8.
+       Swapping the endpoints mirrors every index */
+    if (indices[0] >= 8)
+    {
+        for (u32 c = 0; c < 4; c++)
+        {
+            u32 t = bits[0][c];
+            bits[0][c] = bits[1][c];
+            bits[1][c] = t;
+        }
+        u32 t = p[0];
+        p[0] = p[1];
+        p[1] = t;
+        for (u32 i = 0; i < 16; i++)
+        {
+            indices[i] = 15 - indices[i];
+        }
+    }
+
+    memset(out, 0, 16);
+    BitWriter w = {out, 0};
+    /* Mode 6 is six 0 bits then a 1 */
+    WriteBits(&w, 1 << 6, 7);
+    for (u32 c = 0; c < 4; c++)
+    {
+        WriteBits(&w, bits[0][c], 7);
+        WriteBits(&w, bits[1][c], 7);
+    }
+    WriteBits(&w, p[0], 1);
+    WriteBits(&w, p[1], 1);
+    WriteBits(&w, indices[0], 3);
+    for (u32 i = 1; i < 16; i++)
+    {
+        WriteBits(&w, indices[i], 4);
+    }
+}
+
+void EncodeBCImage(TextureFileFormat format, const u8 *rgba, u32 x, u32 y, u8 *out)
+{
+    if (format == TEXTURE_FILE_RGBA8)
+    {
+        memcpy(out, rgba, (usize)x * y * 4);
+        return;
+    }
+
+    u32 blockBytes = format == TEXTURE_FILE_BC1 ? 8 : 16;
+    for (u32 by = 0; by < y; by += 4)
+    {
+        for (u32 bx = 0; bx < x; bx += 4)
+        {
+            u8 pixels[16][4];
+            for (u32 j = 0; j < 4; j++)
+            {
+                u32 py = by + j < y ? by + j : y - 1;
+                for (u32 i = 0; i < 4; i++)
+                {
+                    u32 px = bx + i < x ? bx + i : x - 1;
+                    memcpy(pixels[j * 4 + i], rgba + ((usize)py * x + px) * 4, 4);
+                }
+            }
+            switch (format)
+            {
+            case TEXTURE_FILE_BC1:
+                EncodeBC1Block((const u8(*)[4])pixels, out);
+                break;
+            case TEXTURE_FILE_BC3:
+                EncodeBC3Block((const u8(*)[4])pixels, out);
+                break;
+            default:
+                EncodeBC7Block((const u8(*)[4])pixels, out);
+                break;
+            }
+            out += blockBytes;
+        }
+    }
+}
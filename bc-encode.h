@@ -0,0 +1,28 @@
+#ifndef BC_ENCODE_H
+#define BC_ENCODE_H
+
+#include "rutils/def.h"
+#include "texture-file.h"
+
+/* Block compression encoders. Each takes a 4x4 block of RGBA8 pixels in row
+   order, pixel 0 top left, and writes one block.
+
+   Endpoints come from the block's principal axis, which is fast and good
+   enough for offline cooking of photographic textures. These aren't the
+   exhaustive searches production encoders do */
+
+/* 8 bytes, colour only. Always uses the four colour mode so alpha reads as
+   opaque */
+void EncodeBC1Block(const u8 pixels[16][4], u8 *out);
+
+/* 16 bytes, interpolated alpha followed by a BC1 colour block */
+void EncodeBC3Block(const u8 pixels[16][4], u8 *out);
+
+/* 16 bytes, mode 6 only: one subset, RGBA endpoints and 4 bit indices */
+void EncodeBC7Block(const u8 pixels[16][4], u8 *out);
+
+/* Encodes an x by y RGBA8 image into TextureLevelSize(format, x, y) bytes.
+   Blocks hanging over the edge repeat the last row and column */
+void EncodeBCImage(TextureFileFormat format, const u8 *rgba, u32 x, u32 y, u8 *out);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include "rutils/def.h"
+
+/* Runtime checks the SIMD paths are picked with, false off x86 */
+
+local bool CPUHasAVX(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx");
+#else
+    return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,108 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "cpu-features.h"
+#include "frame-stats.h"
+#include "frustum-cull.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Scalar against SIMD frustum culling over the same spheres:
+     cull-bench [object count] */
+
+#define DEFAULT_OBJECTS 1000000
+#define REPEATS 50
+/* Spheres are scattered over a cube this far from the origin on each axis */
+#define WORLD_EXTENT 100.0f
+
+typedef void (*CullFun)(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask);
+
+local double BenchCull(CullFun fun, const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask,
+                       FrameStats *stats)
+{
+    ResetFrameStats(stats);
+    for (u32 i = 0; i <= REPEATS; i++)
+    {
+        double start = GetTimeSeconds();
+        fun(planes, bounds, mask);
+        FrameStatsRecord(stats, (GetTimeSeconds() - start) * 1000);
+    }
+    return SummarizeFrameStats(stats).p50;
+}
+
+int main(int argc, char **argv)
+{
+    u32 count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_OBJECTS;
+
+    SphereBounds bounds;
+    FrameStats stats;
+    u32 words = CullMaskWords(count);
+    u64 *reference = malloc(sizeof(u64) * (words ? words : 1));
+    u64 *mask = malloc(sizeof(u64) * (words ? words : 1));
+    if (!reference || !mask || !CreateSphereBounds(count, &bounds) ||
+        !CreateFrameStats(REPEATS, 1, &stats))
+    {
+        puts("Out of memory");
+        return 1;
+    }
+
+    /* Fixed seed so runs are comparable */
+    srand(1);
+    bounds.count = count;
+    for (u32 i = 0; i < count; i++)
+    {
+        bounds.x[i] = (rand() / (f32)RAND_MAX * 2 - 1) * WORLD_EXTENT;
+        bounds.y[i] = (rand() / (f32)RAND_MAX * 2 - 1) * WORLD_EXTENT;
+        bounds.z[i] = (rand() / (f32)RAND_MAX * 2 - 1) * WORLD_EXTENT;
+        bounds.r[i] = rand() / (f32)RAND_MAX * 2;
+    }
+
+    Mat4f proj = CreatePerspectiveMat4f(DegToRad(45), 800 / 600.0f, .1f, WORLD_EXTENT);
+    Mat4f view = CalcLookAtMat4f(vec3f(20, 20, 20), vec3f(0, 0, 0), vec3f(0, 0, 1));
+    proj.e[1][1] *= -1;
+    FrustumPlanes planes;
+    ExtractFrustumPlanes(&proj, &view, &planes);
+
+    struct
+    {
+        const char *name;
+        CullFun fun;
+        bool supported;
+    } variants[] = {
+        {"scalar", CullSpheresScalar, true},
+        {"SSE", CullSpheresSSE, true},
+        {"AVX", CullSpheresAVX, CPUHasAVX()},
+    };
+
+    u32 visible = CullSpheres(&planes, &bounds, reference);
+    printf("%" PRIu32 " spheres, %" PRIu32 " visible, median of %d runs\n", count, visible, REPEATS);
+    double scalarMs = 0;
+    int returnValue = 0;
+    for (u32 i = 0; i < countof(variants); i++)
+    {
+        if (!variants[i].supported)
+        {
+            printf("%-6s not supported on this CPU\n", variants[i].name);
+            continue;
+        }
+        double ms = BenchCull(variants[i].fun, &planes, &bounds, mask, &stats);
+        if (i == 0)
+        {
+            scalarMs = ms;
+        }
+        bool matches = memcmp(mask, reference, sizeof(u64) * words) == 0;
+        printf("%-6s %9.3f ms %9.1f Mspheres/s %6.2fx%s\n", variants[i].name, ms,
+               count / (ms * 1000), scalarMs / ms, matches ? "" : " MISMATCH");
+        if (!matches)
+        {
+            returnValue = 1;
+        }
+    }
+
+    DestroyFrameStats(&stats);
+    DestroySphereBounds(&bounds);
+    free(mask);
+    free(reference);
+    return returnValue;
+}
@@ -1,18 +1,31 @@
 CC=clang
 VERT_SHADERS = $(shell find shaders/ -name "*.vert")
 FRAG_SHADERS = $(shell find shaders/ -name "*.frag")
+COMP_SHADERS = $(shell find shaders/ -name "*.comp")
 VERT_SHADER_TARGETS = $(patsubst shaders/%.vert, shaders/%.vert.spv,	\
 $(VERT_SHADERS))
 
 FRAG_SHADER_TARGETS = $(patsubst shaders/%.frag, shaders/%.frag.spv,	\
 $(FRAG_SHADERS))
 
-LDFLAGS += -lglfw -lvulkan -lm
+COMP_SHADER_TARGETS = $(patsubst shaders/%.comp, shaders/%.comp.spv,	\
+$(COMP_SHADERS))
+
+TEXTURES = $(shell find textures/ -name "*.jpg" -o -name "*.png")
+COOKED_TEXTURES = $(addsuffix .tex, $(basename $(TEXTURES)))
+
+LDFLAGS += -lglfw -lvulkan -lm -lpthread
 
 CFLAGS += -g
-all: app $(VERT_SHADER_TARGETS) $(FRAG_SHADER_TARGETS)
+all: app job-bench cull-bench math-bench texture-cook texture-bench stb-output-test $(VERT_SHADER_TARGETS) $(FRAG_SHADER_TARGETS) $(COMP_SHADER_TARGETS) $(COOKED_TEXTURES)
 stb_image.o: CFLAGS+=-Wno-cast-qual -Wno-disabled-macro-expansion -Wno-cast-align -Wno-comma -Wno-conversion
-app: app.o stb_image.o vk-basic.o rutils/math.o rutils/file.o rutils/string.o
+app: app.o stb_image.o vk-basic.o frame-stats.o frustum-cull.o job-system.o mipmap.o parallel-record.o simd-math.o texture-cache.o texture-decode.o texture-file.o rutils/math.o rutils/file.o rutils/string.o
+job-bench: job-bench.o job-system.o frame-stats.o
+cull-bench: cull-bench.o frustum-cull.o frame-stats.o rutils/math.o
+math-bench: math-bench.o simd-math.o frame-stats.o rutils/math.o
+texture-cook: texture-cook.o frame-stats.o texture-file.o bc-encode.o mipmap.o stb_image.o
+texture-bench: texture-bench.o texture-cache.o texture-decode.o texture-file.o job-system.o frame-stats.o mipmap.o stb_image.o rutils/file.o
+stb-output-test: stb-output-test.o stb_image.o
 
 shaders/%.vert.spv: shaders/%.vert
 	glslangValidator -V $< -o $@
@@ -20,4 +33,13 @@ shaders/%.vert.spv: shaders/%.vert
 shaders/%.frag.spv: shaders/%.frag
 	glslangValidator -V $< -o $@
 
+shaders/%.comp.spv: shaders/%.comp
+	glslangValidator -V $< -o $@
+
+textures/%.tex: textures/%.jpg texture-cook
+	./texture-cook $< $@
+
+textures/%.tex: textures/%.png texture-cook
+	./texture-cook $< $@
+
 sample: sample.o $(RUTILS)
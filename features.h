@@ -1,10 +1,12 @@
 #ifndef FEATURES_H
 #define FEATURES_H
 
+/* Turns on frame time statistics (same as --bench) by default */
 #ifndef PROFILING
 #define PROFILING 0
 #endif
 
+/* Asks for MAILBOX instead of FIFO unless --present-mode says otherwise */
 #ifndef USE_MAILBOX_RENDERER
 #define USE_MAILBOX_RENDERER 0
 #endif
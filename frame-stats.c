@@ -0,0 +1,156 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (199309L)
+
+#include "frame-stats.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double GetTimeSeconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+bool CreateFrameStats(u32 capacity, u32 warmupFrames, FrameStats *out)
+{
+    *out = (FrameStats){0};
+    out->times = malloc(sizeof(out->times[0]) * capacity);
+    if (!out->times)
+    {
+        return false;
+    }
+    /* Touch every page now so the first frames don't pay for page faults */
+    memset(out->times, 0, sizeof(out->times[0]) * capacity);
+    out->capacity = capacity;
+    out->warmupFrames = warmupFrames;
+    return true;
+}
+
+void DestroyFrameStats(FrameStats *stats)
+{
+    free(stats->times);
+    *stats = (FrameStats){0};
+}
+
+local int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile over sorted data */
+local double Percentile(const double *sorted, u32 count, double percent)
+{
+    u32 rank = (u32)ceil(percent / 100 * count);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+FrameStatsSummary SummarizeFrameStats(const FrameStats *stats)
+{
+    FrameStatsSummary ret = {0};
+    ret.frames = stats->count;
+    if (stats->count == 0)
+    {
+        return ret;
+    }
+
+    double *sorted = malloc(sizeof(sorted[0]) * stats->count);
+    memcpy(sorted, stats->times, sizeof(sorted[0]) * stats->count);
+    qsort(sorted, stats->count, sizeof(sorted[0]), CompareDouble);
+
+    double sum = 0;
+    for (u32 i = 0; i < stats->count; i++)
+    {
+        sum += sorted[i];
+    }
+    ret.mean = sum / stats->count;
+
+    double squares = 0;
+    for (u32 i = 0; i < stats->count; i++)
+    {
+        double d = sorted[i] - ret.mean;
+        squares += d * d;
+    }
+    ret.variance = squares / stats->count;
+
+    ret.min = sorted[0];
+    ret.max = sorted[stats->count - 1];
+    ret.p50 = Percentile(sorted, stats->count, 50);
+    ret.p95 = Percentile(sorted, stats->count, 95);
+    ret.p99 = Percentile(sorted, stats->count, 99);
+
+    for (u32 i = 0; i < stats->count; i++)
+    {
+        if (stats->times[i] > 2 * ret.p50)
+        {
+            ret.hitches++;
+        }
+    }
+
+    free(sorted);
+    return ret;
+}
+
+void PrintFrameStatsSummary(FILE *f, const FrameStatsSummary *summary)
+{
+    fprintf(f, "frames %" PRIu32 "\n", summary->frames);
+    fprintf(f, "min    %10.4f ms\n", summary->min);
+    fprintf(f, "mean   %10.4f ms\n", summary->mean);
+    fprintf(f, "p50    %10.4f ms\n", summary->p50);
+    fprintf(f, "p95    %10.4f ms\n", summary->p95);
+    fprintf(f, "p99    %10.4f ms\n", summary->p99);
+    fprintf(f, "max    %10.4f ms\n", summary->max);
+    fprintf(f, "stddev %10.4f ms (variance %f)\n", sqrt(summary->variance), summary->variance);
+    fprintf(f, "hitches (> 2x median) %" PRIu32 "\n", summary->hitches);
+}
+
+bool WriteFrameStatsCSV(const FrameStats *stats, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        return false;
+    }
+    fputs("frame,ms\n", f);
+    for (u32 i = 0; i < stats->count; i++)
+    {
+        fprintf(f, "%" PRIu32 ",%f\n", i, stats->times[i]);
+    }
+    return fclose(f) == 0;
+}
+
+bool WriteFrameStatsJSON(const FrameStats *stats, const FrameStatsSummary *summary, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"warmupFrames\": %" PRIu32 ",\n", stats->warmupFrames);
+    fprintf(f, "  \"frames\": %" PRIu32 ",\n", summary->frames);
+    fprintf(f, "  \"min\": %f,\n", summary->min);
+    fprintf(f, "  \"mean\": %f,\n", summary->mean);
+    fprintf(f, "  \"p50\": %f,\n", summary->p50);
+    fprintf(f, "  \"p95\": %f,\n", summary->p95);
+    fprintf(f, "  \"p99\": %f,\n", summary->p99);
+    fprintf(f, "  \"max\": %f,\n", summary->max);
+    fprintf(f, "  \"variance\": %f,\n", summary->variance);
+    fprintf(f, "  \"hitches\": %" PRIu32 ",\n", summary->hitches);
+    fprintf(f, "  \"frameTimesMs\": [");
+    for (u32 i = 0; i < stats->count; i++)
+    {
+        fprintf(f, "%s%f", i ? ", " : "", stats->times[i]);
+    }
+    fprintf(f, "]\n}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,67 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include "rutils/def.h"
+#include <stdio.h>
+
+/* Frame times in milliseconds, recorded into a buffer allocated up front so
+   recording never touches the allocator or does IO inside the frame loop.
+   The first warmupFrames samples are thrown away and samples past capacity
+   are dropped */
+typedef struct FrameStats
+{
+    double *times;
+    u32 capacity;
+    u32 count;
+    u32 warmupFrames;
+    u32 seen;
+} FrameStats;
+
+/* A hitch is a frame that took more than twice the median */
+typedef struct FrameStatsSummary
+{
+    u32 frames;
+    double min;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+    double variance;
+    u32 hitches;
+} FrameStatsSummary;
+
+/* Seconds on the monotonic clock, for timing frames and benchmark runs */
+double GetTimeSeconds(void);
+
+bool CreateFrameStats(u32 capacity, u32 warmupFrames, FrameStats *out);
+
+void DestroyFrameStats(FrameStats *stats);
+
+local void FrameStatsRecord(FrameStats *stats, double frameTimeMs)
+{
+    if (stats->seen++ < stats->warmupFrames || stats->count == stats->capacity)
+    {
+        return;
+    }
+    stats->times[stats->count++] = frameTimeMs;
+}
+
+/* Drops every sample, warmup starts over */
+local void ResetFrameStats(FrameStats *stats)
+{
+    stats->count = 0;
+    stats->seen = 0;
+}
+
+FrameStatsSummary SummarizeFrameStats(const FrameStats *stats);
+
+void PrintFrameStatsSummary(FILE *f, const FrameStatsSummary *summary);
+
+/* One row per recorded frame */
+bool WriteFrameStatsCSV(const FrameStats *stats, const char *path);
+
+/* The summary plus every recorded frame */
+bool WriteFrameStatsJSON(const FrameStats *stats, const FrameStatsSummary *summary, const char *path);
+
+#endif
@@ -0,0 +1,208 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "frustum-cull.h"
+#include "cpu-features.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULL_X86 1
+#include <immintrin.h>
+#else
+#define CULL_X86 0
+#endif
+
+#define SIMD_GROUP 8
+#define SIMD_ALIGNMENT 32
+
+void ExtractFrustumPlanes(const Mat4f *proj, const Mat4f *view, FrustumPlanes *out)
+{
+    /* e[column][row], same layout the shaders see */
+    f32 m[4][4];
+    for (u32 c = 0; c < 4; c++)
+    {
+        for (u32 r = 0; r < 4; r++)
+        {
+            m[c][r] = 0;
+            for (u32 k = 0; k < 4; k++)
+            {
+                m[c][r] += proj->e[k][r] * view->e[c][k];
+            }
+        }
+    }
+
+    /* Rows of proj * view combined as in Gribb and Hartmann */
+    static const i32 rowSigns[6][2] = {{0, 1}, {0, -1}, {1, 1}, {1, -1}, {2, 0}, {2, -1}};
+    for (u32 p = 0; p < 6; p++)
+    {
+        u32 row = rowSigns[p][0];
+        f32 sign = (f32)rowSigns[p][1];
+        f32 plane[4];
+        for (u32 c = 0; c < 4; c++)
+        {
+            /* The near plane is row 2 alone since z starts at 0 */
+            plane[c] = sign == 0 ? m[c][row] : m[c][3] + sign * m[c][row];
+        }
+        f32 len = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        out->a[p] = plane[0] / len;
+        out->b[p] = plane[1] / len;
+        out->c[p] = plane[2] / len;
+        out->d[p] = plane[3] / len;
+    }
+}
+
+bool CreateSphereBounds(u32 capacity, SphereBounds *out)
+{
+    *out = (SphereBounds){0};
+    usize padded = (capacity + SIMD_GROUP - 1) / SIMD_GROUP * SIMD_GROUP;
+    f32 **arrays[] = {&out->x, &out->y, &out->z, &out->r};
+    for (u32 i = 0; i < countof(arrays); i++)
+    {
+        void *p;
+        if (posix_memalign(&p, SIMD_ALIGNMENT, sizeof(f32) * (padded ? padded : SIMD_GROUP)) != 0)
+        {
+            DestroySphereBounds(out);
+            return false;
+        }
+        memset(p, 0, sizeof(f32) * (padded ? padded : SIMD_GROUP));
+        *arrays[i] = p;
+    }
+    out->capacity = capacity;
+    return true;
+}
+
+void DestroySphereBounds(SphereBounds *bounds)
+{
+    free(bounds->x);
+    free(bounds->y);
+    free(bounds->z);
+    free(bounds->r);
+    *bounds = (SphereBounds){0};
+}
+
+/* Bits past count in the last word come from padding and get dropped */
+local void ClearMaskTail(const SphereBounds *bounds, u64 *mask)
+{
+    if (bounds->count % 64)
+    {
+        mask[bounds->count / 64] &= ((u64)1 << (bounds->count % 64)) - 1;
+    }
+}
+
+void CullSpheresScalar(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask)
+{
+    memset(mask, 0, sizeof(u64) * CullMaskWords(bounds->count));
+    for (u32 i = 0; i < bounds->count; i++)
+    {
+        bool inside = true;
+        for (u32 p = 0; p < 6 && inside; p++)
+        {
+            /* Same order of operations as the SIMD paths so they agree to
+               the bit */
+            f32 dist = (planes->a[p] * bounds->x[i] + planes->b[p] * bounds->y[i]) +
+                       (planes->c[p] * bounds->z[i] + planes->d[p]);
+            inside = dist + bounds->r[i] >= 0;
+        }
+        mask[i / 64] |= (u64)inside << (i % 64);
+    }
+}
+
+#if CULL_X86
+
+void CullSpheresSSE(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask)
+{
+    memset(mask, 0, sizeof(u64) * CullMaskWords(bounds->count));
+    __m128 pa[6], pb[6], pc[6], pd[6];
+    for (u32 p = 0; p < 6; p++)
+    {
+        pa[p] = _mm_set1_ps(planes->a[p]);
+        pb[p] = _mm_set1_ps(planes->b[p]);
+        pc[p] = _mm_set1_ps(planes->c[p]);
+        pd[p] = _mm_set1_ps(planes->d[p]);
+    }
+    __m128 zero = _mm_setzero_ps();
+
+    for (u32 i = 0; i < bounds->count; i += 4)
+    {
+        __m128 x = _mm_load_ps(bounds->x + i);
+        __m128 y = _mm_load_ps(bounds->y + i);
+        __m128 z = _mm_load_ps(bounds->z + i);
+        __m128 r = _mm_load_ps(bounds->r + i);
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (u32 p = 0; p < 6; p++)
+        {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], x), _mm_mul_ps(pb[p], y)),
+                                     _mm_add_ps(_mm_mul_ps(pc[p], z), pd[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, r), zero));
+        }
+        mask[i / 64] |= (u64)_mm_movemask_ps(inside) << (i % 64);
+    }
+    ClearMaskTail(bounds, mask);
+}
+
+__attribute__((target("avx"))) void CullSpheresAVX(const FrustumPlanes *planes, const SphereBounds *bounds,
+                                                   u64 *mask)
+{
+    memset(mask, 0, sizeof(u64) * CullMaskWords(bounds->count));
+    __m256 pa[6], pb[6], pc[6], pd[6];
+    for (u32 p = 0; p < 6; p++)
+    {
+        pa[p] = _mm256_set1_ps(planes->a[p]);
+        pb[p] = _mm256_set1_ps(planes->b[p]);
+        pc[p] = _mm256_set1_ps(planes->c[p]);
+        pd[p] = _mm256_set1_ps(planes->d[p]);
+    }
+    __m256 zero = _mm256_setzero_ps();
+
+    for (u32 i = 0; i < bounds->count; i += 8)
+    {
+        __m256 x = _mm256_load_ps(bounds->x + i);
+        __m256 y = _mm256_load_ps(bounds->y + i);
+        __m256 z = _mm256_load_ps(bounds->z + i);
+        __m256 r = _mm256_load_ps(bounds->r + i);
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (u32 p = 0; p < 6; p++)
+        {
+            __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pa[p], x), _mm256_mul_ps(pb[p], y)),
+                                        _mm256_add_ps(_mm256_mul_ps(pc[p], z), pd[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, r), zero, _CMP_GE_OQ));
+        }
+        mask[i / 64] |= (u64)_mm256_movemask_ps(inside) << (i % 64);
+    }
+    ClearMaskTail(bounds, mask);
+}
+
+#else
+
+void CullSpheresSSE(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask)
+{
+    CullSpheresScalar(planes, bounds, mask);
+}
+
+void CullSpheresAVX(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask)
+{
+    CullSpheresScalar(planes, bounds, mask);
+}
+
+#endif
+
+u32 CullSpheres(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask)
+{
+    if (CPUHasAVX())
+    {
+        CullSpheresAVX(planes, bounds, mask);
+    }
+    else
+    {
+        CullSpheresSSE(planes, bounds, mask);
+    }
+
+    u32 visible = 0;
+    for (u32 i = 0; i < CullMaskWords(bounds->count); i++)
+    {
+        visible += __builtin_popcountll(mask[i]);
+    }
+    return visible;
+}
@@ -0,0 +1,64 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include "rutils/def.h"
+#include "rutils/math.h"
+
+/* Normalized so a point p is inside plane i when
+   a[i] * p.x + b[i] * p.y + c[i] * p.z + d[i] >= 0, and the result is the
+   signed distance. Stored by component so every plane coefficient can be
+   broadcast straight into a register */
+typedef struct FrustumPlanes
+{
+    f32 a[6];
+    f32 b[6];
+    f32 c[6];
+    f32 d[6];
+} FrustumPlanes;
+
+/* Bounding spheres in structure of arrays form. Each array is 32 byte aligned
+   and holds capacity rounded up to 8 floats, so the SIMD paths can always
+   load whole groups. Whatever sits past count is ignored */
+typedef struct SphereBounds
+{
+    f32 *x;
+    f32 *y;
+    f32 *z;
+    f32 *r;
+    u32 count;
+    u32 capacity;
+} SphereBounds;
+
+/* Words needed for a visibility mask over count objects */
+local u32 CullMaskWords(u32 count)
+{
+    return (count + 63) / 64;
+}
+
+local bool CullMaskTest(const u64 *mask, u32 i)
+{
+    return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+/* Planes of proj * view, with clip space z running from 0 to w like Vulkan's */
+void ExtractFrustumPlanes(const Mat4f *proj, const Mat4f *view, FrustumPlanes *out);
+
+bool CreateSphereBounds(u32 capacity, SphereBounds *out);
+
+void DestroySphereBounds(SphereBounds *bounds);
+
+/* Sets bit i of mask when sphere i is at least partly inside every plane and
+   clears it otherwise. mask holds CullMaskWords(bounds->count) words */
+void CullSpheresScalar(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask);
+
+/* 4 spheres per iteration */
+void CullSpheresSSE(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask);
+
+/* 8 spheres per iteration. Only call when the CPU has AVX */
+void CullSpheresAVX(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask);
+
+/* The widest of the above the CPU supports. Returns how many objects are
+   visible */
+u32 CullSpheres(const FrustumPlanes *planes, const SphereBounds *bounds, u64 *mask);
+
+#endif
@@ -0,0 +1,176 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "frame-stats.h"
+#include "job-system.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Microbenchmarks for job-system.c. Every test runs with 1 up to the given
+   thread count, default all online CPUs:
+     job-bench [max threads] */
+
+#define REPEATS 20
+#define EMPTY_JOBS 100000
+#define SPAWN_DEPTH 16
+#define SCALING_ITEMS (1u << 20)
+#define SCALING_ITERATIONS 64
+
+local void EmptyJob(void *data)
+{
+    ignore data;
+}
+
+/* Pure scheduling overhead: push a batch of jobs that do nothing and wait */
+local double BenchEmptyJobs(JobSystem *js, Job *jobs)
+{
+    for (u32 i = 0; i < EMPTY_JOBS; i++)
+    {
+        jobs[i].fun = EmptyJob;
+        jobs[i].data = NULL;
+    }
+    double start = GetTimeSeconds();
+    JobCounter counter = {0};
+    JobSystemRun(js, jobs, EMPTY_JOBS, &counter);
+    JobSystemWait(js, &counter);
+    return (GetTimeSeconds() - start) * 1000;
+}
+
+typedef struct SpawnJobData
+{
+    JobSystem *js;
+    u32 depth;
+} SpawnJobData;
+
+/* Binary tree of jobs where every parent waits on its children, so work only
+   spreads by stealing and dependencies are resolved through counters */
+local void SpawnJob(void *data)
+{
+    SpawnJobData *d = data;
+    if (d->depth == 0)
+    {
+        return;
+    }
+    SpawnJobData children[2] = {{d->js, d->depth - 1}, {d->js, d->depth - 1}};
+    Job jobs[2] = {{SpawnJob, &children[0], NULL}, {SpawnJob, &children[1], NULL}};
+    JobCounter counter = {0};
+    JobSystemRun(d->js, jobs, countof(jobs), &counter);
+    JobSystemWait(d->js, &counter);
+}
+
+local double BenchSpawnTree(JobSystem *js)
+{
+    double start = GetTimeSeconds();
+    SpawnJobData root = {js, SPAWN_DEPTH};
+    SpawnJob(&root);
+    return (GetTimeSeconds() - start) * 1000;
+}
+
+typedef struct ScalingData
+{
+    float *in;
+    float *out;
+} ScalingData;
+
+local void ScalingSlice(u32 first, u32 count, void *user)
+{
+    ScalingData *d = user;
+    for (u32 i = first; i < first + count; i++)
+    {
+        float x = d->in[i];
+        for (u32 j = 0; j < SCALING_ITERATIONS; j++)
+        {
+            x = sinf(x) * 0.5f + 0.25f;
+        }
+        d->out[i] = x;
+    }
+}
+
+/* Compute bound parallel-for, for how close to linear it gets */
+local double BenchParallelFor(JobSystem *js, ScalingData *data)
+{
+    double start = GetTimeSeconds();
+    JobSystemParallelFor(js, SCALING_ITEMS, 0, ScalingSlice, data);
+    return (GetTimeSeconds() - start) * 1000;
+}
+
+local double Median(FrameStats *stats)
+{
+    return SummarizeFrameStats(stats).p50;
+}
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 maxThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : (cpus > 0 ? (u32)cpus : 1);
+    if (maxThreads == 0)
+    {
+        maxThreads = 1;
+    }
+
+    Job *jobs = malloc(sizeof(jobs[0]) * EMPTY_JOBS);
+    ScalingData data = {
+        .in = malloc(sizeof(float) * SCALING_ITEMS),
+        .out = malloc(sizeof(float) * SCALING_ITEMS),
+    };
+    FrameStats emptyStats, spawnStats, scalingStats;
+    if (!jobs || !data.in || !data.out ||
+        !CreateFrameStats(REPEATS, 1, &emptyStats) ||
+        !CreateFrameStats(REPEATS, 1, &spawnStats) ||
+        !CreateFrameStats(REPEATS, 1, &scalingStats))
+    {
+        puts("Out of memory");
+        return 1;
+    }
+    for (u32 i = 0; i < SCALING_ITEMS; i++)
+    {
+        data.in[i] = i / (float)SCALING_ITEMS;
+    }
+
+    printf("median of %d runs. empty: %d jobs, spawn: %d jobs, parallel for: %u items\n",
+           REPEATS, EMPTY_JOBS, (2 << SPAWN_DEPTH) - 1, SCALING_ITEMS);
+    puts("threads  empty ns/job  spawn ns/job  parallel for ms  speedup  efficiency");
+    double singleThreadMs = 0;
+    for (u32 threads = 1; threads <= maxThreads; threads++)
+    {
+        JobSystem js;
+        if (!CreateJobSystem(threads, &js))
+        {
+            printf("Could not start %" PRIu32 " threads\n", threads);
+            return 1;
+        }
+        ResetFrameStats(&emptyStats);
+        ResetFrameStats(&spawnStats);
+        ResetFrameStats(&scalingStats);
+        /* One extra run each for the warmup */
+        for (u32 i = 0; i <= REPEATS; i++)
+        {
+            FrameStatsRecord(&emptyStats, BenchEmptyJobs(&js, jobs));
+            FrameStatsRecord(&spawnStats, BenchSpawnTree(&js));
+            FrameStatsRecord(&scalingStats, BenchParallelFor(&js, &data));
+        }
+        DestroyJobSystem(&js);
+
+        double scalingMs = Median(&scalingStats);
+        if (threads == 1)
+        {
+            singleThreadMs = scalingMs;
+        }
+        double speedup = singleThreadMs / scalingMs;
+        printf("%7" PRIu32 " %13.1f %13.1f %16.3f %8.2fx %10.0f%%\n",
+               threads,
+               Median(&emptyStats) * 1000000 / EMPTY_JOBS,
+               Median(&spawnStats) * 1000000 / ((2 << SPAWN_DEPTH) - 1),
+               scalingMs, speedup, speedup / threads * 100);
+    }
+
+    DestroyFrameStats(&emptyStats);
+    DestroyFrameStats(&spawnStats);
+    DestroyFrameStats(&scalingStats);
+    free(data.in);
+    free(data.out);
+    free(jobs);
+    return 0;
+}
@@ -0,0 +1,394 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "job-system.h"
+#include <sched.h>
+#include <stdlib.h>
+
+#define INITIAL_DEQUE_CAPACITY 256
+/* Slices per thread when JobSystemParallelFor picks the grain */
+#define PARALLEL_FOR_SLICES_PER_THREAD 4
+
+/* The worker the current thread runs, NULL on threads that aren't workers */
+local pthread_key_t currentWorkerKey;
+local pthread_once_t currentWorkerKeyOnce = PTHREAD_ONCE_INIT;
+
+local void CreateCurrentWorkerKey(void)
+{
+    pthread_key_create(&currentWorkerKey, NULL);
+}
+
+/* NULL when the calling thread isn't one of js's workers */
+local JobWorker *CurrentWorker(JobSystem *js)
+{
+    JobWorker *w = pthread_getspecific(currentWorkerKey);
+    return w && w->js == js ? w : NULL;
+}
+
+/* Threads that aren't workers use worker 0's deque */
+local JobDeque *CurrentDeque(JobSystem *js)
+{
+    JobWorker *w = CurrentWorker(js);
+    return w ? &w->deque : &js->workers[0].deque;
+}
+
+local bool JobDequeInit(JobDeque *d)
+{
+    *d = (JobDeque){0};
+    d->jobs = malloc(sizeof(d->jobs[0]) * INITIAL_DEQUE_CAPACITY);
+    if (!d->jobs)
+    {
+        return false;
+    }
+    d->capacity = INITIAL_DEQUE_CAPACITY;
+    pthread_mutex_init(&d->lock, NULL);
+    return true;
+}
+
+local void JobDequeDestroy(JobDeque *d)
+{
+    pthread_mutex_destroy(&d->lock);
+    free(d->jobs);
+    *d = (JobDeque){0};
+}
+
+/* Caller holds the lock. Capacity is a power of two so head and tail can
+   wrap freely */
+local void JobDequePushLocked(JobDeque *d, Job job)
+{
+    if (d->tail - d->head == d->capacity)
+    {
+        Job *jobs = malloc(sizeof(jobs[0]) * d->capacity * 2);
+        if (!jobs)
+        {
+            abort();
+        }
+        for (u32 i = d->head; i != d->tail; i++)
+        {
+            jobs[i & (d->capacity * 2 - 1)] = d->jobs[i & (d->capacity - 1)];
+        }
+        free(d->jobs);
+        d->jobs = jobs;
+        d->capacity *= 2;
+    }
+    d->jobs[d->tail++ & (d->capacity - 1)] = job;
+}
+
+local bool JobDequePop(JobDeque *d, Job *out)
+{
+    bool ret = false;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail != d->head)
+    {
+        *out = d->jobs[--d->tail & (d->capacity - 1)];
+        ret = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+local bool JobDequeSteal(JobDeque *d, Job *out)
+{
+    bool ret = false;
+    /* Don't queue up behind the owner, there are other victims */
+    if (pthread_mutex_trylock(&d->lock) != 0)
+    {
+        return false;
+    }
+    if (d->tail != d->head)
+    {
+        *out = d->jobs[d->head++ & (d->capacity - 1)];
+        ret = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+local u32 XorShift32(u32 *state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* Own deque first, then the others starting from a random victim. rng
+   belongs to the calling thread */
+local bool JobSystemFindJob(JobSystem *js, JobDeque *own, u32 *rng, Job *out)
+{
+    bool found = JobDequePop(own, out);
+    if (!found && js->threadCount > 1)
+    {
+        u32 start = XorShift32(rng) % js->threadCount;
+        for (u32 i = 0; i < js->threadCount && !found; i++)
+        {
+            JobDeque *victim = &js->workers[(start + i) % js->threadCount].deque;
+            if (victim != own)
+            {
+                found = JobDequeSteal(victim, out);
+            }
+        }
+    }
+    if (found)
+    {
+        __atomic_fetch_sub(&js->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return found;
+}
+
+local void RunJob(Job *job)
+{
+    job->fun(job->data);
+    if (job->counter)
+    {
+        __atomic_fetch_sub(&job->counter->value, 1, __ATOMIC_RELEASE);
+    }
+}
+
+local void *JobWorkerMain(void *arg)
+{
+    JobWorker *self = arg;
+    JobSystem *js = self->js;
+    pthread_setspecific(currentWorkerKey, self);
+
+    for (;;)
+    {
+        Job job;
+        if (JobSystemFindJob(js, &self->deque, &self->rng, &job))
+        {
+            RunJob(&job);
+            continue;
+        }
+
+        /* sleepers goes up before queued is checked and JobSystemRun bumps
+           queued before it checks sleepers, so one of the two always sees
+           the other */
+        pthread_mutex_lock(&js->sleepLock);
+        __atomic_fetch_add(&js->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&js->queued, __ATOMIC_SEQ_CST) == 0 && !js->quit)
+        {
+            pthread_cond_wait(&js->wake, &js->sleepLock);
+        }
+        __atomic_fetch_sub(&js->sleepers, 1, __ATOMIC_SEQ_CST);
+        bool quit = js->quit;
+        pthread_mutex_unlock(&js->sleepLock);
+        if (quit)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+bool CreateJobSystem(u32 threadCount, JobSystem *out)
+{
+    pthread_once(&currentWorkerKeyOnce, CreateCurrentWorkerKey);
+
+    *out = (JobSystem){0};
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+    out->workers = calloc(threadCount, sizeof(out->workers[0]));
+    if (!out->workers)
+    {
+        return false;
+    }
+    pthread_mutex_init(&out->sleepLock, NULL);
+    pthread_cond_init(&out->wake, NULL);
+
+    for (u32 i = 0; i < threadCount; i++)
+    {
+        JobWorker *w = &out->workers[i];
+        w->js = out;
+        w->index = i;
+        w->rng = 0x9E3779B9u * (i + 1);
+        if (!JobDequeInit(&w->deque))
+        {
+            /* No threads yet, so there's nothing to join */
+            for (u32 j = 0; j < i; j++)
+            {
+                JobDequeDestroy(&out->workers[j].deque);
+            }
+            pthread_cond_destroy(&out->wake);
+            pthread_mutex_destroy(&out->sleepLock);
+            free(out->workers);
+            *out = (JobSystem){0};
+            return false;
+        }
+    }
+    out->threadCount = threadCount;
+    pthread_setspecific(currentWorkerKey, &out->workers[0]);
+
+    /* Worker 0 is the creating thread */
+    for (u32 i = 1; i < threadCount; i++)
+    {
+        if (pthread_create(&out->workers[i].thread, NULL, JobWorkerMain, &out->workers[i]) != 0)
+        {
+            /* Only the threads that started get joined */
+            for (u32 j = i; j < threadCount; j++)
+            {
+                JobDequeDestroy(&out->workers[j].deque);
+            }
+            out->threadCount = i;
+            DestroyJobSystem(out);
+            return false;
+        }
+    }
+    return true;
+}
+
+void DestroyJobSystem(JobSystem *js)
+{
+    pthread_mutex_lock(&js->sleepLock);
+    js->quit = true;
+    pthread_cond_broadcast(&js->wake);
+    pthread_mutex_unlock(&js->sleepLock);
+
+    /* Every worker is joined before any deque goes, since the ones still
+       running may be trying to steal from it */
+    for (u32 i = 1; i < js->threadCount; i++)
+    {
+        pthread_join(js->workers[i].thread, NULL);
+    }
+    for (u32 i = 0; i < js->threadCount; i++)
+    {
+        JobDequeDestroy(&js->workers[i].deque);
+    }
+
+    if (pthread_getspecific(currentWorkerKey) == &js->workers[0])
+    {
+        pthread_setspecific(currentWorkerKey, NULL);
+    }
+    pthread_cond_destroy(&js->wake);
+    pthread_mutex_destroy(&js->sleepLock);
+    free(js->workers);
+    *js = (JobSystem){0};
+}
+
+u32 JobSystemWorkerIndex(JobSystem *js)
+{
+    JobWorker *w = CurrentWorker(js);
+    return w ? w->index : 0;
+}
+
+void JobSystemRun(JobSystem *js, Job *jobs, u32 count, JobCounter *counter)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (counter)
+    {
+        __atomic_fetch_add(&counter->value, count, __ATOMIC_SEQ_CST);
+    }
+
+    /* Counted before they're visible so a thief can't take queued below
+       zero */
+    __atomic_fetch_add(&js->queued, count, __ATOMIC_SEQ_CST);
+    JobDeque *d = CurrentDeque(js);
+    pthread_mutex_lock(&d->lock);
+    for (u32 i = 0; i < count; i++)
+    {
+        jobs[i].counter = counter;
+        JobDequePushLocked(d, jobs[i]);
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if (__atomic_load_n(&js->sleepers, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&js->sleepLock);
+        if (count == 1)
+        {
+            pthread_cond_signal(&js->wake);
+        }
+        else
+        {
+            pthread_cond_broadcast(&js->wake);
+        }
+        pthread_mutex_unlock(&js->sleepLock);
+    }
+}
+
+void JobSystemWait(JobSystem *js, JobCounter *counter)
+{
+    JobWorker *self = CurrentWorker(js);
+    /* Worker 0's rng belongs to the creating thread, other threads that
+       aren't workers keep theirs for the length of the wait */
+    u32 rng = 0x9E3779B9u;
+    u32 *ownRng = self ? &self->rng : &rng;
+    JobDeque *own = CurrentDeque(js);
+    while (__atomic_load_n(&counter->value, __ATOMIC_ACQUIRE) != 0)
+    {
+        Job job;
+        if (JobSystemFindJob(js, own, ownRng, &job))
+        {
+            RunJob(&job);
+        }
+        else
+        {
+            /* The last jobs are running elsewhere */
+            sched_yield();
+        }
+    }
+}
+
+typedef struct ParallelForSlice
+{
+    ParallelForFun fun;
+    void *user;
+    u32 first;
+    u32 count;
+} ParallelForSlice;
+
+local void ParallelForSliceJob(void *data)
+{
+    ParallelForSlice *slice = data;
+    slice->fun(slice->first, slice->count, slice->user);
+}
+
+void JobSystemParallelFor(JobSystem *js, u32 count, u32 grain, ParallelForFun fun, void *user)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        u32 slices = js->threadCount * PARALLEL_FOR_SLICES_PER_THREAD;
+        grain = (count + slices - 1) / slices;
+    }
+    u32 sliceCount = (count + grain - 1) / grain;
+    if (sliceCount == 1)
+    {
+        fun(0, count, user);
+        return;
+    }
+
+    ParallelForSlice *slices = malloc(sizeof(slices[0]) * sliceCount);
+    Job *jobs = malloc(sizeof(jobs[0]) * sliceCount);
+    if (!slices || !jobs)
+    {
+        free(slices);
+        free(jobs);
+        fun(0, count, user);
+        return;
+    }
+    for (u32 i = 0; i < sliceCount; i++)
+    {
+        slices[i].fun = fun;
+        slices[i].user = user;
+        slices[i].first = i * grain;
+        slices[i].count = i == sliceCount - 1 ? count - i * grain : grain;
+        jobs[i].fun = ParallelForSliceJob;
+        jobs[i].data = &slices[i];
+    }
+
+    JobCounter counter = {0};
+    JobSystemRun(js, jobs, sliceCount, &counter);
+    JobSystemWait(js, &counter);
+    free(jobs);
+    free(slices);
+}
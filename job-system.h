@@ -0,0 +1,88 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include "rutils/def.h"
+#include <pthread.h>
+
+typedef void (*JobFun)(void *data);
+
+/* Called with a contiguous slice of [0, count) */
+typedef void (*ParallelForFun)(u32 first, u32 count, void *user);
+
+/* Number of jobs still outstanding. Only touched through the atomic
+   builtins */
+typedef struct JobCounter
+{
+    u32 value;
+} JobCounter;
+
+typedef struct Job
+{
+    JobFun fun;
+    void *data;
+    JobCounter *counter;
+} Job;
+
+/* Ring buffer of jobs. The owner pushes and pops at the tail, thieves take
+   from the head so they get the oldest and usually biggest work */
+typedef struct JobDeque
+{
+    pthread_mutex_t lock;
+    Job *jobs;
+    u32 capacity;
+    u32 head;
+    u32 tail;
+} JobDeque;
+
+struct JobSystem;
+
+typedef struct JobWorker
+{
+    struct JobSystem *js;
+    u32 index;
+    pthread_t thread;
+    JobDeque deque;
+    u32 rng;
+} JobWorker;
+
+/* threadCount - 1 worker threads plus the thread that created it, which is
+   worker 0. Other threads push to and pop from worker 0's deque, which is
+   locked like every deque, and steal with their own victim order, so jobs
+   can be run and waited on from anywhere */
+typedef struct JobSystem
+{
+    u32 threadCount;
+    JobWorker *workers;
+
+    /* Jobs sitting in deques, used to decide when workers may sleep */
+    u32 queued;
+    u32 sleepers;
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wake;
+    bool quit;
+} JobSystem;
+
+bool CreateJobSystem(u32 threadCount, JobSystem *out);
+
+/* Every job must have finished */
+void DestroyJobSystem(JobSystem *js);
+
+/* Index of the calling thread's worker. Threads that aren't workers get 0
+   as well, so per worker data indexed by it is only safe from workers */
+u32 JobSystemWorkerIndex(JobSystem *js);
+
+/* Queues count jobs on the calling thread's deque. counter, if not NULL,
+   goes up by count now and down by one as each job finishes. The counter in
+   each Job is overwritten */
+void JobSystemRun(JobSystem *js, Job *jobs, u32 count, JobCounter *counter);
+
+/* Runs queued jobs until counter reaches zero. Safe to call from inside a
+   job, which is how one job depends on others */
+void JobSystemWait(JobSystem *js, JobCounter *counter);
+
+/* Calls fun over [0, count) in slices of at most grain items and returns once
+   they're all done. A grain of 0 picks one that gives every thread a few
+   slices */
+void JobSystemParallelFor(JobSystem *js, u32 count, u32 grain, ParallelForFun fun, void *user);
+
+#endif
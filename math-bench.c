@@ -0,0 +1,271 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "cpu-features.h"
+#include "frame-stats.h"
+#include "simd-math.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Per matrix cost of the simd-math.c kernels, scalar against SSE and AVX:
+     math-bench [matrix count] */
+
+#define DEFAULT_MATRICES 4096
+#define REPEATS 50
+/* Relative difference tolerated between a variant and the scalar result */
+#define TOLERANCE 1e-4f
+
+local f32 RandomF32(void)
+{
+    return rand() / (f32)RAND_MAX * 2 - 1;
+}
+
+/* Diagonally dominant so every one of them is invertible */
+local Mat4f RandomMat4f(void)
+{
+    Mat4f m;
+    for (u32 c = 0; c < 4; c++)
+    {
+        for (u32 r = 0; r < 4; r++)
+        {
+            m.e[c][r] = RandomF32() + (c == r ? 4 : 0);
+        }
+    }
+    return m;
+}
+
+local bool NearlyEqual(const f32 *a, const f32 *b, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        if (fabsf(a[i] - b[i]) > TOLERANCE * fmaxf(1, fabsf(b[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct BenchData
+{
+    Mat4f *a;
+    Mat4f *b;
+    Mat4f *out;
+    f32 (*vectors)[4];
+    f32 (*transformed)[4];
+    u32 count;
+} BenchData;
+
+/* Every kernel is wrapped to run over the whole array so they can share one
+   timing loop */
+typedef void (*BenchFun)(BenchData *d);
+
+local void MulScalar(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        MulMat4fScalar(&d->a[i], &d->b[i], &d->out[i]);
+    }
+}
+
+local void MulSSE(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        MulMat4fSSE(&d->a[i], &d->b[i], &d->out[i]);
+    }
+}
+
+local void MulAVX(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        MulMat4fAVX(&d->a[i], &d->b[i], &d->out[i]);
+    }
+}
+
+local void InvertScalar(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        InvertMat4fScalar(&d->a[i], &d->out[i]);
+    }
+}
+
+local void InvertSSE(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        InvertMat4fSSE(&d->a[i], &d->out[i]);
+    }
+}
+
+local void TransformScalar(BenchData *d)
+{
+    TransformVec4sScalar(&d->a[0], d->vectors, d->transformed, d->count);
+}
+
+local void TransformSSE(BenchData *d)
+{
+    TransformVec4sSSE(&d->a[0], d->vectors, d->transformed, d->count);
+}
+
+local void TransformAVX(BenchData *d)
+{
+    TransformVec4sAVX(&d->a[0], d->vectors, d->transformed, d->count);
+}
+
+/* Unbatched reference: proj * view * model per object, like the vertex
+   shader used to */
+local void MVPSeparate(BenchData *d)
+{
+    for (u32 i = 0; i < d->count; i++)
+    {
+        Mat4f viewModel;
+        MulMat4fScalar(&d->a[1], &d->b[i], &viewModel);
+        MulMat4fScalar(&d->a[0], &viewModel, &d->out[i]);
+    }
+}
+
+local void MVPScalar(BenchData *d)
+{
+    CalcMVPBatchScalar(&d->a[0], &d->a[1], d->b, d->count, d->out);
+}
+
+local void MVPSSE(BenchData *d)
+{
+    CalcMVPBatchSSE(&d->a[0], &d->a[1], d->b, d->count, d->out);
+}
+
+local void MVPAVX(BenchData *d)
+{
+    CalcMVPBatchAVX(&d->a[0], &d->a[1], d->b, d->count, d->out);
+}
+
+typedef struct BenchVariant
+{
+    const char *name;
+    BenchFun fun;
+    bool needsAVX;
+} BenchVariant;
+
+/* The first variant is the reference the others are checked against. Results
+   are matrices in out unless vectorResults is set */
+typedef struct BenchGroup
+{
+    const char *name;
+    BenchVariant variants[4];
+    bool vectorResults;
+} BenchGroup;
+
+local double BenchRun(BenchFun fun, BenchData *d, FrameStats *stats)
+{
+    ResetFrameStats(stats);
+    for (u32 i = 0; i <= REPEATS; i++)
+    {
+        double start = GetTimeSeconds();
+        fun(d);
+        FrameStatsRecord(stats, (GetTimeSeconds() - start) * 1000);
+    }
+    return SummarizeFrameStats(stats).p50;
+}
+
+int main(int argc, char **argv)
+{
+    u32 count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MATRICES;
+    if (count < 2)
+    {
+        count = 2;
+    }
+
+    BenchData d = {
+        .a = malloc(sizeof(Mat4f) * count),
+        .b = malloc(sizeof(Mat4f) * count),
+        .out = malloc(sizeof(Mat4f) * count),
+        .vectors = malloc(sizeof(f32[4]) * count),
+        .transformed = malloc(sizeof(f32[4]) * count),
+        .count = count,
+    };
+    Mat4f *reference = malloc(sizeof(Mat4f) * count);
+    FrameStats stats;
+    if (!d.a || !d.b || !d.out || !d.vectors || !d.transformed || !reference ||
+        !CreateFrameStats(REPEATS, 1, &stats))
+    {
+        puts("Out of memory");
+        return 1;
+    }
+
+    /* Fixed seed so runs are comparable */
+    srand(1);
+    for (u32 i = 0; i < count; i++)
+    {
+        d.a[i] = RandomMat4f();
+        d.b[i] = RandomMat4f();
+        for (u32 j = 0; j < 4; j++)
+        {
+            d.vectors[i][j] = RandomF32() * 10;
+        }
+    }
+
+    bool hasAVX = CPUHasAVX();
+    BenchGroup groups[] = {
+        {"multiply", {{"scalar", MulScalar, false}, {"SSE", MulSSE, false}, {"AVX", MulAVX, true}}, false},
+        {"inverse", {{"scalar", InvertScalar, false}, {"SSE", InvertSSE, false}}, false},
+        {"transform",
+         {{"scalar", TransformScalar, false}, {"SSE", TransformSSE, false}, {"AVX", TransformAVX, true}},
+         true},
+        {"mvp",
+         {{"separate", MVPSeparate, false},
+          {"scalar", MVPScalar, false},
+          {"SSE", MVPSSE, false},
+          {"AVX", MVPAVX, true}},
+         false},
+    };
+
+    printf("%u matrices, median of %d runs. transform is per vector\n", count, REPEATS);
+    puts("kernel     variant    ns/matrix  speedup");
+    int returnValue = 0;
+    for (u32 g = 0; g < countof(groups); g++)
+    {
+        BenchGroup *group = &groups[g];
+        double referenceNs = 0;
+        for (u32 v = 0; v < countof(group->variants) && group->variants[v].fun; v++)
+        {
+            BenchVariant *variant = &group->variants[v];
+            if (variant->needsAVX && !hasAVX)
+            {
+                printf("%-10s %-8s not supported on this CPU\n", group->name, variant->name);
+                continue;
+            }
+
+            double ns = BenchRun(variant->fun, &d, &stats) * 1000000 / count;
+            const f32 *results = group->vectorResults ? &d.transformed[0][0] : &d.out[0].e[0][0];
+            bool matches = true;
+            if (v == 0)
+            {
+                referenceNs = ns;
+                memcpy(reference, results, group->vectorResults ? sizeof(f32[4]) * count : sizeof(Mat4f) * count);
+            }
+            else
+            {
+                matches = NearlyEqual(results, &reference[0].e[0][0], (group->vectorResults ? 4 : 16) * count);
+            }
+            printf("%-10s %-8s %11.2f %7.2fx%s\n", group->name, variant->name, ns, referenceNs / ns,
+                   matches ? "" : " MISMATCH");
+            if (!matches)
+            {
+                returnValue = 1;
+            }
+        }
+    }
+
+    DestroyFrameStats(&stats);
+    free(reference);
+    free(d.transformed);
+    free(d.vectors);
+    free(d.out);
+    free(d.b);
+    free(d.a);
+    return returnValue;
+}
@@ -0,0 +1,110 @@
+#include "mipmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIPMAP_X86 1
+#include <emmintrin.h>
+#else
+#define MIPMAP_X86 0
+#endif
+
+usize MipLevelOffset(u32 x, u32 y, u32 bytesPerPixel, u32 level)
+{
+    usize offset = 0;
+    for (u32 i = 0; i < level; i++)
+    {
+        offset += (usize)MipExtent(x, i) * MipExtent(y, i) * bytesPerPixel;
+    }
+    return offset;
+}
+
+/* Averages columns first through last of the 2x2 footprints under row */
+local void DownsampleRowRGBA8(const u8 *row0, const u8 *row1, u32 x, u32 first, u32 last, u8 *dst)
+{
+    for (u32 i = first; i < last; i++)
+    {
+        u32 x0 = 2 * i;
+        u32 x1 = x0 + 1 < x ? x0 + 1 : x0;
+        for (u32 c = 0; c < 4; c++)
+        {
+            u32 sum = row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c];
+            dst[i * 4 + c] = (u8)((sum + 2) / 4);
+        }
+    }
+}
+
+void DownsampleRGBA8Scalar(const u8 *src, u32 x, u32 y, u8 *dst)
+{
+    u32 dx = MipExtent(x, 1);
+    u32 dy = MipExtent(y, 1);
+    for (u32 j = 0; j < dy; j++)
+    {
+        u32 y0 = 2 * j;
+        u32 y1 = y0 + 1 < y ? y0 + 1 : y0;
+        DownsampleRowRGBA8(src + (usize)y0 * x * 4, src + (usize)y1 * x * 4, x, 0, dx, dst + (usize)j * dx * 4);
+    }
+}
+
+#if MIPMAP_X86
+
+/* Sums of two horizontally adjacent pixels from each of two 16 bit rows,
+   pixel pair 0 in lanes 0 to 3 and pair 1 in lanes 4 to 7 */
+local __m128i SumPixelPairs(__m128i a, __m128i b)
+{
+    return _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+}
+
+void DownsampleRGBA8SSE(const u8 *src, u32 x, u32 y, u8 *dst)
+{
+    u32 dx = MipExtent(x, 1);
+    u32 dy = MipExtent(y, 1);
+    __m128i zero = _mm_setzero_si128();
+    __m128i two = _mm_set1_epi16(2);
+    for (u32 j = 0; j < dy; j++)
+    {
+        u32 y0 = 2 * j;
+        u32 y1 = y0 + 1 < y ? y0 + 1 : y0;
+        const u8 *row0 = src + (usize)y0 * x * 4;
+        const u8 *row1 = src + (usize)y1 * x * 4;
+        u8 *out = dst + (usize)j * dx * 4;
+
+        /* 8 source pixels from each row make 4 output ones. x >= 2 * dx
+           here, so every footprint has both of its columns */
+        u32 i = 0;
+        for (; i + 4 <= dx && x >= 2; i += 4)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(row0 + i * 8));
+            __m128i b = _mm_loadu_si128((const __m128i *)(row0 + i * 8 + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(row1 + i * 8));
+            __m128i d = _mm_loadu_si128((const __m128i *)(row1 + i * 8 + 16));
+
+            __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero));
+            __m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero));
+            __m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero));
+            __m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero));
+
+            __m128i lo = _mm_srli_epi16(_mm_add_epi16(SumPixelPairs(s01, s23), two), 2);
+            __m128i hi = _mm_srli_epi16(_mm_add_epi16(SumPixelPairs(s45, s67), two), 2);
+            _mm_storeu_si128((__m128i *)(out + i * 4), _mm_packus_epi16(lo, hi));
+        }
+        DownsampleRowRGBA8(row0, row1, x, i, dx, out);
+    }
+}
+
+#else
+
+void DownsampleRGBA8SSE(const u8 *src, u32 x, u32 y, u8 *dst)
+{
+    DownsampleRGBA8Scalar(src, x, y, dst);
+}
+
+#endif
+
+void GenerateMipChainRGBA8(u8 *chain, u32 x, u32 y, u32 levels)
+{
+    for (u32 level = 1; level < levels; level++)
+    {
+        DownsampleRGBA8SSE(chain + MipLevelOffset(x, y, 4, level - 1),
+                           MipExtent(x, level - 1), MipExtent(y, level - 1),
+                           chain + MipLevelOffset(x, y, 4, level));
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "rutils/def.h"
+
+/* Levels in a full chain, down to 1x1 */
+local u32 MipLevelCount(u32 x, u32 y)
+{
+    u32 size = x > y ? x : y;
+    u32 levels = 1;
+    while (size > 1)
+    {
+        size >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+/* Width or height of level, never below 1 */
+local u32 MipExtent(u32 size, u32 level)
+{
+    size >>= level;
+    return size ? size : 1;
+}
+
+/* Where level starts when the levels are packed back to back, level 0 first.
+   Passing the level count gives the size of the whole chain */
+usize MipLevelOffset(u32 x, u32 y, u32 bytesPerPixel, u32 level);
+
+/* 2x2 box filter from an x by y RGBA8 image into one of
+   MipExtent(x, 1) by MipExtent(y, 1). With an odd size the last row or
+   column is dropped */
+void DownsampleRGBA8Scalar(const u8 *src, u32 x, u32 y, u8 *dst);
+/* 4 output pixels per iteration */
+void DownsampleRGBA8SSE(const u8 *src, u32 x, u32 y, u8 *dst);
+
+/* Fills levels 1 to levels - 1 of a packed chain whose level 0 is already
+   in place */
+void GenerateMipChainRGBA8(u8 *chain, u32 x, u32 y, u32 levels);
+
+#endif
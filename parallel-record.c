@@ -0,0 +1,143 @@
+#include "parallel-record.h"
+#include <stdlib.h>
+
+local void RecordSlice(u32 first, u32 count, void *user)
+{
+    ParallelRecorder *r = user;
+    for (u32 slice = first; slice < first + count; slice++)
+    {
+        r->sliceOk[slice] = false;
+
+        VkCommandBufferAllocateInfo allocInfo = {0};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = r->pools[slice];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(r->ld->dev, &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            r->out[slice] = VK_NULL_HANDLE;
+            continue;
+        }
+        r->out[slice] = commandBuffer;
+
+        VkCommandBufferBeginInfo beginInfo = {0};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                          VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = &r->inheritance;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        {
+            continue;
+        }
+
+        /* Even split, the first drawCount % sliceCount slices get one extra */
+        u32 base = r->drawCount / r->sliceCount;
+        u32 extra = r->drawCount % r->sliceCount;
+        u32 firstDraw = slice * base + (slice < extra ? slice : extra);
+        u32 drawCount = base + (slice < extra ? 1 : 0);
+        if (drawCount)
+        {
+            r->fun(commandBuffer, firstDraw, drawCount, r->user);
+        }
+
+        r->sliceOk[slice] = vkEndCommandBuffer(commandBuffer) == VK_SUCCESS;
+    }
+}
+
+bool CreateParallelRecorder(LogicalDevice *ld, JobSystem *js, u32 sliceCount, ParallelRecorder *out)
+{
+    *out = (ParallelRecorder){0};
+    if (sliceCount == 0)
+    {
+        sliceCount = 1;
+    }
+    out->ld = ld;
+    out->js = js;
+    out->pools = calloc(sliceCount, sizeof(out->pools[0]));
+    out->sliceOk = calloc(sliceCount, sizeof(out->sliceOk[0]));
+    if (!out->pools || !out->sliceOk)
+    {
+        DestroyParallelRecorder(out);
+        return false;
+    }
+
+    for (u32 i = 0; i < sliceCount; i++)
+    {
+        out->pools[i] = CreateCommandPool(ld, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+        if (out->pools[i] == VK_NULL_HANDLE)
+        {
+            out->sliceCount = i;
+            DestroyParallelRecorder(out);
+            return false;
+        }
+    }
+    out->sliceCount = sliceCount;
+    return true;
+}
+
+void DestroyParallelRecorder(ParallelRecorder *recorder)
+{
+    for (u32 i = 0; i < recorder->sliceCount; i++)
+    {
+        vkDestroyCommandPool(recorder->ld->dev, recorder->pools[i], NULL);
+    }
+    free(recorder->sliceOk);
+    free(recorder->pools);
+    *recorder = (ParallelRecorder){0};
+}
+
+bool RecordParallelSecondaries(ParallelRecorder *recorder, VkRenderPass renderPass, VkFramebuffer framebuffer,
+                               u32 drawCount, RecordSliceFun fun, void *user, VkCommandBuffer *out)
+{
+    ParallelRecorder *r = recorder;
+
+    VkCommandBufferInheritanceInfo inheritance = {0};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = renderPass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = framebuffer;
+
+    r->inheritance = inheritance;
+    r->drawCount = drawCount;
+    r->fun = fun;
+    r->user = user;
+    r->out = out;
+    /* One slice per job, they're all about the same size */
+    JobSystemParallelFor(r->js, r->sliceCount, 1, RecordSlice, r);
+
+    bool ok = true;
+    for (u32 i = 0; i < r->sliceCount; i++)
+    {
+        ok = ok && r->sliceOk[i];
+    }
+    if (!ok)
+    {
+        FreeParallelSecondaries(r, out);
+    }
+    return ok;
+}
+
+void FreeParallelSecondaries(ParallelRecorder *recorder, VkCommandBuffer *buffers)
+{
+    for (u32 i = 0; i < recorder->sliceCount; i++)
+    {
+        if (buffers[i] != VK_NULL_HANDLE)
+        {
+            vkFreeCommandBuffers(recorder->ld->dev, recorder->pools[i], 1, &buffers[i]);
+            buffers[i] = VK_NULL_HANDLE;
+        }
+    }
+}
+
+void DeferFreeParallelSecondaries(DeletionQueue *queue, ParallelRecorder *recorder, VkCommandBuffer *buffers)
+{
+    for (u32 i = 0; i < recorder->sliceCount; i++)
+    {
+        VkCommandBuffer *single = malloc(sizeof(*single));
+        *single = buffers[i];
+        DeferFreeCommandBuffers(queue, recorder->pools[i], 1, single);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef PARALLEL_RECORD_H
+#define PARALLEL_RECORD_H
+
+#include "job-system.h"
+#include "vk-basic.h"
+
+/* Records one slice of a draw list into commandBuffer. The buffer inherits
+   nothing but the render pass, so the slice has to bind its own pipeline,
+   buffers, descriptor sets and dynamic state */
+typedef void (*RecordSliceFun)(VkCommandBuffer commandBuffer, u32 firstDraw, u32 drawCount, void *user);
+
+/* Splits a draw list into sliceCount secondary command buffers, recorded as
+   jobs on a JobSystem. Command pools are externally synchronized, so each
+   slice gets a pool of its own. Only the job recording slice i touches pool
+   i, whichever worker that job lands on */
+typedef struct ParallelRecorder
+{
+    LogicalDevice *ld;
+    JobSystem *js;
+    u32 sliceCount;
+    VkCommandPool *pools;
+    bool *sliceOk;
+
+    /* The job being recorded, only valid while RecordParallelSecondaries runs */
+    VkCommandBufferInheritanceInfo inheritance;
+    u32 drawCount;
+    RecordSliceFun fun;
+    void *user;
+    VkCommandBuffer *out;
+} ParallelRecorder;
+
+/* js has to outlive the recorder */
+bool CreateParallelRecorder(LogicalDevice *ld, JobSystem *js, u32 sliceCount, ParallelRecorder *out);
+
+/* Nothing recorded by the recorder may still be pending */
+void DestroyParallelRecorder(ParallelRecorder *recorder);
+
+/* Fills out[0..sliceCount) with freshly allocated secondary command buffers
+   for subpass 0 of renderPass. Buffer i comes from slice i's pool. Blocks,
+   running slices itself, until every slice is recorded. Calls must not
+   overlap */
+bool RecordParallelSecondaries(ParallelRecorder *recorder, VkRenderPass renderPass, VkFramebuffer framebuffer,
+                               u32 drawCount, RecordSliceFun fun, void *user, VkCommandBuffer *out);
+
+/* buffers holds sliceCount buffers from RecordParallelSecondaries. The
+   recorder must be idle */
+void FreeParallelSecondaries(ParallelRecorder *recorder, VkCommandBuffer *buffers);
+
+/* Same as FreeParallelSecondaries but through the deletion queue */
+void DeferFreeParallelSecondaries(DeletionQueue *queue, ParallelRecorder *recorder, VkCommandBuffer *buffers);
+
+#endif
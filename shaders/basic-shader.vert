@@ -10,6 +10,8 @@ layout(binding = 0) uniform UniformBufferObject
     mat4 model;
     mat4 view;
     mat4 proj;
+    mat4 viewProj;
+    mat4 mvp;
 }
 ubo;
 
@@ -23,7 +25,7 @@ out gl_PerVertex
 
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPos, 1.0);
+    gl_Position = ubo.mvp * vec4(inPos, 1.0);
     fragColor = inCol;
     fragTexCoord = texCoord;
 }
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec3 inCol;
+layout(location = 2) in vec2 texCoord;
+/* Per instance and already premultiplied by view and projection, takes
+   locations 3 to 6 */
+layout(location = 3) in mat4 instanceMVP;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+void main()
+{
+    gl_Position = instanceMVP * vec4(inPos, 1.0);
+    fragColor = inCol;
+    fragTexCoord = texCoord;
+}
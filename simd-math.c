@@ -0,0 +1,369 @@
+#include "simd-math.h"
+#include "cpu-features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATH_X86 1
+#include <immintrin.h>
+#else
+#define MATH_X86 0
+#endif
+
+void MulMat4fScalar(const Mat4f *a, const Mat4f *b, Mat4f *out)
+{
+    Mat4f r;
+    for (u32 c = 0; c < 4; c++)
+    {
+        for (u32 row = 0; row < 4; row++)
+        {
+            r.e[c][row] = a->e[0][row] * b->e[c][0] + a->e[1][row] * b->e[c][1] +
+                          a->e[2][row] * b->e[c][2] + a->e[3][row] * b->e[c][3];
+        }
+    }
+    *out = r;
+}
+
+bool InvertMat4fScalar(const Mat4f *m, Mat4f *out)
+{
+    const f32 *e = &m->e[0][0];
+    f32 inv[16];
+
+    /* Cofactors, transposed as they're computed */
+    inv[0] = e[5] * e[10] * e[15] - e[5] * e[11] * e[14] - e[9] * e[6] * e[15] +
+             e[9] * e[7] * e[14] + e[13] * e[6] * e[11] - e[13] * e[7] * e[10];
+    inv[4] = -e[4] * e[10] * e[15] + e[4] * e[11] * e[14] + e[8] * e[6] * e[15] -
+             e[8] * e[7] * e[14] - e[12] * e[6] * e[11] + e[12] * e[7] * e[10];
+    inv[8] = e[4] * e[9] * e[15] - e[4] * e[11] * e[13] - e[8] * e[5] * e[15] +
+             e[8] * e[7] * e[13] + e[12] * e[5] * e[11] - e[12] * e[7] * e[9];
+    inv[12] = -e[4] * e[9] * e[14] + e[4] * e[10] * e[13] + e[8] * e[5] * e[14] -
+              e[8] * e[6] * e[13] - e[12] * e[5] * e[10] + e[12] * e[6] * e[9];
+    inv[1] = -e[1] * e[10] * e[15] + e[1] * e[11] * e[14] + e[9] * e[2] * e[15] -
+             e[9] * e[3] * e[14] - e[13] * e[2] * e[11] + e[13] * e[3] * e[10];
+    inv[5] = e[0] * e[10] * e[15] - e[0] * e[11] * e[14] - e[8] * e[2] * e[15] +
+             e[8] * e[3] * e[14] + e[12] * e[2] * e[11] - e[12] * e[3] * e[10];
+    inv[9] = -e[0] * e[9] * e[15] + e[0] * e[11] * e[13] + e[8] * e[1] * e[15] -
+             e[8] * e[3] * e[13] - e[12] * e[1] * e[11] + e[12] * e[3] * e[9];
+    inv[13] = e[0] * e[9] * e[14] - e[0] * e[10] * e[13] - e[8] * e[1] * e[14] +
+              e[8] * e[2] * e[13] + e[12] * e[1] * e[10] - e[12] * e[2] * e[9];
+    inv[2] = e[1] * e[6] * e[15] - e[1] * e[7] * e[14] - e[5] * e[2] * e[15] +
+             e[5] * e[3] * e[14] + e[13] * e[2] * e[7] - e[13] * e[3] * e[6];
+    inv[6] = -e[0] * e[6] * e[15] + e[0] * e[7] * e[14] + e[4] * e[2] * e[15] -
+             e[4] * e[3] * e[14] - e[12] * e[2] * e[7] + e[12] * e[3] * e[6];
+    inv[10] = e[0] * e[5] * e[15] - e[0] * e[7] * e[13] - e[4] * e[1] * e[15] +
+              e[4] * e[3] * e[13] + e[12] * e[1] * e[7] - e[12] * e[3] * e[5];
+    inv[14] = -e[0] * e[5] * e[14] + e[0] * e[6] * e[13] + e[4] * e[1] * e[14] -
+              e[4] * e[2] * e[13] - e[12] * e[1] * e[6] + e[12] * e[2] * e[5];
+    inv[3] = -e[1] * e[6] * e[11] + e[1] * e[7] * e[10] + e[5] * e[2] * e[11] -
+             e[5] * e[3] * e[10] - e[9] * e[2] * e[7] + e[9] * e[3] * e[6];
+    inv[7] = e[0] * e[6] * e[11] - e[0] * e[7] * e[10] - e[4] * e[2] * e[11] +
+             e[4] * e[3] * e[10] + e[8] * e[2] * e[7] - e[8] * e[3] * e[6];
+    inv[11] = -e[0] * e[5] * e[11] + e[0] * e[7] * e[9] + e[4] * e[1] * e[11] -
+              e[4] * e[3] * e[9] - e[8] * e[1] * e[7] + e[8] * e[3] * e[5];
+    inv[15] = e[0] * e[5] * e[10] - e[0] * e[6] * e[9] - e[4] * e[1] * e[10] +
+              e[4] * e[2] * e[9] + e[8] * e[1] * e[6] - e[8] * e[2] * e[5];
+
+    f32 det = e[0] * inv[0] + e[1] * inv[4] + e[2] * inv[8] + e[3] * inv[12];
+    if (det == 0)
+    {
+        return false;
+    }
+    for (u32 i = 0; i < 16; i++)
+    {
+        (&out->e[0][0])[i] = inv[i] / det;
+    }
+    return true;
+}
+
+void TransformVec4sScalar(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        f32 v[4] = {in[i][0], in[i][1], in[i][2], in[i][3]};
+        for (u32 row = 0; row < 4; row++)
+        {
+            out[i][row] = m->e[0][row] * v[0] + m->e[1][row] * v[1] + m->e[2][row] * v[2] + m->e[3][row] * v[3];
+        }
+    }
+}
+
+void CalcMVPBatchScalar(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out)
+{
+    Mat4f viewProj;
+    MulMat4fScalar(proj, view, &viewProj);
+    for (u32 i = 0; i < count; i++)
+    {
+        MulMat4fScalar(&viewProj, &models[i], &out[i]);
+    }
+}
+
+#if MATH_X86
+
+#define SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define SWIZZLE(v, x, y, z, w) _mm_shuffle_ps((v), (v), SHUFFLE_MASK(x, y, z, w))
+#define SPLAT(v, i) SWIZZLE(v, i, i, i, i)
+
+/* a * column, the columns of a already in registers */
+local __m128 MulColumnSSE(const __m128 *a, __m128 column)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], SPLAT(column, 0)), _mm_mul_ps(a[1], SPLAT(column, 1))),
+                      _mm_add_ps(_mm_mul_ps(a[2], SPLAT(column, 2)), _mm_mul_ps(a[3], SPLAT(column, 3))));
+}
+
+/* Unrolled by hand throughout, with a loop the compiler keeps the columns on
+   the stack instead of in registers */
+local void LoadMat4fSSE(const Mat4f *m, __m128 *out)
+{
+    out[0] = _mm_loadu_ps(m->e[0]);
+    out[1] = _mm_loadu_ps(m->e[1]);
+    out[2] = _mm_loadu_ps(m->e[2]);
+    out[3] = _mm_loadu_ps(m->e[3]);
+}
+
+/* a * b with the columns of a in registers */
+local void MulLoadedMat4fSSE(const __m128 *a, const Mat4f *b, Mat4f *out)
+{
+    __m128 b0 = _mm_loadu_ps(b->e[0]);
+    __m128 b1 = _mm_loadu_ps(b->e[1]);
+    __m128 b2 = _mm_loadu_ps(b->e[2]);
+    __m128 b3 = _mm_loadu_ps(b->e[3]);
+    __m128 r0 = MulColumnSSE(a, b0);
+    __m128 r1 = MulColumnSSE(a, b1);
+    __m128 r2 = MulColumnSSE(a, b2);
+    __m128 r3 = MulColumnSSE(a, b3);
+    _mm_storeu_ps(out->e[0], r0);
+    _mm_storeu_ps(out->e[1], r1);
+    _mm_storeu_ps(out->e[2], r2);
+    _mm_storeu_ps(out->e[3], r3);
+}
+
+void MulMat4fSSE(const Mat4f *a, const Mat4f *b, Mat4f *out)
+{
+    __m128 ac[4];
+    LoadMat4fSSE(a, ac);
+    MulLoadedMat4fSSE(ac, b, out);
+}
+
+/* The 2x2 helpers below work on 2x2 matrices packed as (m00, m01, m10, m11).
+   a * b */
+local __m128 Mat2MulSSE(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, SWIZZLE(b, 0, 3, 0, 3)),
+                      _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+/* adj(a) * b */
+local __m128 Mat2AdjMulSSE(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(SWIZZLE(a, 3, 3, 0, 0), b),
+                      _mm_mul_ps(SWIZZLE(a, 1, 1, 2, 2), SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+/* a * adj(b) */
+local __m128 Mat2MulAdjSSE(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, SWIZZLE(b, 3, 0, 3, 0)),
+                      _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+/* Block inverse: m is split into 2x2 blocks A B / C D and the inverse is
+   built from their adjugates, which keeps everything in four registers */
+bool InvertMat4fSSE(const Mat4f *m, Mat4f *out)
+{
+    __m128 c[4];
+    LoadMat4fSSE(m, c);
+
+    __m128 a = _mm_movelh_ps(c[0], c[1]);
+    __m128 b = _mm_movehl_ps(c[1], c[0]);
+    __m128 cc = _mm_movelh_ps(c[2], c[3]);
+    __m128 d = _mm_movehl_ps(c[3], c[2]);
+
+    /* (|A|, |B|, |C|, |D|) */
+    __m128 dets = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(c[0], c[2], SHUFFLE_MASK(0, 2, 0, 2)),
+                                        _mm_shuffle_ps(c[1], c[3], SHUFFLE_MASK(1, 3, 1, 3))),
+                             _mm_mul_ps(_mm_shuffle_ps(c[0], c[2], SHUFFLE_MASK(1, 3, 1, 3)),
+                                        _mm_shuffle_ps(c[1], c[3], SHUFFLE_MASK(0, 2, 0, 2))));
+    __m128 detA = SPLAT(dets, 0);
+    __m128 detB = SPLAT(dets, 1);
+    __m128 detC = SPLAT(dets, 2);
+    __m128 detD = SPLAT(dets, 3);
+
+    __m128 dc = Mat2AdjMulSSE(d, cc);
+    __m128 ab = Mat2AdjMulSSE(a, b);
+    __m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), Mat2MulSSE(b, dc));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), Mat2MulSSE(cc, ab));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(detB, cc), Mat2MulAdjSSE(d, ab));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), Mat2MulAdjSSE(a, dc));
+
+    /* |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C) */
+    __m128 tr = _mm_mul_ps(ab, SWIZZLE(dc, 0, 2, 1, 3));
+    tr = _mm_add_ps(tr, SWIZZLE(tr, 1, 0, 3, 2));
+    tr = _mm_add_ps(tr, SWIZZLE(tr, 2, 3, 0, 1));
+    __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+    if (_mm_cvtss_f32(det) == 0)
+    {
+        return false;
+    }
+
+    __m128 rcp = _mm_div_ps(_mm_setr_ps(1, -1, -1, 1), det);
+    x = _mm_mul_ps(x, rcp);
+    y = _mm_mul_ps(y, rcp);
+    z = _mm_mul_ps(z, rcp);
+    w = _mm_mul_ps(w, rcp);
+
+    /* Undo the adjugate and the packing in one shuffle */
+    _mm_storeu_ps(out->e[0], _mm_shuffle_ps(x, y, SHUFFLE_MASK(3, 1, 3, 1)));
+    _mm_storeu_ps(out->e[1], _mm_shuffle_ps(x, y, SHUFFLE_MASK(2, 0, 2, 0)));
+    _mm_storeu_ps(out->e[2], _mm_shuffle_ps(z, w, SHUFFLE_MASK(3, 1, 3, 1)));
+    _mm_storeu_ps(out->e[3], _mm_shuffle_ps(z, w, SHUFFLE_MASK(2, 0, 2, 0)));
+    return true;
+}
+
+void TransformVec4sSSE(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count)
+{
+    __m128 mc[4];
+    LoadMat4fSSE(m, mc);
+    for (u32 i = 0; i < count; i++)
+    {
+        _mm_storeu_ps(out[i], MulColumnSSE(mc, _mm_loadu_ps(in[i])));
+    }
+}
+
+void CalcMVPBatchSSE(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out)
+{
+    Mat4f viewProj;
+    MulMat4fSSE(proj, view, &viewProj);
+    __m128 vp[4];
+    LoadMat4fSSE(&viewProj, vp);
+    for (u32 i = 0; i < count; i++)
+    {
+        MulLoadedMat4fSSE(vp, &models[i], &out[i]);
+    }
+}
+
+#define AVX_SPLAT(v, i) _mm256_permute_ps((v), SHUFFLE_MASK(i, i, i, i))
+
+/* a * two columns at once, each 128 bit lane holding one. a's columns are
+   duplicated into both lanes */
+__attribute__((target("avx"))) local __m256 MulColumnPairAVX(const __m256 *a, __m256 columns)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[0], AVX_SPLAT(columns, 0)),
+                                       _mm256_mul_ps(a[1], AVX_SPLAT(columns, 1))),
+                         _mm256_add_ps(_mm256_mul_ps(a[2], AVX_SPLAT(columns, 2)),
+                                       _mm256_mul_ps(a[3], AVX_SPLAT(columns, 3))));
+}
+
+__attribute__((target("avx"))) local void LoadMat4fDuplicatedAVX(const Mat4f *m, __m256 *out)
+{
+    out[0] = _mm256_broadcast_ps((const __m128 *)m->e[0]);
+    out[1] = _mm256_broadcast_ps((const __m128 *)m->e[1]);
+    out[2] = _mm256_broadcast_ps((const __m128 *)m->e[2]);
+    out[3] = _mm256_broadcast_ps((const __m128 *)m->e[3]);
+}
+
+__attribute__((target("avx"))) void MulMat4fAVX(const Mat4f *a, const Mat4f *b, Mat4f *out)
+{
+    __m256 ac[4];
+    LoadMat4fDuplicatedAVX(a, ac);
+    __m256 b01 = _mm256_loadu_ps(b->e[0]);
+    __m256 b23 = _mm256_loadu_ps(b->e[2]);
+    __m256 r01 = MulColumnPairAVX(ac, b01);
+    __m256 r23 = MulColumnPairAVX(ac, b23);
+    _mm256_storeu_ps(out->e[0], r01);
+    _mm256_storeu_ps(out->e[2], r23);
+}
+
+__attribute__((target("avx"))) void TransformVec4sAVX(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4],
+                                                      u32 count)
+{
+    __m256 mc[4];
+    LoadMat4fDuplicatedAVX(m, mc);
+    u32 i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm256_storeu_ps(out[i], MulColumnPairAVX(mc, _mm256_loadu_ps(in[i])));
+    }
+    if (i < count)
+    {
+        TransformVec4sSSE(m, in + i, out + i, count - i);
+    }
+}
+
+__attribute__((target("avx"))) void CalcMVPBatchAVX(const Mat4f *proj, const Mat4f *view, const Mat4f *models,
+                                                    u32 count, Mat4f *out)
+{
+    Mat4f viewProj;
+    MulMat4fSSE(proj, view, &viewProj);
+    __m256 vp[4];
+    LoadMat4fDuplicatedAVX(&viewProj, vp);
+    for (u32 i = 0; i < count; i++)
+    {
+        __m256 m01 = _mm256_loadu_ps(models[i].e[0]);
+        __m256 m23 = _mm256_loadu_ps(models[i].e[2]);
+        __m256 r01 = MulColumnPairAVX(vp, m01);
+        __m256 r23 = MulColumnPairAVX(vp, m23);
+        _mm256_storeu_ps(out[i].e[0], r01);
+        _mm256_storeu_ps(out[i].e[2], r23);
+    }
+}
+
+#else
+
+void MulMat4fSSE(const Mat4f *a, const Mat4f *b, Mat4f *out)
+{
+    MulMat4fScalar(a, b, out);
+}
+
+void MulMat4fAVX(const Mat4f *a, const Mat4f *b, Mat4f *out)
+{
+    MulMat4fScalar(a, b, out);
+}
+
+bool InvertMat4fSSE(const Mat4f *m, Mat4f *out)
+{
+    return InvertMat4fScalar(m, out);
+}
+
+void TransformVec4sSSE(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count)
+{
+    TransformVec4sScalar(m, in, out, count);
+}
+
+void TransformVec4sAVX(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count)
+{
+    TransformVec4sScalar(m, in, out, count);
+}
+
+void CalcMVPBatchSSE(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out)
+{
+    CalcMVPBatchScalar(proj, view, models, count, out);
+}
+
+void CalcMVPBatchAVX(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out)
+{
+    CalcMVPBatchScalar(proj, view, models, count, out);
+}
+
+#endif
+
+void TransformVec4s(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count)
+{
+    if (CPUHasAVX())
+    {
+        TransformVec4sAVX(m, in, out, count);
+    }
+    else
+    {
+        TransformVec4sSSE(m, in, out, count);
+    }
+}
+
+void CalcMVPBatch(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out)
+{
+    if (CPUHasAVX())
+    {
+        CalcMVPBatchAVX(proj, view, models, count, out);
+    }
+    else
+    {
+        CalcMVPBatchSSE(proj, view, models, count, out);
+    }
+}
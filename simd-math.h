@@ -0,0 +1,39 @@
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H
+
+#include "rutils/def.h"
+#include "rutils/math.h"
+
+/* SIMD versions of the Mat4f work done every frame, next to plain scalar ones
+   they're checked against. Matrices are column major like everywhere else,
+   so a * b applies b first. None of these need aligned input. The SSE
+   versions are what to call for a single matrix, they fall back to scalar
+   off x86 */
+
+/* out = a * b. out may be a or b */
+void MulMat4fScalar(const Mat4f *a, const Mat4f *b, Mat4f *out);
+void MulMat4fSSE(const Mat4f *a, const Mat4f *b, Mat4f *out);
+/* Two columns at a time. Only call when the CPU has AVX */
+void MulMat4fAVX(const Mat4f *a, const Mat4f *b, Mat4f *out);
+
+/* General inverse. Returns false and leaves out alone when m is singular.
+   Nothing in the frame loop needs one yet */
+bool InvertMat4fScalar(const Mat4f *m, Mat4f *out);
+bool InvertMat4fSSE(const Mat4f *m, Mat4f *out);
+
+/* out[i] = m * in[i] over count 4 component vectors. out may be in */
+void TransformVec4sScalar(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count);
+void TransformVec4sSSE(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count);
+void TransformVec4sAVX(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count);
+
+/* out[i] = proj * view * models[i], with proj * view done once up front.
+   out may be models */
+void CalcMVPBatchScalar(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out);
+void CalcMVPBatchSSE(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out);
+void CalcMVPBatchAVX(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out);
+
+/* The widest of the above the CPU supports */
+void TransformVec4s(const Mat4f *m, const f32 (*in)[4], f32 (*out)[4], u32 count);
+void CalcMVPBatch(const Mat4f *proj, const Mat4f *view, const Mat4f *models, u32 count, Mat4f *out);
+
+#endif
@@ -0,0 +1,228 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "stb-output.h"
+#include "stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Checks that decoding through SetStbiOutputBuffer gives the same pixels as
+   plain stbi_load, and never writes past the byte it's allowed:
+     stb-output-test [image ...]
+   Built in PNGs cover the shapes whose intermediate allocations land on the
+   output size or one past it, like the zlib buffer of a 1 pixel high RGBA
+   image. Images given on the command line are checked the same way, JPEGs
+   are the ones that use the spare byte */
+
+/* Bytes past the spare one that have to come back untouched */
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xcd
+
+typedef struct PNGCase
+{
+    const char *name;
+    u32 x;
+    u32 y;
+    /* PNG color type: 0 gray, 2 RGB, 3 palette, 4 gray alpha, 6 RGBA */
+    u8 colorType;
+    u8 bitDepth;
+} PNGCase;
+
+local const PNGCase pngCases[] = {
+    {"RGBA 1x1", 1, 1, 6, 8},
+    {"RGBA 1 high", 7, 1, 6, 8},
+    {"RGBA 1 high wide", 1000, 1, 6, 8},
+    {"RGBA 1 wide", 1, 7, 6, 8},
+    {"RGBA", 64, 64, 6, 8},
+    {"RGBA 16 bit 1 high", 3, 1, 6, 16},
+    {"RGB 1 high", 13, 1, 2, 8},
+    {"RGB", 33, 17, 2, 8},
+    {"gray 1 high", 5, 1, 0, 8},
+    {"gray alpha 1 high", 5, 1, 4, 8},
+    {"palette 1 high", 4, 1, 3, 8},
+};
+
+typedef struct ByteWriter
+{
+    u8 *data;
+    usize size;
+    usize capacity;
+} ByteWriter;
+
+local void WriteBytes(ByteWriter *w, const void *bytes, usize count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (w->size + count > w->capacity)
+    {
+        w->capacity = (w->size + count) * 2;
+        w->data = realloc(w->data, w->capacity);
+    }
+    memcpy(w->data + w->size, bytes, count);
+    w->size += count;
+}
+
+local void WriteU32BE(ByteWriter *w, u32 v)
+{
+    u8 b[4] = {v >> 24, v >> 16, v >> 8, v};
+    WriteBytes(w, b, 4);
+}
+
+local u32 CRC32(const u8 *data, usize size)
+{
+    u32 crc = 0xffffffff;
+    for (usize i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (u32 bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+local void WriteChunk(ByteWriter *w, const char *type, const u8 *data, usize size)
+{
+    WriteU32BE(w, (u32)size);
+    usize start = w->size;
+    WriteBytes(w, type, 4);
+    WriteBytes(w, data, size);
+    WriteU32BE(w, CRC32(w->data + start, size + 4));
+}
+
+/* Random pixels behind a different filter on each row, stored in
+   uncompressed deflate blocks */
+local ByteWriter EncodePNG(const PNGCase *c)
+{
+    local const u32 channels[] = {[0] = 1, [2] = 3, [3] = 1, [4] = 2, [6] = 4};
+    usize rowBytes = (usize)c->x * channels[c->colorType] * c->bitDepth / 8 + 1;
+    usize rawSize = rowBytes * c->y;
+    u8 *raw = malloc(rawSize);
+    for (usize i = 0; i < rawSize; i++)
+    {
+        raw[i] = i % rowBytes == 0 ? (u8)(i / rowBytes % 5) : (u8)rand();
+    }
+
+    ByteWriter zlib = {0};
+    WriteBytes(&zlib, (u8[]){0x78, 0x01}, 2);
+    u32 a = 1, b = 0;
+    for (usize offset = 0; offset < rawSize || offset == 0;)
+    {
+        u16 length = rawSize - offset > 65535 ? 65535 : (u16)(rawSize - offset);
+        bool last = offset + length == rawSize;
+        u8 header[5] = {last, length, length >> 8, ~length, (u16)~length >> 8};
+        WriteBytes(&zlib, header, 5);
+        WriteBytes(&zlib, raw + offset, length);
+        for (usize i = offset; i < offset + length; i++)
+        {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+        if (last)
+        {
+            break;
+        }
+    }
+    WriteU32BE(&zlib, b << 16 | a);
+
+    ByteWriter png = {0};
+    WriteBytes(&png, (u8[]){0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'}, 8);
+    u8 ihdr[13] = {c->x >> 24, c->x >> 16, c->x >> 8, c->x, c->y >> 24, c->y >> 16, c->y >> 8, c->y,
+                   c->bitDepth, c->colorType, 0, 0, 0};
+    WriteChunk(&png, "IHDR", ihdr, sizeof(ihdr));
+    if (c->colorType == 3)
+    {
+        u8 palette[256 * 3];
+        for (u32 i = 0; i < sizeof(palette); i++)
+        {
+            palette[i] = rand();
+        }
+        WriteChunk(&png, "PLTE", palette, sizeof(palette));
+    }
+    WriteChunk(&png, "IDAT", zlib.data, zlib.size);
+    WriteChunk(&png, "IEND", NULL, 0);
+    free(zlib.data);
+    free(raw);
+    return png;
+}
+
+/* Decodes data both ways, returns whether they agree */
+local bool CheckImage(const char *name, const u8 *data, usize size)
+{
+    int x, y, channels;
+    u8 *reference = stbi_load_from_memory(data, (int)size, &x, &y, &channels, STBI_rgb_alpha);
+    if (!reference)
+    {
+        printf("%-24s could not decode: %s\n", name, stbi_failure_reason());
+        return false;
+    }
+    usize outputSize = (usize)x * y * 4;
+    u8 *buffer = malloc(outputSize + 1 + GUARD_SIZE);
+    memset(buffer, GUARD_BYTE, outputSize + 1 + GUARD_SIZE);
+
+    SetStbiOutputBuffer(buffer, outputSize);
+    int outX, outY, outChannels;
+    u8 *pixels = stbi_load_from_memory(data, (int)size, &outX, &outY, &outChannels, STBI_rgb_alpha);
+    SetStbiOutputBuffer(NULL, 0);
+
+    bool matches = pixels && outX == x && outY == y && memcmp(pixels, reference, outputSize) == 0;
+    bool guardIntact = true;
+    for (usize i = outputSize + 1; i < outputSize + 1 + GUARD_SIZE; i++)
+    {
+        guardIntact = guardIntact && buffer[i] == GUARD_BYTE;
+    }
+    printf("%-24s %5dx%-5d %-8s %s\n", name, x, y, pixels == buffer ? "in place" : "copied",
+           !matches ? "MISMATCH" : !guardIntact ? "OVERRUN" : "ok");
+
+    if (pixels != buffer)
+    {
+        stbi_image_free(pixels);
+    }
+    stbi_image_free(reference);
+    free(buffer);
+    return matches && guardIntact;
+}
+
+int main(int argc, char **argv)
+{
+    int returnValue = 0;
+    /* Fixed seed so failures reproduce */
+    srand(1);
+    for (u32 i = 0; i < countof(pngCases); i++)
+    {
+        ByteWriter png = EncodePNG(&pngCases[i]);
+        if (!CheckImage(pngCases[i].name, png.data, png.size))
+        {
+            returnValue = 1;
+        }
+        free(png.data);
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f)
+        {
+            printf("Could not open %s\n", argv[i]);
+            returnValue = 1;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        u8 *data = malloc(size > 0 ? size : 1);
+        bool read = size > 0 && fread(data, 1, size, f) == (usize)size;
+        fclose(f);
+        if (!read || !CheckImage(argv[i], data, size))
+        {
+            returnValue = 1;
+        }
+        free(data);
+    }
+    return returnValue;
+}
@@ -0,0 +1,25 @@
+#ifndef STB_OUTPUT_H
+#define STB_OUTPUT_H
+
+#include "rutils/def.h"
+
+/* Until cleared with NULL, stbi_load calls on this thread hand out buffer as
+   the allocation for a decoded image of size bytes, so it's decoded in place
+   with no allocation or copy of its own. Whether that happened shows in the
+   pointer stbi_load returns: anything other than buffer is an ordinary
+   allocation that still needs copying and stbi_image_free.
+
+   The JPEG decoder asks for one byte more than the image and never writes
+   it, which buffer needs room for.
+
+   Decoders may read back what they've written, PNG's filters do, so buffer
+   should only be staging memory for formats known not to.
+
+   Buffer is matched by allocation size alone, which depends on how the
+   vendored stb_image 2.19 allocates, none of it documented. Other
+   allocations can match too, like PNG's zlib buffer for a 1 pixel high RGBA
+   image, which only costs the in place decode. Run stb-output-test after
+   updating stb_image.h */
+void SetStbiOutputBuffer(void *buffer, usize size);
+
+#endif
@@ -1,2 +1,99 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "stb-output.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+local void *StbiMalloc(usize size);
+local void *StbiRealloc(void *p, usize size);
+local void StbiFree(void *p);
+
+#define STBI_MALLOC(size) StbiMalloc(size)
+#define STBI_REALLOC(p, size) StbiRealloc(p, size)
+#define STBI_FREE(p) StbiFree(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+
+typedef struct OutputBuffer
+{
+    u8 *buffer;
+    usize size;
+    /* Handed out and not freed yet, for an allocation of takenSize */
+    bool taken;
+    usize takenSize;
+} OutputBuffer;
+
+local pthread_key_t outputKey;
+local pthread_once_t outputKeyOnce = PTHREAD_ONCE_INIT;
+
+local void CreateOutputKey(void)
+{
+    pthread_key_create(&outputKey, free);
+}
+
+local OutputBuffer *CurrentOutput(void)
+{
+    pthread_once(&outputKeyOnce, CreateOutputKey);
+    return pthread_getspecific(outputKey);
+}
+
+void SetStbiOutputBuffer(void *buffer, usize size)
+{
+    OutputBuffer *out = CurrentOutput();
+    if (!out)
+    {
+        out = malloc(sizeof(*out));
+        if (!out)
+        {
+            return;
+        }
+        pthread_setspecific(outputKey, out);
+    }
+    *out = (OutputBuffer){buffer, buffer ? size : 0, false, 0};
+}
+
+/* The output is allocated once at its final size, so matching on the size
+   finds it. Anything else that happens to match is harmless: it's decoded
+   in buffer, freed, and buffer goes back to waiting for the output */
+local void *StbiMalloc(usize size)
+{
+    OutputBuffer *out = CurrentOutput();
+    if (out && out->buffer && !out->taken && (size == out->size || size == out->size + 1))
+    {
+        out->taken = true;
+        out->takenSize = size;
+        return out->buffer;
+    }
+    return malloc(size);
+}
+
+/* Only PNG's compressed data and GIF frames are reallocated, never the
+   output, but keep buffer's contents if it does happen */
+local void *StbiRealloc(void *p, usize size)
+{
+    OutputBuffer *out = CurrentOutput();
+    if (out && p && p == out->buffer)
+    {
+        void *moved = malloc(size);
+        if (moved)
+        {
+            memcpy(moved, p, size < out->takenSize ? size : out->takenSize);
+            out->taken = false;
+        }
+        return moved;
+    }
+    return realloc(p, size);
+}
+
+local void StbiFree(void *p)
+{
+    OutputBuffer *out = CurrentOutput();
+    if (out && p && p == out->buffer)
+    {
+        out->taken = false;
+        return;
+    }
+    free(p);
+}
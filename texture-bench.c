@@ -0,0 +1,256 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "frame-stats.h"
+#include "texture-decode.h"
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Texture loading startup time against thread count. Every jpg and png in a
+   directory goes through the same header and decode passes the app uses,
+   into one buffer allocated up front:
+     texture-bench directory [max threads] [--mips] [--cache cache directory]
+   With a cache it's also timed cold, with the cache emptied before every
+   run so each one decodes and writes it, and warm, loading only from it.
+   Aim for 100 or more images so every thread count has plenty to share */
+
+#define REPEATS 5
+
+local bool IsImagePath(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0 || strcmp(dot, ".png") == 0);
+}
+
+local int ComparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Sorted so every run decodes in the same order */
+local char **ListImages(const char *dir, u32 *outCount)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        return NULL;
+    }
+    u32 count = 0, capacity = 0;
+    char **paths = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+    {
+        if (!IsImagePath(entry->d_name))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 128;
+            paths = realloc(paths, sizeof(paths[0]) * capacity);
+        }
+        usize length = strlen(dir) + strlen(entry->d_name) + 2;
+        paths[count] = malloc(length);
+        snprintf(paths[count], length, "%s/%s", dir, entry->d_name);
+        count++;
+    }
+    closedir(d);
+    qsort(paths, count, sizeof(paths[0]), ComparePaths);
+    *outCount = count;
+    return paths;
+}
+
+/* What the app does at startup minus the GPU: size everything, then decode
+   into the buffer that would be staging */
+local double BenchLoad(JobSystem *js, DecodedImage *images, u32 count, bool mips, const char *cacheDir, u8 *dest,
+                       usize destSize, u32 *outDecoded)
+{
+    double start = GetTimeSeconds();
+    usize size = ReadImageHeaders(js, images, count, mips, cacheDir);
+    /* Treated as staging like the app does, unless there are mips to filter */
+    *outDecoded = size <= destSize ? DecodeImages(js, images, count, dest, !mips) : 0;
+    return (GetTimeSeconds() - start) * 1000;
+}
+
+local void EmptyCache(DecodedImage *images, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        if (images[i].cache.path[0])
+        {
+            remove(images[i].cache.path);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 maxThreads = cpus > 0 ? (u32)cpus : 1;
+    bool mips = false;
+    const char *cacheDir = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mips") == 0)
+        {
+            mips = true;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            cacheDir = argv[++i];
+        }
+        else if (!dir)
+        {
+            dir = argv[i];
+        }
+        else
+        {
+            maxThreads = strtoul(argv[i], NULL, 10);
+        }
+    }
+    if (!dir)
+    {
+        puts("usage: texture-bench directory [max threads] [--mips] [--cache cache directory]");
+        return 1;
+    }
+    if (maxThreads == 0)
+    {
+        maxThreads = 1;
+    }
+
+    u32 count;
+    char **paths = ListImages(dir, &count);
+    if (!paths || count == 0)
+    {
+        printf("No jpg or png files in %s\n", dir);
+        return 1;
+    }
+    DecodedImage *images = calloc(count, sizeof(images[0]));
+    FrameStats stats, coldStats, warmStats;
+    if (!images || !CreateFrameStats(REPEATS, 1, &stats) || !CreateFrameStats(REPEATS, 1, &coldStats) ||
+        !CreateFrameStats(REPEATS, 1, &warmStats))
+    {
+        puts("Out of memory");
+        return 1;
+    }
+    if (cacheDir && !CreateTextureCacheDir(cacheDir))
+    {
+        printf("Could not create %s\n", cacheDir);
+        return 1;
+    }
+    for (u32 i = 0; i < count; i++)
+    {
+        images[i].path = paths[i];
+    }
+
+    JobSystem js;
+    if (!CreateJobSystem(1, &js))
+    {
+        puts("Could not start the job system");
+        return 1;
+    }
+    usize destSize = ReadImageHeaders(&js, images, count, mips, NULL);
+    DestroyJobSystem(&js);
+    u8 *dest = malloc(destSize);
+    if (!dest)
+    {
+        puts("Out of memory");
+        return 1;
+    }
+    u64 pixels = 0;
+    u32 readable = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        pixels += (u64)images[i].x * images[i].y;
+        readable += images[i].ok;
+    }
+
+    printf("%" PRIu32 " of %" PRIu32 " images readable, %.1f MPixels, %zu MiB decoded%s. median of %d runs\n",
+           readable, count, pixels / 1e6, destSize >> 20, mips ? " with mips" : "", REPEATS);
+    printf("threads    startup ms  MPixels/s  speedup  efficiency%s\n", cacheDir ? "  cold cache ms  warm cache ms" : "");
+    double singleThreadMs = 0;
+    u64 singleThreadChecksum = 0;
+    for (u32 threads = 1; threads <= maxThreads; threads++)
+    {
+        if (!CreateJobSystem(threads, &js))
+        {
+            printf("Could not start %" PRIu32 " threads\n", threads);
+            return 1;
+        }
+        ResetFrameStats(&stats);
+        u32 decoded = 0;
+        /* One extra run for the warmup, which also pulls the files into the
+           page cache so every thread count reads from memory */
+        for (u32 i = 0; i <= REPEATS; i++)
+        {
+            FrameStatsRecord(&stats, BenchLoad(&js, images, count, mips, NULL, dest, destSize, &decoded));
+        }
+
+        /* Decoding is deterministic, any thread count and the cache have to
+           give the same bytes */
+        u64 checksum = HashFNV1a(FNV1A_BASIS, dest, destSize);
+        bool cacheMatches = true;
+        if (cacheDir)
+        {
+            ResetFrameStats(&coldStats);
+            ResetFrameStats(&warmStats);
+            u32 coldDecoded = 0, warmDecoded = 0;
+            for (u32 i = 0; i <= REPEATS; i++)
+            {
+                EmptyCache(images, count);
+                FrameStatsRecord(&coldStats,
+                                 BenchLoad(&js, images, count, mips, cacheDir, dest, destSize, &coldDecoded));
+            }
+            cacheMatches = coldDecoded == decoded && HashFNV1a(FNV1A_BASIS, dest, destSize) == checksum;
+            for (u32 i = 0; i <= REPEATS; i++)
+            {
+                FrameStatsRecord(&warmStats,
+                                 BenchLoad(&js, images, count, mips, cacheDir, dest, destSize, &warmDecoded));
+            }
+            u32 hits = 0;
+            for (u32 i = 0; i < count; i++)
+            {
+                hits += images[i].cache.hit;
+            }
+            cacheMatches = cacheMatches && warmDecoded == decoded && hits == readable &&
+                           HashFNV1a(FNV1A_BASIS, dest, destSize) == checksum;
+        }
+        DestroyJobSystem(&js);
+        double ms = SummarizeFrameStats(&stats).p50;
+        if (threads == 1)
+        {
+            singleThreadMs = ms;
+            singleThreadChecksum = checksum;
+        }
+        if (decoded != readable || checksum != singleThreadChecksum || !cacheMatches)
+        {
+            printf("MISMATCH with %" PRIu32 " threads: %" PRIu32 " of %" PRIu32 " decoded%s\n", threads, decoded,
+                   readable, cacheMatches ? "" : ", cache differs");
+            return 1;
+        }
+        double speedup = singleThreadMs / ms;
+        printf("%7" PRIu32 " %13.1f %10.1f %7.2fx %10.0f%%", threads, ms, pixels / 1e3 / ms, speedup,
+               speedup / threads * 100);
+        if (cacheDir)
+        {
+            printf(" %14.1f %14.1f", SummarizeFrameStats(&coldStats).p50, SummarizeFrameStats(&warmStats).p50);
+        }
+        putchar('\n');
+    }
+
+    DestroyFrameStats(&stats);
+    DestroyFrameStats(&coldStats);
+    DestroyFrameStats(&warmStats);
+    free(dest);
+    free(images);
+    for (u32 i = 0; i < count; i++)
+    {
+        free(paths[i]);
+    }
+    free(paths);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "texture-cache.h"
+#include "mipmap.h"
+#include "rutils/file.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+bool CreateTextureCacheDir(const char *dir)
+{
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+/* Maps the entry and parses it, NULL if that fails */
+local void *MapTextureCacheEntry(const char *path, isize *outSize, TextureFile *outFile)
+{
+    void *data = MapFileToROBuffer(path, NULL, outSize);
+    if (data && !ParseTextureFile(data, *outSize, outFile))
+    {
+        UnmapMappedBuffer(data, *outSize);
+        return NULL;
+    }
+    return data;
+}
+
+/* Writes source over the stamp in the entry's header and leaves the rest of
+   the file alone */
+local bool RestampTextureCacheEntry(const char *path, const TextureSource *source)
+{
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fseek(f, offsetof(TextureFileHeader, source), SEEK_SET) == 0 &&
+              fwrite(source, sizeof(*source), 1, f) == 1;
+    return fclose(f) == 0 && ok;
+}
+
+bool OpenTextureCacheEntry(const char *dir, const char *sourcePath, TextureFileFormat format, bool mipChain,
+                           TextureCacheEntry *out)
+{
+    *out = (TextureCacheEntry){0};
+    TextureSource source;
+    int length = snprintf(out->path, sizeof(out->path), "%s/%016llx.tex", dir,
+                          (unsigned long long)HashFNV1a(FNV1A_BASIS, sourcePath, strlen(sourcePath)));
+    if (length < 0 || (usize)length >= sizeof(out->path) || !ReadTextureSource(sourcePath, false, &source))
+    {
+        out->path[0] = 0;
+        return false;
+    }
+
+    isize size;
+    TextureFile file;
+    void *data = MapTextureCacheEntry(out->path, &size, &file);
+    if (data)
+    {
+        out->header = file.header;
+        UnmapMappedBuffer(data, size);
+    }
+    u32 mipLevels = mipChain ? MipLevelCount(out->header.x, out->header.y) : 1;
+    bool usable = data && out->header.format == format && out->header.mipLevels == mipLevels &&
+                  out->header.source.size == source.size;
+    /* Only the stamp is compared when it can be, hashing means reading the
+       whole source */
+    if (usable && out->header.source.mtime == source.mtime)
+    {
+        out->source = out->header.source;
+        out->hit = true;
+        return true;
+    }
+
+    if (!ReadTextureSource(sourcePath, true, &out->source))
+    {
+        out->path[0] = 0;
+        return false;
+    }
+    out->hit = usable && out->header.source.hash == out->source.hash;
+    /* Touched but unchanged. With the new mtime stamped, later runs are back
+       to only comparing stamps. Should that fail the entry still hits, it is
+       just hashed again next time */
+    if (out->hit && RestampTextureCacheEntry(out->path, &out->source))
+    {
+        out->header.source = out->source;
+    }
+    return out->hit;
+}
+
+bool ReadTextureCacheEntry(const TextureCacheEntry *entry, u8 *dest)
+{
+    isize size;
+    TextureFile file;
+    void *data = MapTextureCacheEntry(entry->path, &size, &file);
+    if (!data)
+    {
+        return false;
+    }
+    bool ok = memcmp(&file.header, &entry->header, sizeof(file.header)) == 0;
+    for (u32 i = 0; i < file.header.mipLevels && ok; i++)
+    {
+        memcpy(dest, TextureFileLevelData(&file, i), file.levels[i].size);
+        dest += file.levels[i].size;
+    }
+    UnmapMappedBuffer(data, size);
+    return ok;
+}
+
+bool WriteTextureCacheEntry(const TextureCacheEntry *entry, TextureFileFormat format, u32 x, u32 y,
+                            u32 mipLevels, const u8 *levels)
+{
+    if (!entry->path[0] || mipLevels > TEXTURE_FILE_MAX_MIP_LEVELS)
+    {
+        return false;
+    }
+    const u8 *levelData[TEXTURE_FILE_MAX_MIP_LEVELS];
+    for (u32 i = 0; i < mipLevels; i++)
+    {
+        levelData[i] = levels;
+        levels += TextureLevelSize(format, MipExtent(x, i), MipExtent(y, i));
+    }
+
+    char temporary[TEXTURE_CACHE_PATH_MAX + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", entry->path);
+    if (!WriteTextureFile(temporary, format, x, y, mipLevels, levelData, &entry->source))
+    {
+        remove(temporary);
+        return false;
+    }
+    return rename(temporary, entry->path) == 0;
+}
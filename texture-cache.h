@@ -0,0 +1,46 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "texture-file.h"
+
+/* Decoded images kept on disk as texture files, so later runs map them
+   instead of decoding again. Each source image gets one entry in the cache
+   directory, named after a hash of its path and stamped with its
+   TextureSource. An entry is up to date when the source's size and mtime
+   still match the stamp or, failing that, its contents hash the same, which
+   keeps entries valid across a touch or a fresh checkout. The stamp is then
+   updated so the hash is only paid once */
+
+#define TEXTURE_CACHE_PATH_MAX 512
+
+typedef struct TextureCacheEntry
+{
+    char path[TEXTURE_CACHE_PATH_MAX];
+    /* Always hashed on a miss, since the new entry needs it */
+    TextureSource source;
+    bool hit;
+    /* The entry's header when it hit */
+    TextureFileHeader header;
+} TextureCacheEntry;
+
+/* Creates dir if it isn't there yet */
+bool CreateTextureCacheDir(const char *dir);
+
+/* Looks up the entry for sourcePath in dir and checks it is up to date and
+   holds format with either a full mip chain or only level 0. Returns whether
+   it hit. When the source can't be read or the entry's path doesn't fit,
+   out->path is left empty and the image can't be cached at all */
+bool OpenTextureCacheEntry(const char *dir, const char *sourcePath, TextureFileFormat format, bool mipChain,
+                           TextureCacheEntry *out);
+
+/* Copies every level of an entry that hit into dest, packed back to back.
+   Fails when the entry changed since it was opened */
+bool ReadTextureCacheEntry(const TextureCacheEntry *entry, u8 *dest);
+
+/* Replaces the entry with mipLevels levels packed back to back in levels.
+   The file is written under a temporary name and renamed into place, so
+   readers never see half of one */
+bool WriteTextureCacheEntry(const TextureCacheEntry *entry, TextureFileFormat format, u32 x, u32 y,
+                            u32 mipLevels, const u8 *levels);
+
+#endif
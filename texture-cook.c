@@ -0,0 +1,128 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200112L)
+
+#include "bc-encode.h"
+#include "frame-stats.h"
+#include "mipmap.h"
+#include "stb_image.h"
+#include "texture-file.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Cooks an image stb_image can read into a texture file with a full mip
+   chain:
+     texture-cook [-f rgba8|bc1|bc3|bc7] [--no-mips] input output
+   Without -f opaque images become BC1 and ones with alpha BC7 */
+
+local bool streq(const char *a, const char *b)
+{
+    return strcmp(a, b) == 0;
+}
+
+local void PrintUsage(void)
+{
+    puts("usage: texture-cook [-f rgba8|bc1|bc3|bc7] [--no-mips] input output");
+}
+
+int main(int argc, char **argv)
+{
+    i32 format = -1;
+    bool mips = true;
+    const char *paths[2];
+    u32 pathCount = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (streq(argv[i], "-f") && i + 1 < argc)
+        {
+            i++;
+            for (u32 j = 0; j < TEXTURE_FILE_FORMAT_COUNT; j++)
+            {
+                if (streq(argv[i], TextureFileFormatName(j)))
+                {
+                    format = j;
+                }
+            }
+            if (format < 0)
+            {
+                printf("Unknown format %s\n", argv[i]);
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (streq(argv[i], "--no-mips"))
+        {
+            mips = false;
+        }
+        else if (pathCount < countof(paths))
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (pathCount != countof(paths))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    double start = GetTimeSeconds();
+    int x, y, channels;
+    u8 *image = stbi_load(paths[0], &x, &y, &channels, STBI_rgb_alpha);
+    if (!image)
+    {
+        printf("Couldn't load %s: %s\n", paths[0], stbi_failure_reason());
+        return 1;
+    }
+    if (format < 0)
+    {
+        format = channels == 4 || channels == 2 ? TEXTURE_FILE_BC7 : TEXTURE_FILE_BC1;
+    }
+
+    u32 levels = mips ? MipLevelCount(x, y) : 1;
+    u64 rawBytes = MipLevelOffset(x, y, 4, levels);
+    u64 cookedBytes = 0;
+    for (u32 i = 0; i < levels; i++)
+    {
+        cookedBytes += TextureLevelSize(format, MipExtent(x, i), MipExtent(y, i));
+    }
+    u8 *chain = malloc(rawBytes);
+    u8 *encoded = malloc(cookedBytes);
+    const u8 *levelData[TEXTURE_FILE_MAX_MIP_LEVELS];
+    if (!chain || !encoded)
+    {
+        puts("Out of memory");
+        return 1;
+    }
+    memcpy(chain, image, (usize)x * y * 4);
+    stbi_image_free(image);
+    GenerateMipChainRGBA8(chain, x, y, levels);
+
+    u8 *out = encoded;
+    for (u32 i = 0; i < levels; i++)
+    {
+        EncodeBCImage(format, chain + MipLevelOffset(x, y, 4, i), MipExtent(x, i), MipExtent(y, i), out);
+        levelData[i] = out;
+        out += TextureLevelSize(format, MipExtent(x, i), MipExtent(y, i));
+    }
+
+    TextureSource source;
+    if (!ReadTextureSource(paths[0], true, &source) ||
+        !WriteTextureFile(paths[1], format, x, y, levels, levelData, &source))
+    {
+        printf("Couldn't write %s\n", paths[1]);
+        return 1;
+    }
+
+    printf("%s: %dx%d %s, %" PRIu32 " levels, %" PRIu64 " KiB (%.1fx smaller than rgba8) in %.1f ms\n",
+           paths[1], x, y, TextureFileFormatName(format), levels, cookedBytes / 1024,
+           (double)rawBytes / cookedBytes, (GetTimeSeconds() - start) * 1000);
+
+    free(encoded);
+    free(chain);
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "texture-decode.h"
+#include "mipmap.h"
+#include "stb-output.h"
+#include "stb_image.h"
+#include <stdio.h>
+#include <string.h>
+
+/* stb_image keeps no state between calls apart from its failure reason,
+   which stb_image.h keeps per thread */
+
+typedef struct HeaderContext
+{
+    DecodedImage *images;
+    bool mipChains;
+    const char *cacheDir;
+} HeaderContext;
+
+typedef struct DecodeContext
+{
+    DecodedImage *images;
+    u8 *dest;
+    bool destIsStaging;
+    u32 decoded;
+} DecodeContext;
+
+local void ReadHeaderSlice(u32 first, u32 count, void *user)
+{
+    HeaderContext *ctx = user;
+    for (u32 i = first; i < first + count; i++)
+    {
+        DecodedImage *image = &ctx->images[i];
+        *image = (DecodedImage){.path = image->path};
+        if (ctx->cacheDir &&
+            OpenTextureCacheEntry(ctx->cacheDir, image->path, TEXTURE_FILE_RGBA8, ctx->mipChains, &image->cache))
+        {
+            image->x = image->cache.header.x;
+            image->y = image->cache.header.y;
+            image->channels = 4;
+            image->ok = true;
+            continue;
+        }
+        FILE *f = fopen(image->path, "rb");
+        if (!f)
+        {
+            continue;
+        }
+        /* Every JPEG starts with a start of image marker */
+        u8 magic[2] = {0};
+        image->writeOnlyDecode = fread(magic, 1, 2, f) == 2 && magic[0] == 0xFF && magic[1] == 0xD8;
+        fseek(f, 0, SEEK_SET);
+        int x, y, channels;
+        image->ok = stbi_info_from_file(f, &x, &y, &channels) && x > 0 && y > 0;
+        fclose(f);
+        image->x = image->ok ? x : 0;
+        image->y = image->ok ? y : 0;
+        image->channels = image->ok ? channels : 0;
+    }
+}
+
+usize ReadImageHeaders(JobSystem *js, DecodedImage *images, u32 count, bool mipChains, const char *cacheDir)
+{
+    /* Only a few KiB of each file is read, so these are cheap slices. Cache
+       misses hash their source too, which is still far less than decoding */
+    HeaderContext ctx = {images, mipChains, cacheDir};
+    JobSystemParallelFor(js, count, 0, ReadHeaderSlice, &ctx);
+
+    usize offset = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        DecodedImage *image = &images[i];
+        image->mipLevels = image->ok ? (mipChains ? MipLevelCount(image->x, image->y) : 1) : 0;
+        image->offset = offset;
+        image->size = image->ok ? MipLevelOffset(image->x, image->y, 4, image->mipLevels) : 0;
+        /* Plus the byte SetStbiOutputBuffer wants spare */
+        offset = (offset + image->size + 1 + DECODED_IMAGE_ALIGNMENT - 1) / DECODED_IMAGE_ALIGNMENT *
+                 DECODED_IMAGE_ALIGNMENT;
+    }
+    return offset;
+}
+
+local void DecodeSlice(u32 first, u32 count, void *user)
+{
+    DecodeContext *ctx = user;
+    for (u32 i = first; i < first + count; i++)
+    {
+        DecodedImage *image = &ctx->images[i];
+        if (!image->ok)
+        {
+            continue;
+        }
+        u8 *out = ctx->dest + image->offset;
+        if (image->cache.hit)
+        {
+            image->ok = ReadTextureCacheEntry(&image->cache, out);
+            if (image->ok)
+            {
+                __atomic_fetch_add(&ctx->decoded, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+
+        usize size = (usize)image->x * image->y * 4;
+        /* The cache entry is written from the decoded pixels, so they have to
+           be somewhere that reads back quickly */
+        bool cacheMiss = image->cache.path[0] != 0;
+        bool inPlace = !ctx->destIsStaging || (image->writeOnlyDecode && !cacheMiss);
+        SetStbiOutputBuffer(inPlace ? out : NULL, size);
+        int x, y, channels;
+        u8 *pixels = stbi_load(image->path, &x, &y, &channels, STBI_rgb_alpha);
+        SetStbiOutputBuffer(NULL, 0);
+        /* The file could have changed since its header was read */
+        if (!pixels || (u32)x != image->x || (u32)y != image->y)
+        {
+            if (pixels != out)
+            {
+                stbi_image_free(pixels);
+            }
+            image->ok = false;
+            continue;
+        }
+        if (pixels != out)
+        {
+            memcpy(out, pixels, size);
+        }
+        GenerateMipChainRGBA8(out, image->x, image->y, image->mipLevels);
+        if (cacheMiss)
+        {
+            /* A failed write only means decoding again next time */
+            const u8 *levels = ctx->destIsStaging && image->mipLevels == 1 ? pixels : out;
+            WriteTextureCacheEntry(&image->cache, TEXTURE_FILE_RGBA8, image->x, image->y, image->mipLevels, levels);
+        }
+        if (pixels != out)
+        {
+            stbi_image_free(pixels);
+        }
+        __atomic_fetch_add(&ctx->decoded, 1, __ATOMIC_RELAXED);
+    }
+}
+
+u32 DecodeImages(JobSystem *js, DecodedImage *images, u32 count, u8 *dest, bool destIsStaging)
+{
+    DecodeContext ctx = {images, dest, destIsStaging, 0};
+    /* One image per slice, they're big and vary a lot in size */
+    JobSystemParallelFor(js, count, 1, DecodeSlice, &ctx);
+    return ctx.decoded;
+}
@@ -0,0 +1,56 @@
+#ifndef TEXTURE_DECODE_H
+#define TEXTURE_DECODE_H
+
+#include "job-system.h"
+#include "texture-cache.h"
+
+/* Decodes many images at once on a JobSystem, in two passes so the caller
+   can allocate every destination up front, staging memory included:
+   ReadImageHeaders sizes and lays out the images, then DecodeImages writes
+   each one to its offset in a single buffer of the size it returned.
+   Pixels are always RGBA8.
+
+   With a cache directory images that are in the cache are copied out of it
+   instead, and the rest are added to it as they're decoded */
+
+/* Where images start in the destination. Covers the copy offset alignment
+   of every format an image gets uploaded as */
+#define DECODED_IMAGE_ALIGNMENT 16
+
+typedef struct DecodedImage
+{
+    const char *path;
+    u32 x;
+    u32 y;
+    /* Channels in the file, not in the decoded pixels */
+    u32 channels;
+    /* JPEG decoding only ever writes its output, so it can go straight to
+       staging memory */
+    bool writeOnlyDecode;
+    /* Levels written from offset, packed as MipLevelOffset lays them out */
+    u32 mipLevels;
+    usize offset;
+    usize size;
+    bool ok;
+    /* Only used with a cache directory. Images that hit report 4 channels */
+    TextureCacheEntry cache;
+} DecodedImage;
+
+/* Reads the header of every images[i].path in parallel and packs the images
+   back to back, returning the bytes DecodeImages needs. With mipChains each
+   image gets room for its full chain, otherwise only level 0. Images that
+   can't be read are left !ok and take no space. cacheDir may be NULL */
+usize ReadImageHeaders(JobSystem *js, DecodedImage *images, u32 count, bool mipChains, const char *cacheDir);
+
+/* Decodes every ok image into dest + offset in parallel and box filters the
+   rest of its levels when it has any. An image that fails to decode now is
+   marked !ok. Returns how many succeeded.
+
+   Images are decoded in place where possible, see SetStbiOutputBuffer. With
+   destIsStaging only writeOnlyDecode images that aren't going into the cache
+   are, the rest are decoded elsewhere and copied in once. The mip filter
+   reads back what it writes, so dest wants to be ordinary memory when there
+   are mip chains */
+u32 DecodeImages(JobSystem *js, DecodedImage *images, u32 count, u8 *dest, bool destIsStaging);
+
+#endif
@@ -0,0 +1,167 @@
+/* Feature macros */
+#define _POSIX_C_SOURCE (200809L)
+
+#include "texture-file.h"
+#include "mipmap.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define LEVEL_ALIGNMENT 16
+#define HASH_CHUNK_SIZE (64 * 1024)
+
+local const char *formatNames[] = {
+    [TEXTURE_FILE_RGBA8] = "rgba8",
+    [TEXTURE_FILE_BC1] = "bc1",
+    [TEXTURE_FILE_BC3] = "bc3",
+    [TEXTURE_FILE_BC7] = "bc7",
+};
+
+const char *TextureFileFormatName(TextureFileFormat format)
+{
+    return format < TEXTURE_FILE_FORMAT_COUNT ? formatNames[format] : "unknown";
+}
+
+u64 TextureLevelSize(TextureFileFormat format, u32 x, u32 y)
+{
+    u64 blocks = (u64)((x + 3) / 4) * ((y + 3) / 4);
+    switch (format)
+    {
+    case TEXTURE_FILE_RGBA8:
+        return (u64)x * y * 4;
+    case TEXTURE_FILE_BC1:
+        return blocks * 8;
+    case TEXTURE_FILE_BC3:
+    case TEXTURE_FILE_BC7:
+        return blocks * 16;
+    default:
+        return 0;
+    }
+}
+
+local u64 AlignLevelOffset(u64 offset)
+{
+    return (offset + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+}
+
+bool ParseTextureFile(const void *data, usize size, TextureFile *out)
+{
+    *out = (TextureFile){0};
+    if (size < sizeof(TextureFileHeader))
+    {
+        return false;
+    }
+    TextureFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != TEXTURE_FILE_MAGIC || header.version != TEXTURE_FILE_VERSION ||
+        header.format >= TEXTURE_FILE_FORMAT_COUNT || header.x == 0 || header.y == 0 ||
+        header.mipLevels == 0 || header.mipLevels > TEXTURE_FILE_MAX_MIP_LEVELS ||
+        header.mipLevels > MipLevelCount(header.x, header.y))
+    {
+        return false;
+    }
+
+    usize tableEnd = sizeof(TextureFileHeader) + sizeof(TextureFileLevel) * header.mipLevels;
+    if (size < tableEnd)
+    {
+        return false;
+    }
+    const TextureFileLevel *levels = (const TextureFileLevel *)((const u8 *)data + sizeof(TextureFileHeader));
+    for (u32 i = 0; i < header.mipLevels; i++)
+    {
+        u64 expected = TextureLevelSize(header.format, MipExtent(header.x, i), MipExtent(header.y, i));
+        if (levels[i].size != expected || levels[i].offset < tableEnd || levels[i].offset % LEVEL_ALIGNMENT ||
+            levels[i].offset > size || levels[i].size > size - levels[i].offset)
+        {
+            return false;
+        }
+    }
+
+    out->header = header;
+    out->levels = levels;
+    out->base = data;
+    return true;
+}
+
+bool WriteTextureFile(const char *path, TextureFileFormat format, u32 x, u32 y, u32 mipLevels,
+                      const u8 *const *levelData, const TextureSource *source)
+{
+    if (mipLevels == 0 || mipLevels > TEXTURE_FILE_MAX_MIP_LEVELS)
+    {
+        return false;
+    }
+
+    TextureFileHeader header = {TEXTURE_FILE_MAGIC, TEXTURE_FILE_VERSION, format, x, y, mipLevels};
+    if (source)
+    {
+        header.source = *source;
+    }
+    TextureFileLevel levels[TEXTURE_FILE_MAX_MIP_LEVELS];
+    u64 offset = AlignLevelOffset(sizeof(header) + sizeof(levels[0]) * mipLevels);
+    for (u32 i = 0; i < mipLevels; i++)
+    {
+        levels[i].offset = offset;
+        levels[i].size = TextureLevelSize(format, MipExtent(x, i), MipExtent(y, i));
+        offset = AlignLevelOffset(offset + levels[i].size);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(levels, sizeof(levels[0]), mipLevels, f) == mipLevels;
+    u64 written = sizeof(header) + sizeof(levels[0]) * mipLevels;
+    local const u8 padding[LEVEL_ALIGNMENT];
+    for (u32 i = 0; i < mipLevels && ok; i++)
+    {
+        ok = fwrite(padding, 1, levels[i].offset - written, f) == levels[i].offset - written &&
+             fwrite(levelData[i], 1, levels[i].size, f) == levels[i].size;
+        written = levels[i].offset + levels[i].size;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+u64 HashFNV1a(u64 hash, const void *data, usize size)
+{
+    const u8 *bytes = data;
+    for (usize i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+bool ReadTextureSource(const char *path, bool withHash, TextureSource *out)
+{
+    *out = (TextureSource){0};
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return false;
+    }
+    out->size = st.st_size;
+    out->mtime = (i64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (!withHash)
+    {
+        return true;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+    u64 hash = FNV1A_BASIS;
+    u8 chunk[HASH_CHUNK_SIZE];
+    usize read;
+    while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    {
+        hash = HashFNV1a(hash, chunk, read);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    out->hash = hash;
+    return ok;
+}
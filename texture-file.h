@@ -0,0 +1,94 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include "rutils/def.h"
+
+/* GPU ready textures as written by texture-cook and the texture cache: a
+   TextureFileHeader, one TextureFileLevel per mip level, then the levels
+   themselves, largest first. Level offsets are from the start of the file
+   and 16 byte aligned, so each level can be copied straight into staging
+   memory. Everything is little endian */
+
+#define TEXTURE_FILE_MAGIC 0x58455452u /* "RTEX" */
+/* 2 added the source stamp */
+#define TEXTURE_FILE_VERSION 2
+/* Enough for any u32 extent */
+#define TEXTURE_FILE_MAX_MIP_LEVELS 32
+/* Hash of no bytes, where every HashFNV1a chain starts */
+#define FNV1A_BASIS 14695981039346656037ull
+
+typedef enum TextureFileFormat
+{
+    TEXTURE_FILE_RGBA8,
+    TEXTURE_FILE_BC1,
+    TEXTURE_FILE_BC3,
+    TEXTURE_FILE_BC7,
+    TEXTURE_FILE_FORMAT_COUNT,
+} TextureFileFormat;
+
+/* The image a texture file was made from, to tell when it's out of date.
+   hash is FNV-1a over the file's contents and mtime is in nanoseconds */
+typedef struct TextureSource
+{
+    u64 hash;
+    u64 size;
+    i64 mtime;
+} TextureSource;
+
+typedef struct TextureFileHeader
+{
+    u32 magic;
+    u32 version;
+    u32 format;
+    u32 x;
+    u32 y;
+    u32 mipLevels;
+    /* All zero when written without one */
+    TextureSource source;
+} TextureFileHeader;
+
+typedef struct TextureFileLevel
+{
+    u64 offset;
+    u64 size;
+} TextureFileLevel;
+
+/* A file that passed ParseTextureFile. levels and base point into the
+   buffer it was parsed from */
+typedef struct TextureFile
+{
+    TextureFileHeader header;
+    const TextureFileLevel *levels;
+    const u8 *base;
+} TextureFile;
+
+/* Short lowercase name, also what texture-cook takes on the command line */
+const char *TextureFileFormatName(TextureFileFormat format);
+
+/* Bytes in one level of format. Block compressed levels are padded out to
+   whole 4x4 blocks */
+u64 TextureLevelSize(TextureFileFormat format, u32 x, u32 y);
+
+/* Checks the header and that every level lies inside the size bytes at data
+   and has the size its format and extent call for */
+bool ParseTextureFile(const void *data, usize size, TextureFile *out);
+
+local const u8 *TextureFileLevelData(const TextureFile *file, u32 level)
+{
+    return file->base + file->levels[level].offset;
+}
+
+/* levelData[i] holds TextureLevelSize bytes for level i. source may be
+   NULL */
+bool WriteTextureFile(const char *path, TextureFileFormat format, u32 x, u32 y, u32 mipLevels,
+                      const u8 *const *levelData, const TextureSource *source);
+
+/* FNV-1a over size bytes at data, continuing from hash so a stream can be
+   hashed in pieces */
+u64 HashFNV1a(u64 hash, const void *data, usize size);
+
+/* Size and mtime of the file at path, plus its hash when withHash is set,
+   which reads the whole file */
+bool ReadTextureSource(const char *path, bool withHash, TextureSource *out);
+
+#endif
@@ -1,7 +1,9 @@
 #include "vk-basic.h"
 #include "features.h"
+#include "rutils/file.h"
 #include "rutils/math.h"
 #include "rutils/string.h"
+#include <stdio.h>
 
 local bool HasStencilComponent(VkFormat format)
 {
@@ -18,16 +20,19 @@ VkPhysicalDevice GetVkPhysicalDevice(VkInstance instance, VkSurfaceKHR surf,
     VkPhysicalDevice devArr[dcount];
     vkEnumeratePhysicalDevices(instance, &dcount, devArr);
 
+    VkPhysicalDevice ret = VK_NULL_HANDLE;
+    int bestScore = 0;
     for (u32 i = 0; i < dcount; i++)
     {
-        if (checkFun(devArr[i], surf, expectedDeviceExtensions, numExpectedExtensions))
+        int score = checkFun(devArr[i], surf, expectedDeviceExtensions, numExpectedExtensions);
+        if (score > bestScore)
         {
-            VkPhysicalDevice ret = devArr[i];
-            return ret;
+            ret = devArr[i];
+            bestScore = score;
         }
     }
 
-    return VK_NULL_HANDLE;
+    return ret;
 }
 
 bool GetDeviceQueueGraphicsAndPresentationIndices(VkPhysicalDevice dev, VkSurfaceKHR surf, QueueIndices *indices)
@@ -44,7 +49,15 @@ bool GetDeviceQueueGraphicsAndPresentationIndices(VkPhysicalDevice dev, VkSurfac
     for (u32 i = 0; i < queueFamilyCount; i++)
     {
         VkBool32 presentSupportVK = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, surf, &presentSupportVK);
+        if (surf != VK_NULL_HANDLE)
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, surf, &presentSupportVK);
+        }
+        else
+        {
+            /* Headless. Nothing is presented so keep it on the graphics family */
+            presentSupportVK = (pArr[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        }
 
         if (pArr[i].queueCount > 0 && presentSupportVK)
         {
@@ -65,6 +78,39 @@ bool GetDeviceQueueGraphicsAndPresentationIndices(VkPhysicalDevice dev, VkSurfac
     return false;
 }
 
+bool GetDeviceQueueTransferIndex(VkPhysicalDevice dev, u32 *out)
+{
+    u32 queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(dev, &queueFamilyCount, NULL);
+
+    VkQueueFamilyProperties pArr[queueFamilyCount];
+    vkGetPhysicalDeviceQueueFamilyProperties(dev, &queueFamilyCount, pArr);
+
+    /* Transfer only families are usually the DMA engines. Fall back to an
+       async compute family, which still stays off the graphics queue */
+    bool found = false;
+    for (u32 i = 0; i < queueFamilyCount; i++)
+    {
+        VkQueueFlags flags = pArr[i].queueFlags;
+        if (pArr[i].queueCount == 0 || !(flags & VK_QUEUE_TRANSFER_BIT) ||
+            flags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            continue;
+        }
+        if (!(flags & VK_QUEUE_COMPUTE_BIT))
+        {
+            *out = i;
+            return true;
+        }
+        if (!found)
+        {
+            *out = i;
+            found = true;
+        }
+    }
+    return found;
+}
+
 bool CheckDeviceExtensionSupport(VkPhysicalDevice dev,
                                  const char **extensionList,
                                  size_t extensionCount)
@@ -159,25 +205,44 @@ errcode CreateLogicalDevice(VkPhysicalDevice physdev,
         return ERROR_INVAL_PARAMETER;
     }
 
-    f32 queuePriority = 1.0f;
+    ld.dedicatedTransfer = GetDeviceQueueTransferIndex(physdev, &qi.transferIndex);
+    if (!ld.dedicatedTransfer)
+    {
+        qi.transferIndex = qi.graphicsIndex;
+    }
 
-    VkDeviceQueueCreateInfo qci[2] = {0};
-    qci[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    qci[0].queueFamilyIndex = qi.graphicsIndex;
-    qci[0].queueCount = 1;
-    qci[0].pQueuePriorities = &queuePriority;
+    f32 queuePriority = 1.0f;
 
-    qci[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    qci[1].queueFamilyIndex = qi.presentIndex;
-    qci[1].queueCount = 1;
-    qci[1].pQueuePriorities = &queuePriority;
+    u32 families[] = {qi.graphicsIndex, qi.presentIndex, qi.transferIndex};
+    VkDeviceQueueCreateInfo qci[countof(families)] = {0};
+    u32 qciCount = 0;
+    for (u32 i = 0; i < countof(families); i++)
+    {
+        bool seen = false;
+        for (u32 j = 0; j < qciCount; j++)
+        {
+            if (qci[j].queueFamilyIndex == families[i])
+            {
+                seen = true;
+            }
+        }
+        if (seen)
+        {
+            continue;
+        }
+        qci[qciCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        qci[qciCount].queueFamilyIndex = families[i];
+        qci[qciCount].queueCount = 1;
+        qci[qciCount].pQueuePriorities = &queuePriority;
+        qciCount++;
+    }
 
     VkDeviceCreateInfo dci = {0};
     const char *extensionList[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-    dci.enabledExtensionCount = countof(extensionList);
+    dci.enabledExtensionCount = surf != VK_NULL_HANDLE ? countof(extensionList) : 0;
     dci.ppEnabledExtensionNames = extensionList;
     dci.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    dci.queueCreateInfoCount = qi.graphicsIndex == qi.presentIndex ? 1 : 2;
+    dci.queueCreateInfoCount = qciCount;
     dci.pQueueCreateInfos = qci;
     dci.pEnabledFeatures = df;
 
@@ -195,18 +260,84 @@ errcode CreateLogicalDevice(VkPhysicalDevice physdev,
     {
         ld.presentQueue = ld.graphicsQueue;
     }
+    if (ld.dedicatedTransfer)
+    {
+        vkGetDeviceQueue(ld.dev, qi.transferIndex, 0, &ld.transferQueue);
+    }
+    else
+    {
+        ld.transferQueue = ld.graphicsQueue;
+    }
 
     ld.indices = qi;
     ld.physdev = physdev;
 
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physdev, &props);
+    vkGetPhysicalDeviceMemoryProperties(physdev, &ld.allocator.memProperties);
+    ld.allocator.bufferImageGranularity = props.limits.bufferImageGranularity;
+    ld.allocator.nonCoherentAtomSize = props.limits.nonCoherentAtomSize;
+
     *outld = ld;
 
     return ERROR_SUCCESS;
 }
 
+local bool PresentModeSupported(const SwapChainSupportDetails *d, VkPresentModeKHR mode)
+{
+    for (u32 i = 0; i < d->modeCount; i++)
+    {
+        if (d->presentModes[i] == mode)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Uncapped modes fall back to each other before giving up on tearing or
+   latency, everything ends at FIFO which is always there */
+local VkPresentModeKHR SelectPresentMode(const SwapChainSupportDetails *d, VkPresentModeKHR preferred)
+{
+    VkPresentModeKHR immediateChain[] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+                                         VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+    VkPresentModeKHR mailboxChain[] = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    VkPresentModeKHR relaxedChain[] = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+
+    VkPresentModeKHR *chain = NULL;
+    u32 chainLength = 0;
+    switch (preferred)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        chain = immediateChain;
+        chainLength = countof(immediateChain);
+        break;
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        chain = mailboxChain;
+        chainLength = countof(mailboxChain);
+        break;
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+        chain = relaxedChain;
+        chainLength = countof(relaxedChain);
+        break;
+    default:
+        break;
+    }
+
+    for (u32 i = 0; i < chainLength; i++)
+    {
+        if (PresentModeSupported(d, chain[i]))
+        {
+            return chain[i];
+        }
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
 errcode CreateRenderContext(LogicalDevice *ld,
                             VkSurfaceKHR surf, u32 windowWidth,
-                            u32 windowHeight, RenderContext *out)
+                            u32 windowHeight, VkSwapchainKHR oldSwapchain,
+                            VkPresentModeKHR presentMode, RenderContext *out)
 
 {
     SwapChainSupportDetails d = QuerySwapChainSupport(ld->physdev, surf);
@@ -235,19 +366,7 @@ errcode CreateRenderContext(LogicalDevice *ld,
         }
     }
 
-    VkPresentModeKHR pmode = VK_PRESENT_MODE_FIFO_KHR;
-
-    if (USE_MAILBOX_RENDERER)
-    {
-        for (u32 i = 0; i < d.modeCount; i++)
-        {
-            if (d.presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-            {
-                pmode = VK_PRESENT_MODE_MAILBOX_KHR;
-                break;
-            }
-        }
-    }
+    VkPresentModeKHR pmode = SelectPresentMode(&d, presentMode);
 
     VkExtent2D e = SelectSwapExtent(&d, windowWidth, windowHeight);
 
@@ -256,6 +375,15 @@ errcode CreateRenderContext(LogicalDevice *ld,
     {
         imageCount = d.capabilities.maxImageCount;
     }
+    if (d.capabilities.minImageCount > MAX_SWAPCHAIN_IMAGES)
+    {
+        DeleteSwapChainSupportDetails(d);
+        return ERROR_INITIALIZATION_FAILURE;
+    }
+    if (imageCount > MAX_SWAPCHAIN_IMAGES)
+    {
+        imageCount = MAX_SWAPCHAIN_IMAGES;
+    }
 
     VkSwapchainCreateInfoKHR ci = {0};
     ci.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -285,14 +413,24 @@ errcode CreateRenderContext(LogicalDevice *ld,
     ci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     ci.presentMode = pmode;
     ci.clipped = VK_TRUE;
-    ci.oldSwapchain = VK_NULL_HANDLE;
+    ci.oldSwapchain = oldSwapchain;
 
     if (vkCreateSwapchainKHR(ld->dev, &ci, NULL, &out->swapchain) != VK_SUCCESS)
     {
+        out->swapchain = VK_NULL_HANDLE;
+        DeleteSwapChainSupportDetails(d);
         return ERROR_EXTERNAL_LIB;
     }
 
+    /* minImageCount is only a minimum, the driver may still create more */
     vkGetSwapchainImagesKHR(ld->dev, out->swapchain, &imageCount, NULL);
+    if (imageCount > MAX_SWAPCHAIN_IMAGES)
+    {
+        vkDestroySwapchainKHR(ld->dev, out->swapchain, NULL);
+        out->swapchain = VK_NULL_HANDLE;
+        DeleteSwapChainSupportDetails(d);
+        return ERROR_INITIALIZATION_FAILURE;
+    }
     out->images = malloc(sizeof(out->images[0]) * imageCount);
     vkGetSwapchainImagesKHR(ld->dev, out->swapchain, &imageCount, out->images);
     out->imageCount = imageCount;
@@ -316,31 +454,93 @@ errcode CreateRenderContext(LogicalDevice *ld,
         ivci.subresourceRange.layerCount = 1;
         if (vkCreateImageView(ld->dev, &ivci, NULL, &out->imageViews[i]) != VK_SUCCESS)
         {
-            free(out->images);
-            free(out->imageViews);
+            out->imageCount = i;
+            DestroySwapChainData(ld, out);
+            out->swapchain = VK_NULL_HANDLE;
+            DeleteSwapChainSupportDetails(d);
             return ERROR_EXTERNAL_LIB;
         }
     }
     out->e = e;
     out->format = form;
+    out->presentMode = pmode;
 
     DeleteSwapChainSupportDetails(d);
     return ERROR_SUCCESS;
 }
 
+errcode CreateOffscreenRenderContext(LogicalDevice *ld, u32 width, u32 height,
+                                     u32 imageCount, RenderContext *out)
+{
+    *out = (RenderContext){0};
+    if (imageCount > MAX_SWAPCHAIN_IMAGES)
+    {
+        return ERROR_INVAL_PARAMETER;
+    }
+    out->format = (VkSurfaceFormatKHR){VK_FORMAT_B8G8R8A8_UNORM,
+                                       VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    out->e = (VkExtent2D){width, height};
+    out->images = calloc(imageCount, sizeof(out->images[0]));
+    out->imageViews = calloc(imageCount, sizeof(out->imageViews[0]));
+    out->imageMemory = calloc(imageCount, sizeof(out->imageMemory[0]));
+
+    for (u32 i = 0; i < imageCount; i++)
+    {
+        if (!CreateVkImage(ld, width, height, 1, out->format.format,
+                           VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                           &out->images[i], &out->imageMemory[i]))
+        {
+            out->imageCount = i;
+            DestroySwapChainData(ld, out);
+            return ERROR_EXTERNAL_LIB;
+        }
+        if (!CreateImageView(ld, out->images[i], out->format.format, VK_IMAGE_ASPECT_COLOR_BIT, 1,
+                             &out->imageViews[i]))
+        {
+            out->imageCount = i + 1;
+            DestroySwapChainData(ld, out);
+            return ERROR_EXTERNAL_LIB;
+        }
+    }
+    out->imageCount = imageCount;
+    return ERROR_SUCCESS;
+}
+
 void DestroySwapChainData(LogicalDevice *ld, RenderContext *data)
 {
     for (u32 i = 0; i < data->imageCount; i++)
     {
         vkDestroyImageView(ld->dev, data->imageViews[i], NULL);
     }
+    if (data->swapchain != VK_NULL_HANDLE)
+    {
+        vkDestroySwapchainKHR(ld->dev, data->swapchain, NULL);
+    }
+    else
+    {
+        for (u32 i = 0; i < data->imageCount; i++)
+        {
+            vkDestroyImage(ld->dev, data->images[i], NULL);
+            FreeGPUMemory(ld, &data->imageMemory[i]);
+        }
+        free(data->imageMemory);
+    }
     free(data->imageViews);
     free(data->images);
-    vkDestroySwapchainKHR(ld->dev, data->swapchain, NULL);
 }
 
 void DestroyLogicalDevice(LogicalDevice *ld)
 {
+    GPUAllocator *a = &ld->allocator;
+    for (u32 i = 0; i < a->blockCount; i++)
+    {
+        if (a->blocks[i].memory != VK_NULL_HANDLE)
+        {
+            vkFreeMemory(ld->dev, a->blocks[i].memory, NULL);
+        }
+        free(a->blocks[i].chunks);
+    }
+    free(a->blocks);
     vkDestroyDevice(ld->dev, NULL);
 }
 
@@ -361,8 +561,125 @@ VkShaderModule CreateVkShaderModule(const LogicalDevice *ld,
     return mod;
 }
 
+/* Vulkan's own cache header has the device UUID but not the driver version,
+   so the file gets a header of our own in front of the cache data */
+#define PIPELINE_CACHE_MAGIC 0x43505456 /* "VTPC" */
+
+typedef struct PipelineCacheFileHeader
+{
+    u32 magic;
+    u32 vendorID;
+    u32 deviceID;
+    u32 driverVersion;
+    u8 uuid[VK_UUID_SIZE];
+    u64 dataSize;
+} PipelineCacheFileHeader;
+
+local PipelineCacheFileHeader PipelineCacheHeaderForDevice(const LogicalDevice *ld)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ld->physdev, &props);
+
+    PipelineCacheFileHeader header = {0};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendorID = props.vendorID;
+    header.deviceID = props.deviceID;
+    header.driverVersion = props.driverVersion;
+    memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+VkPipelineCache LoadPipelineCache(const LogicalDevice *ld, const char *path, bool *warm)
+{
+    *warm = false;
+    PipelineCacheFileHeader expected = PipelineCacheHeaderForDevice(ld);
+
+    VkPipelineCacheCreateInfo cacheInfo = {0};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+    isize fileSize = 0;
+    u8 *file = path ? MapFileToROBuffer(path, NULL, &fileSize) : NULL;
+    /* fileSize counts one byte past the end of the file, as with the shaders */
+    if (file && fileSize - 1 >= (isize)sizeof(expected))
+    {
+        PipelineCacheFileHeader header;
+        memcpy(&header, file, sizeof(header));
+        if (header.magic == expected.magic &&
+            header.vendorID == expected.vendorID &&
+            header.deviceID == expected.deviceID &&
+            header.driverVersion == expected.driverVersion &&
+            memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) == 0 &&
+            header.dataSize == (u64)(fileSize - 1 - sizeof(header)))
+        {
+            cacheInfo.initialDataSize = header.dataSize;
+            cacheInfo.pInitialData = file + sizeof(header);
+        }
+    }
+
+    VkPipelineCache cache;
+    VkResult result = vkCreatePipelineCache(ld->dev, &cacheInfo, NULL, &cache);
+    if (result != VK_SUCCESS && cacheInfo.initialDataSize)
+    {
+        /* The driver didn't like the data. Start over with an empty cache */
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = NULL;
+        result = vkCreatePipelineCache(ld->dev, &cacheInfo, NULL, &cache);
+    }
+    else if (result == VK_SUCCESS)
+    {
+        *warm = cacheInfo.initialDataSize != 0;
+    }
+
+    if (file)
+    {
+        UnmapMappedBuffer(file, fileSize);
+    }
+    return result == VK_SUCCESS ? cache : VK_NULL_HANDLE;
+}
+
+bool SavePipelineCache(const LogicalDevice *ld, VkPipelineCache cache, const char *path)
+{
+    size_t dataSize;
+    if (vkGetPipelineCacheData(ld->dev, cache, &dataSize, NULL) != VK_SUCCESS)
+    {
+        return false;
+    }
+    void *data = malloc(dataSize);
+    if (vkGetPipelineCacheData(ld->dev, cache, &dataSize, data) != VK_SUCCESS)
+    {
+        free(data);
+        return false;
+    }
+
+    PipelineCacheFileHeader header = PipelineCacheHeaderForDevice(ld);
+    header.dataSize = dataSize;
+
+    size_t pathLen = strlen(path);
+    char *tmpPath = malloc(pathLen + sizeof(".tmp"));
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", sizeof(".tmp"));
+
+    bool ok = false;
+    FILE *f = fopen(tmpPath, "wb");
+    if (f)
+    {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(data, 1, dataSize, f) == dataSize;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmpPath, path) == 0;
+        if (!ok)
+        {
+            remove(tmpPath);
+        }
+    }
+
+    free(tmpPath);
+    free(data);
+    return ok;
+}
+
 VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
-                                  const RenderContext *data,
+                                  VkPipelineCache cache,
                                   VkShaderModule vertShader,
                                   VkShaderModule fragShader,
                                   VkRenderPass renderpass,
@@ -391,24 +708,11 @@ VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
     piasci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     piasci.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport = {0};
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = (float)data->e.width;
-    viewport.height = (float)data->e.height;
-    viewport.minDepth = 0;
-    viewport.maxDepth = 1;
-
-    VkRect2D scissor = {0};
-    scissor.offset = (VkOffset2D){0, 0};
-    scissor.extent = data->e;
-
+    /* Viewport and scissor are dynamic so the pipeline survives resizes */
     VkPipelineViewportStateCreateInfo vps = {0};
     vps.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     vps.viewportCount = 1;
-    vps.pViewports = &viewport;
     vps.scissorCount = 1;
-    vps.pScissors = &scissor;
 
     VkPipelineRasterizationStateCreateInfo rasterizer = {0};
     rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -443,7 +747,7 @@ VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
     colorBlending.blendConstants[3] = 0;
 
     VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
-                                      VK_DYNAMIC_STATE_LINE_WIDTH};
+                                      VK_DYNAMIC_STATE_SCISSOR};
 
     VkPipelineDynamicStateCreateInfo dynamicState = {0};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -481,9 +785,10 @@ VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
     pipelineInfo.renderPass = renderpass;
     pipelineInfo.subpass = 0;
     pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pDynamicState = &dynamicState;
 
     VkPipeline graphicsPipeline;
-    if (vkCreateGraphicsPipelines(ld->dev, VK_NULL_HANDLE, 1,
+    if (vkCreateGraphicsPipelines(ld->dev, cache, 1,
                                   &pipelineInfo, NULL, &graphicsPipeline) !=
         VK_SUCCESS)
     {
@@ -493,6 +798,42 @@ VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
 
     return graphicsPipeline;
 }
+
+VkPipeline CreateComputePipeline(const LogicalDevice *ld,
+                                 VkPipelineCache cache,
+                                 VkShaderModule shader,
+                                 VkDescriptorSetLayout *descriptorSetLayouts,
+                                 u32 descriptorSetsCount,
+                                 VkPipelineLayout *layout)
+{
+    VkPipelineLayoutCreateInfo pci = {0};
+    pci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pci.setLayoutCount = descriptorSetsCount;
+    pci.pSetLayouts = descriptorSetLayouts;
+
+    if (vkCreatePipelineLayout(ld->dev, &pci, NULL, layout))
+    {
+        return VK_NULL_HANDLE;
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {0};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = *layout;
+
+    VkPipeline computePipeline;
+    if (vkCreateComputePipelines(ld->dev, cache, 1, &pipelineInfo, NULL, &computePipeline) != VK_SUCCESS)
+    {
+        vkDestroyPipelineLayout(ld->dev, *layout, NULL);
+        return VK_NULL_HANDLE;
+    }
+
+    return computePipeline;
+}
+
 VkRenderPass CreateRenderPass(const LogicalDevice *ld,
                               const RenderContext *data,
                               const DepthResources *dr)
@@ -505,7 +846,8 @@ VkRenderPass CreateRenderPass(const LogicalDevice *ld,
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = data->swapchain != VK_NULL_HANDLE ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                                                     : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
     VkAttachmentDescription depthAttachment = {0};
     if (dr)
@@ -595,12 +937,12 @@ VkFramebuffer *CreateFrameBuffers(const LogicalDevice *ld, const RenderContext *
     return ret;
 }
 
-VkCommandPool CreateCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flags)
+local VkCommandPool CreateCommandPoolForFamily(LogicalDevice *ld, u32 family, VkCommandPoolCreateFlags flags)
 {
 
     VkCommandPoolCreateInfo poolInfo = {0};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.queueFamilyIndex = ld->indices.graphicsIndex;
+    poolInfo.queueFamilyIndex = family;
     poolInfo.flags = flags;
 
     VkCommandPool ret;
@@ -611,6 +953,20 @@ VkCommandPool CreateCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flag
     return ret;
 }
 
+VkCommandPool CreateCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flags)
+{
+    return CreateCommandPoolForFamily(ld, ld->indices.graphicsIndex, flags);
+}
+
+VkCommandPool CreateTransferCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flags)
+{
+    if (!ld->dedicatedTransfer)
+    {
+        return VK_NULL_HANDLE;
+    }
+    return CreateCommandPoolForFamily(ld, ld->indices.transferIndex, flags);
+}
+
 bool FindMemoryType(VkPhysicalDevice physdev, u32 typefilter,
                     VkMemoryPropertyFlags properties, u32 *out)
 {
@@ -619,7 +975,8 @@ bool FindMemoryType(VkPhysicalDevice physdev, u32 typefilter,
     vkGetPhysicalDeviceMemoryProperties(physdev, &memproperties);
     for (u32 i = 0; i < memproperties.memoryTypeCount; i++)
     {
-        if (typefilter & (i << i) && memproperties.memoryTypes[i].propertyFlags & properties)
+        if (typefilter & (1 << i) &&
+            (memproperties.memoryTypes[i].propertyFlags & properties) == properties)
         {
             *out = i;
             return true;
@@ -628,69 +985,434 @@ bool FindMemoryType(VkPhysicalDevice physdev, u32 typefilter,
     return false;
 }
 
-VkResult CreateGPUBufferData(LogicalDevice *ld,
-                             size_t vertexBufferSize,
-                             VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                             GPUBufferData *buffer)
+local VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
 
+/* Whether the last byte of one resource and the first byte of another land on
+   the same bufferImageGranularity page */
+local bool OnSamePage(VkDeviceSize lastByte, VkDeviceSize firstByte, VkDeviceSize granularity)
 {
-    VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkBufferCreateInfo bufferInfo = {0};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = vertexBufferSize;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    return (lastByte & ~(granularity - 1)) == (firstByte & ~(granularity - 1));
+}
 
-    if (vkCreateBuffer(ld->dev, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS)
+local void InsertGPUMemoryChunk(GPUMemoryBlock *block, u32 index, GPUMemoryChunk chunk)
+{
+    if (block->chunkCount == block->chunkCapacity)
     {
-
-        return ERROR_EXTERNAL_LIB;
+        block->chunkCapacity = block->chunkCapacity ? block->chunkCapacity * 2 : 16;
+        block->chunks = realloc(block->chunks, sizeof(block->chunks[0]) * block->chunkCapacity);
     }
+    memmove(&block->chunks[index + 1], &block->chunks[index],
+            sizeof(block->chunks[0]) * (block->chunkCount - index));
+    block->chunks[index] = chunk;
+    block->chunkCount++;
+}
 
-    VkMemoryRequirements memReq = {0};
-    vkGetBufferMemoryRequirements(ld->dev, vertexBuffer, &memReq);
+local void RemoveGPUMemoryChunk(GPUMemoryBlock *block, u32 index)
+{
+    memmove(&block->chunks[index], &block->chunks[index + 1],
+            sizeof(block->chunks[0]) * (block->chunkCount - index - 1));
+    block->chunkCount--;
+}
 
-    VkMemoryAllocateInfo allocInfo = {0};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memReq.size;
-    if (!FindMemoryType(ld->physdev, memReq.memoryTypeBits,
-                        properties, &allocInfo.memoryTypeIndex))
+/* First fit over the block's chunk list. Chunks are kept sorted by offset and
+   adjacent free chunks are always merged, so the neighbours of a free chunk
+   are live allocations */
+local bool GPUMemoryBlockAlloc(GPUMemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment,
+                               VkDeviceSize granularity, bool linear, VkDeviceSize *outOffset)
+{
+    for (u32 i = 0; i < block->chunkCount; i++)
     {
+        GPUMemoryChunk c = block->chunks[i];
+        if (!c.free || c.size < size)
+        {
+            continue;
+        }
 
-        return -1;
-    }
+        VkDeviceSize offset = AlignUp(c.offset, alignment);
+        if (i > 0)
+        {
+            GPUMemoryChunk *prev = &block->chunks[i - 1];
+            if (!prev->free && prev->linear != linear &&
+                OnSamePage(prev->offset + prev->size - 1, offset, granularity))
+            {
+                offset = AlignUp(offset, granularity);
+            }
+        }
 
-    VkDeviceMemory vertexBufferMem;
-    if (vkAllocateMemory(ld->dev, &allocInfo, NULL, &vertexBufferMem) != VK_SUCCESS)
-    {
+        VkDeviceSize end = offset + size;
+        if (end > c.offset + c.size)
+        {
+            continue;
+        }
 
-        return -1;
-    }
+        if (i + 1 < block->chunkCount)
+        {
+            GPUMemoryChunk *next = &block->chunks[i + 1];
+            if (!next->free && next->linear != linear && OnSamePage(end - 1, next->offset, granularity))
+            {
+                continue;
+            }
+        }
 
-    vkBindBufferMemory(ld->dev, vertexBuffer, vertexBufferMem, 0);
-    *buffer = (GPUBufferData){vertexBuffer, vertexBufferMem};
-    return VK_SUCCESS;
+        u32 index = i;
+        if (offset > c.offset)
+        {
+            block->chunks[index].size = offset - c.offset;
+            index++;
+            InsertGPUMemoryChunk(block, index, (GPUMemoryChunk){offset, size, false, linear});
+        }
+        else
+        {
+            block->chunks[index] = (GPUMemoryChunk){offset, size, false, linear};
+        }
+
+        if (end < c.offset + c.size)
+        {
+            InsertGPUMemoryChunk(block, index + 1,
+                                 (GPUMemoryChunk){end, c.offset + c.size - end, true, false});
+        }
+
+        *outOffset = offset;
+        return true;
+    }
+    return false;
 }
 
-void DestroyGPUBufferInfo(LogicalDevice *ld, GPUBufferData *buffer)
+local bool GPUMemoryBlockIsEmpty(GPUMemoryBlock *block)
 {
-    vkDestroyBuffer(ld->dev, buffer->buffer, NULL);
-    vkFreeMemory(ld->dev, buffer->deviceMemory, NULL);
+    return block->chunkCount == 1 && block->chunks[0].free;
 }
 
-void CopyGPUBuffer(LogicalDevice *ld,
-                   GPUBufferData *dest, GPUBufferData *src,
-                   VkDeviceSize size, VkDeviceSize offsetDest,
-                   VkDeviceSize offsetSrc, VkCommandPool commandPool)
+local bool CreateGPUMemoryBlock(LogicalDevice *ld, u32 memoryTypeIndex, VkDeviceSize size,
+                                bool dedicated, u32 *outIndex)
 {
-    VkCommandBufferAllocateInfo allocInfo = {0};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(ld->dev, &allocInfo, &commandBuffer);
+    GPUAllocator *a = &ld->allocator;
+
+    VkMemoryAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(ld->dev, &allocInfo, NULL, &memory) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    u32 index = a->blockCount;
+    for (u32 i = 0; i < a->blockCount; i++)
+    {
+        if (a->blocks[i].memory == VK_NULL_HANDLE)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == a->blockCount)
+    {
+        a->blocks = realloc(a->blocks, sizeof(a->blocks[0]) * (a->blockCount + 1));
+        a->blocks[index] = (GPUMemoryBlock){0};
+        a->blockCount++;
+    }
+
+    GPUMemoryBlock *block = &a->blocks[index];
+    block->memory = memory;
+    block->size = size;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->dedicated = dedicated;
+    block->mapped = NULL;
+    block->mapCount = 0;
+    block->chunkCount = 0;
+    InsertGPUMemoryChunk(block, 0, (GPUMemoryChunk){0, size, true, false});
+
+    *outIndex = index;
+    return true;
+}
+
+bool AllocateGPUMemory(LogicalDevice *ld, const VkMemoryRequirements *memReq,
+                       VkMemoryPropertyFlags properties, bool linear, GPUAllocation *out)
+{
+    GPUAllocator *a = &ld->allocator;
+
+    u32 memoryTypeIndex;
+    if (!FindMemoryType(ld->physdev, memReq->memoryTypeBits, properties, &memoryTypeIndex))
+    {
+        return false;
+    }
+
+    VkDeviceSize offset;
+    for (u32 i = 0; i < a->blockCount; i++)
+    {
+        GPUMemoryBlock *block = &a->blocks[i];
+        if (block->memory != VK_NULL_HANDLE && !block->dedicated &&
+            block->memoryTypeIndex == memoryTypeIndex &&
+            GPUMemoryBlockAlloc(block, memReq->size, memReq->alignment,
+                                a->bufferImageGranularity, linear, &offset))
+        {
+            *out = (GPUAllocation){block->memory, offset, memReq->size, i};
+            return true;
+        }
+    }
+
+    /* Don't let one block eat too much of a small heap */
+    u32 heapIndex = a->memProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    VkDeviceSize blockSize = GPU_MEMORY_BLOCK_SIZE;
+    if (blockSize > a->memProperties.memoryHeaps[heapIndex].size / 8)
+    {
+        blockSize = a->memProperties.memoryHeaps[heapIndex].size / 8;
+    }
+
+    bool dedicated = memReq->size > blockSize;
+    u32 blockIndex;
+    if (!CreateGPUMemoryBlock(ld, memoryTypeIndex, dedicated ? memReq->size : blockSize,
+                              dedicated, &blockIndex))
+    {
+        return false;
+    }
+
+    GPUMemoryBlock *block = &a->blocks[blockIndex];
+    if (!GPUMemoryBlockAlloc(block, memReq->size, memReq->alignment,
+                             a->bufferImageGranularity, linear, &offset))
+    {
+        return false;
+    }
+    *out = (GPUAllocation){block->memory, offset, memReq->size, blockIndex};
+    return true;
+}
+
+void FreeGPUMemory(LogicalDevice *ld, GPUAllocation *alloc)
+{
+    if (alloc->memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    GPUMemoryBlock *block = &ld->allocator.blocks[alloc->block];
+
+    u32 lo = 0;
+    u32 hi = block->chunkCount;
+    while (lo < hi)
+    {
+        u32 mid = lo + (hi - lo) / 2;
+        if (block->chunks[mid].offset < alloc->offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    u32 i = lo;
+    block->chunks[i].free = true;
+    block->chunks[i].linear = false;
+
+    if (i + 1 < block->chunkCount && block->chunks[i + 1].free)
+    {
+        block->chunks[i].size += block->chunks[i + 1].size;
+        RemoveGPUMemoryChunk(block, i + 1);
+    }
+    if (i > 0 && block->chunks[i - 1].free)
+    {
+        block->chunks[i - 1].size += block->chunks[i].size;
+        RemoveGPUMemoryChunk(block, i);
+    }
+
+    /* Shared blocks stay around so staging churn doesn't hit the driver */
+    if (block->dedicated && GPUMemoryBlockIsEmpty(block))
+    {
+        vkFreeMemory(ld->dev, block->memory, NULL);
+        block->memory = VK_NULL_HANDLE;
+        block->chunkCount = 0;
+    }
+
+    alloc->memory = VK_NULL_HANDLE;
+}
+
+void *MapGPUMemory(LogicalDevice *ld, GPUAllocation *alloc)
+{
+    GPUMemoryBlock *block = &ld->allocator.blocks[alloc->block];
+    if (block->mapCount == 0)
+    {
+        if (vkMapMemory(ld->dev, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS)
+        {
+            return NULL;
+        }
+    }
+    block->mapCount++;
+    return (u8 *)block->mapped + alloc->offset;
+}
+
+void UnmapGPUMemory(LogicalDevice *ld, GPUAllocation *alloc)
+{
+    GPUMemoryBlock *block = &ld->allocator.blocks[alloc->block];
+    if (--block->mapCount == 0)
+    {
+        vkUnmapMemory(ld->dev, block->memory);
+        block->mapped = NULL;
+    }
+}
+
+VkResult CreateGPUBufferData(LogicalDevice *ld,
+                             size_t vertexBufferSize,
+                             VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                             GPUBufferData *buffer)
+
+{
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkBufferCreateInfo bufferInfo = {0};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = vertexBufferSize;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(ld->dev, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS)
+    {
+
+        return ERROR_EXTERNAL_LIB;
+    }
+
+    VkMemoryRequirements memReq = {0};
+    vkGetBufferMemoryRequirements(ld->dev, vertexBuffer, &memReq);
+
+    GPUAllocation vertexBufferMem;
+    if (!AllocateGPUMemory(ld, &memReq, properties, true, &vertexBufferMem))
+    {
+        vkDestroyBuffer(ld->dev, vertexBuffer, NULL);
+        return -1;
+    }
+
+    vkBindBufferMemory(ld->dev, vertexBuffer, vertexBufferMem.memory, vertexBufferMem.offset);
+
+    GPUAllocator *a = &ld->allocator;
+    u32 memoryTypeIndex = a->blocks[vertexBufferMem.block].memoryTypeIndex;
+    bool coherent = a->memProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    *buffer = (GPUBufferData){vertexBuffer, vertexBufferMem, NULL, coherent};
+    return VK_SUCCESS;
+}
+
+VkResult CreateMappedGPUBufferData(LogicalDevice *ld,
+                                   size_t bufferSize,
+                                   VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                                   GPUBufferData *buffer)
+{
+    VkResult result = CreateGPUBufferData(ld, bufferSize, usage,
+                                          properties | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, buffer);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    buffer->mapped = MapGPUMemory(ld, &buffer->alloc);
+    if (!buffer->mapped)
+    {
+        DestroyGPUBufferInfo(ld, buffer);
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+void DestroyGPUBufferInfo(LogicalDevice *ld, GPUBufferData *buffer)
+{
+    if (buffer->mapped)
+    {
+        UnmapGPUMemory(ld, &buffer->alloc);
+        buffer->mapped = NULL;
+    }
+    vkDestroyBuffer(ld->dev, buffer->buffer, NULL);
+    FreeGPUMemory(ld, &buffer->alloc);
+}
+
+/* Flush and invalidate ranges have to be multiples of nonCoherentAtomSize
+   relative to the start of the VkDeviceMemory, not the buffer */
+local VkMappedMemoryRange GPUBufferMappedRange(LogicalDevice *ld, GPUBufferData *buffer,
+                                               VkDeviceSize offset, VkDeviceSize size)
+{
+    GPUAllocator *a = &ld->allocator;
+    VkDeviceSize atom = a->nonCoherentAtomSize;
+    VkDeviceSize blockSize = a->blocks[buffer->alloc.block].size;
+
+    VkDeviceSize start = (buffer->alloc.offset + offset) & ~(atom - 1);
+    VkDeviceSize end = AlignUp(buffer->alloc.offset + offset + size, atom);
+    if (end > blockSize)
+    {
+        end = blockSize;
+    }
+
+    VkMappedMemoryRange range = {0};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = buffer->alloc.memory;
+    range.offset = start;
+    range.size = end - start;
+    return range;
+}
+
+void FlushGPUBuffer(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (buffer->coherent)
+    {
+        return;
+    }
+    VkMappedMemoryRange range = GPUBufferMappedRange(ld, buffer, offset, size);
+    vkFlushMappedMemoryRanges(ld->dev, 1, &range);
+}
+
+void InvalidateGPUBuffer(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (buffer->coherent)
+    {
+        return;
+    }
+    VkMappedMemoryRange range = GPUBufferMappedRange(ld, buffer, offset, size);
+    vkInvalidateMappedMemoryRanges(ld->dev, 1, &range);
+}
+
+void *MapGPUBufferRange(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    GPUMemoryBlock *block = &ld->allocator.blocks[buffer->alloc.block];
+    if (block->mapCount > 0)
+    {
+        block->mapCount++;
+        return (u8 *)block->mapped + buffer->alloc.offset + offset;
+    }
+    VkMappedMemoryRange range = GPUBufferMappedRange(ld, buffer, offset, size);
+    void *mapped;
+    if (vkMapMemory(ld->dev, block->memory, range.offset, range.size, 0, &mapped) != VK_SUCCESS)
+    {
+        return NULL;
+    }
+    return (u8 *)mapped + (buffer->alloc.offset + offset - range.offset);
+}
+
+void UnmapGPUBufferRange(LogicalDevice *ld, GPUBufferData *buffer)
+{
+    GPUMemoryBlock *block = &ld->allocator.blocks[buffer->alloc.block];
+    if (block->mapCount > 0)
+    {
+        UnmapGPUMemory(ld, &buffer->alloc);
+        return;
+    }
+    vkUnmapMemory(ld->dev, block->memory);
+}
+
+void CopyGPUBuffer(LogicalDevice *ld,
+                   GPUBufferData *dest, GPUBufferData *src,
+                   VkDeviceSize size, VkDeviceSize offsetDest,
+                   VkDeviceSize offsetSrc, VkCommandPool commandPool)
+{
+    VkCommandBufferAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(ld->dev, &allocInfo, &commandBuffer);
 
     VkCommandBufferBeginInfo beginInfo = {0};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -717,7 +1439,41 @@ void CopyGPUBuffer(LogicalDevice *ld,
     vkFreeCommandBuffers(ld->dev, commandPool, 1, &commandBuffer);
 }
 
-VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, RenderContext *swapchain,
+bool CreateGPURingBuffer(LogicalDevice *ld, VkDeviceSize elementSize, u32 regionCount,
+                         VkBufferUsageFlags usage, GPURingBuffer *out)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ld->physdev, &props);
+
+    VkDeviceSize alignment = 1;
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+    {
+        alignment = props.limits.minUniformBufferOffsetAlignment;
+    }
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT &&
+        props.limits.minStorageBufferOffsetAlignment > alignment)
+    {
+        alignment = props.limits.minStorageBufferOffsetAlignment;
+    }
+
+    out->regionSize = AlignUp(elementSize, alignment);
+    out->regionCount = regionCount;
+
+    if (CreateMappedGPUBufferData(ld, out->regionSize * regionCount, usage,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  &out->buffer) != VK_SUCCESS)
+    {
+        return false;
+    }
+    return true;
+}
+
+void DestroyGPURingBuffer(LogicalDevice *ld, GPURingBuffer *ring)
+{
+    DestroyGPUBufferInfo(ld, &ring->buffer);
+}
+
+VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, u32 maxSets,
                                       u32 poolSizeCount, VkDescriptorPoolSize *poolSizes)
 {
 
@@ -725,7 +1481,7 @@ VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, RenderContext *swapchai
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = poolSizeCount;
     poolInfo.pPoolSizes = poolSizes;
-    poolInfo.maxSets = swapchain->imageCount;
+    poolInfo.maxSets = maxSets;
     VkDescriptorPool ret;
 
     if (vkCreateDescriptorPool(ld->dev, &poolInfo, NULL, &ret) != VK_SUCCESS)
@@ -735,14 +1491,14 @@ VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, RenderContext *swapchai
     return ret;
 }
 
-VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
+VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, u32 setCount,
                                         VkDescriptorPool descriptorPool,
-                                        GPUBufferData *buffers, VkDescriptorSetLayout layout,
+                                        GPURingBuffer *uniformRing, VkDescriptorSetLayout layout,
                                         VkDeviceSize typeSize, VkImageView imageView, VkSampler sampler)
 {
-    VkDescriptorSet *ret = malloc(data->imageCount * sizeof(*ret));
-    VkDescriptorSetLayout descriptorSetLayouts[data->imageCount];
-    for (u32 i = 0; i < data->imageCount; i++)
+    VkDescriptorSet *ret = malloc(setCount * sizeof(*ret));
+    VkDescriptorSetLayout descriptorSetLayouts[setCount];
+    for (u32 i = 0; i < setCount; i++)
     {
         descriptorSetLayouts[i] = layout;
     }
@@ -750,7 +1506,7 @@ VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
     VkDescriptorSetAllocateInfo allocInfo = {0};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = data->imageCount;
+    allocInfo.descriptorSetCount = setCount;
     allocInfo.pSetLayouts = descriptorSetLayouts;
 
     if (vkAllocateDescriptorSets(ld->dev, &allocInfo, ret) != VK_SUCCESS)
@@ -758,10 +1514,10 @@ VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
         return NULL;
     }
 
-    for (u32 i = 0; i < data->imageCount; i++)
+    for (u32 i = 0; i < setCount; i++)
     {
         VkDescriptorBufferInfo bufferInfo = {0};
-        bufferInfo.buffer = buffers[i].buffer;
+        bufferInfo.buffer = uniformRing->buffer.buffer;
         bufferInfo.offset = 0;
         bufferInfo.range = typeSize;
 
@@ -775,7 +1531,7 @@ VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
         descriptorWrites[0].dstSet = ret[i];
         descriptorWrites[0].dstBinding = 0;
         descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         descriptorWrites[0].descriptorCount = 1;
         descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -792,7 +1548,7 @@ VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
     return ret;
 }
 bool CreateImageView(LogicalDevice *ld, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
-                     VkImageView *out)
+                     u32 mipLevels, VkImageView *out)
 {
     VkImageViewCreateInfo viewInfo = {0};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -801,7 +1557,7 @@ bool CreateImageView(LogicalDevice *ld, VkImage image, VkFormat format, VkImageA
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -838,8 +1594,8 @@ bool FindSupportedFormat(LogicalDevice *ld, u32 candidateCount, VkFormat *candid
     return false;
 }
 
-bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, VkFormat format, VkImageUsageFlags usage,
-                   VkImage *outImage, VkDeviceMemory *outMem)
+bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, u32 mipLevels, VkFormat format, VkImageUsageFlags usage,
+                   VkImage *outImage, GPUAllocation *outMem)
 {
     VkImageCreateInfo imageInfo = {0};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -847,7 +1603,7 @@ bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, VkFormat format, VkImageUsag
     imageInfo.extent.width = x;
     imageInfo.extent.height = y;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -864,26 +1620,26 @@ bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, VkFormat format, VkImageUsag
     VkMemoryRequirements memReq = {0};
     vkGetImageMemoryRequirements(ld->dev, *outImage, &memReq);
 
-    VkMemoryAllocateInfo allocInfo = {0};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memReq.size;
-    if (!FindMemoryType(ld->physdev, memReq.memoryTypeBits,
-                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                        &allocInfo.memoryTypeIndex))
-    {
-        return ERROR_EXTERNAL_LIB;
-    }
-
-    if (vkAllocateMemory(ld->dev, &allocInfo, NULL, outMem))
+    if (!AllocateGPUMemory(ld, &memReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, outMem))
     {
+        vkDestroyImage(ld->dev, *outImage, NULL);
         return false;
     }
 
-    vkBindImageMemory(ld->dev, *outImage, *outMem, 0);
+    vkBindImageMemory(ld->dev, *outImage, outMem->memory, outMem->offset);
     return true;
 }
 
-bool CreateDepthResources(LogicalDevice *ld, RenderContext *rc, VkCommandPool commandPool, DepthResources *out)
+bool FormatSupportsMipBlits(LogicalDevice *ld, VkFormat format)
+{
+    VkFormatFeatureFlags features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(ld->physdev, format, &props);
+    return (props.optimalTilingFeatures & features) == features;
+}
+
+bool CreateDepthResources(LogicalDevice *ld, RenderContext *rc, UploadBatch *batch, DepthResources *out)
 {
 
     VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT};
@@ -893,102 +1649,126 @@ bool CreateDepthResources(LogicalDevice *ld, RenderContext *rc, VkCommandPool co
         return false;
     }
 
-    if (!CreateVkImage(ld, rc->e.width, rc->e.height, out->format,
+    if (!CreateVkImage(ld, rc->e.width, rc->e.height, 1, out->format,
                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
                        &out->image, &out->mem))
     {
         return false;
     }
 
-    if (!CreateImageView(ld, out->image, out->format, VK_IMAGE_ASPECT_DEPTH_BIT, &out->view))
+    if (!CreateImageView(ld, out->image, out->format, VK_IMAGE_ASPECT_DEPTH_BIT, 1, &out->view))
     {
+        vkDestroyImage(ld->dev, out->image, NULL);
+        FreeGPUMemory(ld, &out->mem);
         return false;
     }
 
-    TransitionImageLayout(ld, commandPool,
-                          out->image, out->format,
-                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    if (batch)
+    {
+        UploadBatchTransitionImage(ld, batch, out->image, out->format,
+                                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    }
     return true;
 }
 
 void DestroyDepthResources(LogicalDevice *ld, DepthResources *dr)
 {
-    vkDestroyImage(ld->dev, dr->image, NULL);
-    vkFreeMemory(ld->dev, dr->mem, NULL);
     vkDestroyImageView(ld->dev, dr->view, NULL);
+    vkDestroyImage(ld->dev, dr->image, NULL);
+    FreeGPUMemory(ld, &dr->mem);
 }
 
-void TransitionImageLayout(LogicalDevice *ld, VkCommandPool commandPool, VkImage image, VkFormat format,
-                           VkImageLayout oldLayout, VkImageLayout newLayout)
+void RecordViewportAndScissor(VkCommandBuffer commandBuffer, VkExtent2D extent)
 {
-    ignore format;
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommandBuffer(ld, commandPool);
-    {
-        VkImageMemoryBarrier barrier = {0};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
+    VkViewport viewport = {0};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = (float)extent.width;
+    viewport.height = (float)extent.height;
+    viewport.minDepth = 0;
+    viewport.maxDepth = 1;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    VkRect2D scissor = {0};
+    scissor.offset = (VkOffset2D){0, 0};
+    scissor.extent = extent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
 
-        barrier.image = image;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = 1;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
+void RecordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
+                                 VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
 
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = 0;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
-        if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-        {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    barrier.image = image;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
 
-            if (HasStencilComponent(format))
-            {
-                barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-            }
-        }
-        else
-        {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        }
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
 
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
+    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    {
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+        if (HasStencilComponent(format))
         {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
         }
-        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-        {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    else
+    {
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    }
 
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    VkPipelineStageFlags sourceStage;
+    VkPipelineStageFlags destinationStage;
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        }
-        else
-        {
-            ERROR("Invalid state transition");
-        }
+    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, NULL, 0, 0, 1, &barrier);
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    }
+    else
+    {
+        ERROR("Invalid state transition");
     }
+
+    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, NULL, 0, 0, 1, &barrier);
+}
+
+void TransitionImageLayout(LogicalDevice *ld, VkCommandPool commandPool, VkImage image, VkFormat format,
+                           VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommandBuffer(ld, commandPool);
+    RecordImageLayoutTransition(commandBuffer, image, format, oldLayout, newLayout);
     EndSingleTimeCommandBuffer(ld, commandPool, commandBuffer);
 }
 
@@ -1026,3 +1806,731 @@ void EndSingleTimeCommandBuffer(LogicalDevice *ld, VkCommandPool commandPool, Vk
 
     vkFreeCommandBuffers(ld->dev, commandPool, 1, &commandBuffer);
 }
+
+bool BeginUploadBatch(LogicalDevice *ld, VkCommandPool commandPool, VkCommandPool transferPool,
+                      UploadBatch *out)
+{
+    *out = (UploadBatch){0};
+
+    VkFenceCreateInfo fenceInfo = {0};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(ld->dev, &fenceInfo, NULL, &out->fence) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    if (transferPool != VK_NULL_HANDLE && ld->dedicatedTransfer)
+    {
+        VkSemaphoreCreateInfo semaphoreInfo = {0};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        if (vkCreateSemaphore(ld->dev, &semaphoreInfo, NULL, &out->transferDone) != VK_SUCCESS)
+        {
+            vkDestroyFence(ld->dev, out->fence, NULL);
+            return false;
+        }
+
+        out->commandPool = transferPool;
+        out->graphicsPool = commandPool;
+        out->acquireCommandBuffer = BeginSingleTimeCommandBuffer(ld, commandPool);
+    }
+    else
+    {
+        out->commandPool = commandPool;
+    }
+
+    out->commandBuffer = BeginSingleTimeCommandBuffer(ld, out->commandPool);
+    return true;
+}
+
+/* Queue family ownership transfers are recorded twice: a release at the end
+   of the transfer command buffer and a matching acquire on the graphics
+   queue. Only the layouts, families and ranges are stored here, the access
+   masks are filled in at submit */
+local void UploadBatchReleaseBuffer(LogicalDevice *ld, UploadBatch *batch, VkBuffer buffer,
+                                    VkDeviceSize offset, VkDeviceSize size)
+{
+    if (batch->bufferBarrierCount == batch->bufferBarrierCapacity)
+    {
+        batch->bufferBarrierCapacity = batch->bufferBarrierCapacity ? batch->bufferBarrierCapacity * 2 : 8;
+        batch->bufferBarriers = realloc(batch->bufferBarriers,
+                                        sizeof(batch->bufferBarriers[0]) * batch->bufferBarrierCapacity);
+    }
+
+    VkBufferMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = ld->indices.transferIndex;
+    barrier.dstQueueFamilyIndex = ld->indices.graphicsIndex;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    batch->bufferBarriers[batch->bufferBarrierCount++] = barrier;
+}
+
+local void UploadBatchReleaseImage(LogicalDevice *ld, UploadBatch *batch, VkImage image,
+                                   VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    if (batch->imageBarrierCount == batch->imageBarrierCapacity)
+    {
+        batch->imageBarrierCapacity = batch->imageBarrierCapacity ? batch->imageBarrierCapacity * 2 : 8;
+        batch->imageBarriers = realloc(batch->imageBarriers,
+                                       sizeof(batch->imageBarriers[0]) * batch->imageBarrierCapacity);
+    }
+
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = ld->indices.transferIndex;
+    barrier.dstQueueFamilyIndex = ld->indices.graphicsIndex;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    batch->imageBarriers[batch->imageBarrierCount++] = barrier;
+}
+
+bool UploadBatchAllocateStaging(LogicalDevice *ld, UploadBatch *batch, VkDeviceSize size,
+                                GPUBufferData *out)
+{
+    if (batch->stagingCount == batch->stagingCapacity)
+    {
+        batch->stagingCapacity = batch->stagingCapacity ? batch->stagingCapacity * 2 : 8;
+        batch->stagingBuffers = realloc(batch->stagingBuffers,
+                                        sizeof(batch->stagingBuffers[0]) * batch->stagingCapacity);
+    }
+
+    if (CreateMappedGPUBufferData(ld, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  &batch->stagingBuffers[batch->stagingCount]) != VK_SUCCESS)
+    {
+        return false;
+    }
+    *out = batch->stagingBuffers[batch->stagingCount++];
+    return true;
+}
+
+void UploadBatchCopyBuffer(LogicalDevice *ld, UploadBatch *batch, GPUBufferData *dest, GPUBufferData *src,
+                           VkDeviceSize size, VkDeviceSize offsetDest, VkDeviceSize offsetSrc)
+{
+    VkBufferCopy copyRegion = {0};
+    copyRegion.dstOffset = offsetDest;
+    copyRegion.srcOffset = offsetSrc;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(batch->commandBuffer, src->buffer, dest->buffer, 1, &copyRegion);
+    batch->hasBufferCopies = true;
+
+    if (batch->acquireCommandBuffer != VK_NULL_HANDLE)
+    {
+        UploadBatchReleaseBuffer(ld, batch, dest->buffer, offsetDest, size);
+    }
+}
+
+bool UploadBatchStageBuffer(LogicalDevice *ld, UploadBatch *batch, GPUBufferData *dest,
+                            const void *data, VkDeviceSize size, VkDeviceSize offsetDest)
+{
+    GPUBufferData staging;
+    if (!UploadBatchAllocateStaging(ld, batch, size, &staging))
+    {
+        return false;
+    }
+    memcpy(staging.mapped, data, size);
+    UploadBatchCopyBuffer(ld, batch, dest, &staging, size, offsetDest, 0);
+    return true;
+}
+
+void UploadBatchCopyBufferToImage(UploadBatch *batch, GPUBufferData *src, VkDeviceSize offsetSrc,
+                                  VkImage image, u32 mipLevel, u32 x, u32 y)
+{
+    VkBufferImageCopy region = {0};
+    region.bufferOffset = offsetSrc;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+
+    region.imageOffset = (VkOffset3D){0, 0, 0};
+    region.imageExtent = (VkExtent3D){x, y, 1};
+
+    vkCmdCopyBufferToImage(batch->commandBuffer, src->buffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+void UploadBatchTransitionImage(LogicalDevice *ld, UploadBatch *batch, VkImage image, VkFormat format,
+                                VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    if (batch->acquireCommandBuffer == VK_NULL_HANDLE || newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        RecordImageLayoutTransition(batch->commandBuffer, image, format, oldLayout, newLayout);
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        /* Leaving the transfer queue. The layout change rides along with the
+           ownership transfer */
+        UploadBatchReleaseImage(ld, batch, image, oldLayout, newLayout);
+    }
+    else
+    {
+        /* Nothing to upload, and transfer queues can't reach the graphics
+           stages these transitions wait on */
+        RecordImageLayoutTransition(batch->acquireCommandBuffer, image, format, oldLayout, newLayout);
+    }
+}
+
+/* One level's layout change, leaving the others alone */
+local void RecordMipLevelBarrier(VkCommandBuffer commandBuffer, VkImage image, u32 level,
+                                 VkImageLayout oldLayout, VkImageLayout newLayout,
+                                 VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                                 VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = level;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+/* Every level starts in TRANSFER_DST_OPTIMAL. Each one becomes a blit source
+   for the next and is done once that blit is, so it goes straight on to
+   SHADER_READ_ONLY_OPTIMAL */
+local void RecordMipBlits(VkCommandBuffer commandBuffer, VkImage image, u32 x, u32 y, u32 mipLevels)
+{
+    i32 width = x;
+    i32 height = y;
+    for (u32 level = 1; level < mipLevels; level++)
+    {
+        RecordMipLevelBarrier(commandBuffer, image, level - 1,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                              VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        i32 nextWidth = width > 1 ? width / 2 : 1;
+        i32 nextHeight = height > 1 ? height / 2 : 1;
+        VkImageBlit blit = {0};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.layerCount = 1;
+        blit.srcOffsets[1] = (VkOffset3D){width, height, 1};
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.layerCount = 1;
+        blit.dstOffsets[1] = (VkOffset3D){nextWidth, nextHeight, 1};
+        vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        RecordMipLevelBarrier(commandBuffer, image, level - 1,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                              VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                              VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    /* The last level is only ever written */
+    RecordMipLevelBarrier(commandBuffer, image, mipLevels - 1,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void UploadBatchGenerateMips(LogicalDevice *ld, UploadBatch *batch, VkImage image, u32 x, u32 y, u32 mipLevels)
+{
+    if (batch->acquireCommandBuffer == VK_NULL_HANDLE)
+    {
+        RecordMipBlits(batch->commandBuffer, image, x, y, mipLevels);
+        return;
+    }
+
+    /* Handed over still in TRANSFER_DST_OPTIMAL, the blits happen once the
+       graphics queue owns it */
+    UploadBatchReleaseImage(ld, batch, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    if (batch->mipGenerationCount == batch->mipGenerationCapacity)
+    {
+        batch->mipGenerationCapacity = batch->mipGenerationCapacity ? batch->mipGenerationCapacity * 2 : 8;
+        batch->mipGenerations = realloc(batch->mipGenerations,
+                                        sizeof(batch->mipGenerations[0]) * batch->mipGenerationCapacity);
+    }
+    batch->mipGenerations[batch->mipGenerationCount++] = (PendingMipGeneration){image, x, y, mipLevels};
+}
+
+local bool SubmitUploadBatchToTransferQueue(LogicalDevice *ld, UploadBatch *batch)
+{
+    VkAccessFlags bufferReadAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                     VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+    for (u32 i = 0; i < batch->bufferBarrierCount; i++)
+    {
+        batch->bufferBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        batch->bufferBarriers[i].dstAccessMask = 0;
+    }
+    for (u32 i = 0; i < batch->imageBarrierCount; i++)
+    {
+        batch->imageBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        batch->imageBarriers[i].dstAccessMask = 0;
+    }
+    if (batch->bufferBarrierCount || batch->imageBarrierCount)
+    {
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+                             batch->bufferBarrierCount, batch->bufferBarriers,
+                             batch->imageBarrierCount, batch->imageBarriers);
+    }
+
+    for (u32 i = 0; i < batch->bufferBarrierCount; i++)
+    {
+        batch->bufferBarriers[i].srcAccessMask = 0;
+        batch->bufferBarriers[i].dstAccessMask = bufferReadAccess;
+    }
+    for (u32 i = 0; i < batch->imageBarrierCount; i++)
+    {
+        /* Images still in TRANSFER_DST_OPTIMAL have mips to blit */
+        batch->imageBarriers[i].srcAccessMask = 0;
+        batch->imageBarriers[i].dstAccessMask =
+            batch->imageBarriers[i].newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+                ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+                : VK_ACCESS_SHADER_READ_BIT;
+    }
+    if (batch->bufferBarrierCount || batch->imageBarrierCount)
+    {
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, NULL,
+                             batch->bufferBarrierCount, batch->bufferBarriers,
+                             batch->imageBarrierCount, batch->imageBarriers);
+    }
+    for (u32 i = 0; i < batch->mipGenerationCount; i++)
+    {
+        PendingMipGeneration *mips = &batch->mipGenerations[i];
+        RecordMipBlits(batch->acquireCommandBuffer, mips->image, mips->x, mips->y, mips->mipLevels);
+    }
+
+    if (batch->timer)
+    {
+        GPUTimerEnd(batch->timer, batch->commandBuffer, batch->timerScope);
+    }
+
+    if (vkEndCommandBuffer(batch->commandBuffer) != VK_SUCCESS ||
+        vkEndCommandBuffer(batch->acquireCommandBuffer) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    VkSubmitInfo transferSubmit = {0};
+    transferSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    transferSubmit.commandBufferCount = 1;
+    transferSubmit.pCommandBuffers = &batch->commandBuffer;
+    transferSubmit.signalSemaphoreCount = 1;
+    transferSubmit.pSignalSemaphores = &batch->transferDone;
+
+    if (vkQueueSubmit(ld->transferQueue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquireSubmit = {0};
+    acquireSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquireSubmit.waitSemaphoreCount = 1;
+    acquireSubmit.pWaitSemaphores = &batch->transferDone;
+    acquireSubmit.pWaitDstStageMask = &waitStage;
+    acquireSubmit.commandBufferCount = 1;
+    acquireSubmit.pCommandBuffers = &batch->acquireCommandBuffer;
+
+    /* The graphics side waits on the transfer side, so this fence covers both */
+    if (vkQueueSubmit(ld->graphicsQueue, 1, &acquireSubmit, batch->fence) != VK_SUCCESS)
+    {
+        return false;
+    }
+    batch->submitted = true;
+    return true;
+}
+
+bool SubmitUploadBatch(LogicalDevice *ld, UploadBatch *batch)
+{
+    if (batch->acquireCommandBuffer != VK_NULL_HANDLE)
+    {
+        return SubmitUploadBatchToTransferQueue(ld, batch);
+    }
+
+    /* Images get their own barriers on the way to their final layout. Buffer
+       copies are made visible to everything that could read them */
+    if (batch->hasBufferCopies)
+    {
+        VkMemoryBarrier barrier = {0};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+
+    if (batch->timer)
+    {
+        GPUTimerEnd(batch->timer, batch->commandBuffer, batch->timerScope);
+    }
+
+    if (vkEndCommandBuffer(batch->commandBuffer) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    VkSubmitInfo submitInfo = {0};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->commandBuffer;
+
+    if (vkQueueSubmit(ld->graphicsQueue, 1, &submitInfo, batch->fence) != VK_SUCCESS)
+    {
+        return false;
+    }
+    batch->submitted = true;
+    return true;
+}
+
+bool UploadBatchIsComplete(LogicalDevice *ld, UploadBatch *batch)
+{
+    return batch->submitted && vkGetFenceStatus(ld->dev, batch->fence) == VK_SUCCESS;
+}
+
+void WaitUploadBatch(LogicalDevice *ld, UploadBatch *batch)
+{
+    if (batch->submitted)
+    {
+        vkWaitForFences(ld->dev, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+    }
+}
+
+void DestroyUploadBatch(LogicalDevice *ld, UploadBatch *batch)
+{
+    WaitUploadBatch(ld, batch);
+    for (u32 i = 0; i < batch->stagingCount; i++)
+    {
+        DestroyGPUBufferInfo(ld, &batch->stagingBuffers[i]);
+    }
+    free(batch->stagingBuffers);
+    free(batch->bufferBarriers);
+    free(batch->imageBarriers);
+    free(batch->mipGenerations);
+    vkFreeCommandBuffers(ld->dev, batch->commandPool, 1, &batch->commandBuffer);
+    if (batch->acquireCommandBuffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(ld->dev, batch->graphicsPool, 1, &batch->acquireCommandBuffer);
+        vkDestroySemaphore(ld->dev, batch->transferDone, NULL);
+    }
+    vkDestroyFence(ld->dev, batch->fence, NULL);
+    *batch = (UploadBatch){0};
+}
+
+void UploadBatchTimeWith(LogicalDevice *ld, UploadBatch *batch, GPUTimer *timer, u32 scope)
+{
+    if (timer->pool == VK_NULL_HANDLE || scope >= timer->scopeCount)
+    {
+        return;
+    }
+
+    if (batch->acquireCommandBuffer != VK_NULL_HANDLE)
+    {
+        if (!timer->transferTimestamps)
+        {
+            return;
+        }
+        /* Transfer queues can write timestamps but can't reset queries, so
+           that has to happen on the graphics queue first */
+        VkCommandBuffer reset = BeginSingleTimeCommandBuffer(ld, batch->graphicsPool);
+        GPUTimerReset(timer, reset, scope);
+        EndSingleTimeCommandBuffer(ld, batch->graphicsPool, reset);
+    }
+    else
+    {
+        GPUTimerReset(timer, batch->commandBuffer, scope);
+    }
+
+    batch->timer = timer;
+    batch->timerScope = scope;
+    GPUTimerBegin(timer, batch->commandBuffer, scope);
+}
+
+local u64 TimestampMask(u32 validBits)
+{
+    return validBits >= 64 ? UINT64_MAX : ((u64)1 << validBits) - 1;
+}
+
+bool CreateGPUTimer(LogicalDevice *ld, u32 scopeCount, GPUTimer *out)
+{
+    *out = (GPUTimer){0};
+
+    u32 familyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(ld->physdev, &familyCount, NULL);
+    VkQueueFamilyProperties *families = malloc(sizeof(*families) * familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(ld->physdev, &familyCount, families);
+    u32 graphicsBits = families[ld->indices.graphicsIndex].timestampValidBits;
+    u32 transferBits = families[ld->indices.transferIndex].timestampValidBits;
+    free(families);
+
+    if (graphicsBits == 0)
+    {
+        return false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ld->physdev, &props);
+
+    VkQueryPoolCreateInfo poolInfo = {0};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = scopeCount * 2;
+
+    VkQueryPool pool;
+    if (vkCreateQueryPool(ld->dev, &poolInfo, NULL, &pool) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    out->pool = pool;
+    out->scopeCount = scopeCount;
+    out->period = props.limits.timestampPeriod;
+    out->mask = TimestampMask(graphicsBits);
+    if (ld->dedicatedTransfer && transferBits != 0)
+    {
+        out->transferTimestamps = true;
+        if (transferBits < graphicsBits)
+        {
+            out->mask = TimestampMask(transferBits);
+        }
+    }
+    return true;
+}
+
+void DestroyGPUTimer(LogicalDevice *ld, GPUTimer *timer)
+{
+    if (timer->pool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(ld->dev, timer->pool, NULL);
+    }
+    *timer = (GPUTimer){0};
+}
+
+void GPUTimerReset(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope)
+{
+    if (timer->pool != VK_NULL_HANDLE && scope < timer->scopeCount)
+    {
+        vkCmdResetQueryPool(commandBuffer, timer->pool, scope * 2, 2);
+    }
+}
+
+void GPUTimerBegin(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope)
+{
+    if (timer->pool != VK_NULL_HANDLE && scope < timer->scopeCount)
+    {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timer->pool, scope * 2);
+    }
+}
+
+void GPUTimerEnd(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope)
+{
+    if (timer->pool != VK_NULL_HANDLE && scope < timer->scopeCount)
+    {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timer->pool, scope * 2 + 1);
+    }
+}
+
+bool GPUTimerCollect(LogicalDevice *ld, GPUTimer *timer, u32 scope, double *outMs)
+{
+    if (timer->pool == VK_NULL_HANDLE || scope >= timer->scopeCount)
+    {
+        return false;
+    }
+
+    /* No WAIT_BIT, so this comes back VK_NOT_READY instead of stalling */
+    u64 ticks[2];
+    if (vkGetQueryPoolResults(ld->dev, timer->pool, scope * 2, 2, sizeof(ticks), ticks,
+                              sizeof(ticks[0]), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    u64 elapsed = (ticks[1] - ticks[0]) & timer->mask;
+    *outMs = (double)elapsed * timer->period / 1000000.0;
+    return true;
+}
+
+void DeletionQueueSetFrame(DeletionQueue *queue, u64 frame)
+{
+    queue->frame = frame;
+}
+
+local DeferredDeletion *PushDeferredDeletion(DeletionQueue *queue, DeferredDeletionType type)
+{
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 16;
+        queue->items = realloc(queue->items, sizeof(queue->items[0]) * queue->capacity);
+    }
+    DeferredDeletion *d = &queue->items[queue->count++];
+    d->type = type;
+    d->frame = queue->frame;
+    return d;
+}
+
+void DeferDestroyGPUBuffer(DeletionQueue *queue, GPUBufferData *buffer)
+{
+    PushDeferredDeletion(queue, DEFERRED_GPU_BUFFER)->u.buffer = *buffer;
+}
+
+void DeferDestroyImage(DeletionQueue *queue, VkImage image, GPUAllocation *mem)
+{
+    DeferredDeletion *d = PushDeferredDeletion(queue, DEFERRED_IMAGE);
+    d->u.image.image = image;
+    d->u.image.mem = mem ? *mem : (GPUAllocation){0};
+}
+
+void DeferDestroyImageView(DeletionQueue *queue, VkImageView view)
+{
+    PushDeferredDeletion(queue, DEFERRED_IMAGE_VIEW)->u.imageView = view;
+}
+
+void DeferDestroyFramebuffer(DeletionQueue *queue, VkFramebuffer framebuffer)
+{
+    PushDeferredDeletion(queue, DEFERRED_FRAMEBUFFER)->u.framebuffer = framebuffer;
+}
+
+void DeferFreeCommandBuffers(DeletionQueue *queue, VkCommandPool pool, u32 count, VkCommandBuffer *buffers)
+{
+    DeferredDeletion *d = PushDeferredDeletion(queue, DEFERRED_COMMAND_BUFFERS);
+    d->u.commandBuffers.pool = pool;
+    d->u.commandBuffers.count = count;
+    d->u.commandBuffers.buffers = buffers;
+}
+
+void DeferDestroyPipeline(DeletionQueue *queue, VkPipeline pipeline)
+{
+    PushDeferredDeletion(queue, DEFERRED_PIPELINE)->u.pipeline = pipeline;
+}
+
+void DeferDestroyPipelineLayout(DeletionQueue *queue, VkPipelineLayout layout)
+{
+    PushDeferredDeletion(queue, DEFERRED_PIPELINE_LAYOUT)->u.pipelineLayout = layout;
+}
+
+void DeferDestroyRenderPass(DeletionQueue *queue, VkRenderPass renderPass)
+{
+    PushDeferredDeletion(queue, DEFERRED_RENDER_PASS)->u.renderPass = renderPass;
+}
+
+void DeferDestroySampler(DeletionQueue *queue, VkSampler sampler)
+{
+    PushDeferredDeletion(queue, DEFERRED_SAMPLER)->u.sampler = sampler;
+}
+
+void DeferDestroyDepthResources(DeletionQueue *queue, DepthResources *dr)
+{
+    DeferDestroyImageView(queue, dr->view);
+    DeferDestroyImage(queue, dr->image, &dr->mem);
+}
+
+void DeferDestroySwapChainData(DeletionQueue *queue, RenderContext *rc)
+{
+    for (u32 i = 0; i < rc->imageCount; i++)
+    {
+        DeferDestroyImageView(queue, rc->imageViews[i]);
+    }
+    if (rc->swapchain != VK_NULL_HANDLE)
+    {
+        PushDeferredDeletion(queue, DEFERRED_SWAPCHAIN)->u.swapchain = rc->swapchain;
+    }
+    else
+    {
+        for (u32 i = 0; i < rc->imageCount; i++)
+        {
+            DeferDestroyImage(queue, rc->images[i], &rc->imageMemory[i]);
+        }
+        free(rc->imageMemory);
+    }
+    free(rc->imageViews);
+    free(rc->images);
+}
+
+local void DestroyDeferred(LogicalDevice *ld, DeferredDeletion *d)
+{
+    switch (d->type)
+    {
+    case DEFERRED_GPU_BUFFER:
+        DestroyGPUBufferInfo(ld, &d->u.buffer);
+        break;
+    case DEFERRED_IMAGE:
+        vkDestroyImage(ld->dev, d->u.image.image, NULL);
+        if (d->u.image.mem.memory != VK_NULL_HANDLE)
+        {
+            FreeGPUMemory(ld, &d->u.image.mem);
+        }
+        break;
+    case DEFERRED_IMAGE_VIEW:
+        vkDestroyImageView(ld->dev, d->u.imageView, NULL);
+        break;
+    case DEFERRED_FRAMEBUFFER:
+        vkDestroyFramebuffer(ld->dev, d->u.framebuffer, NULL);
+        break;
+    case DEFERRED_COMMAND_BUFFERS:
+        vkFreeCommandBuffers(ld->dev, d->u.commandBuffers.pool, d->u.commandBuffers.count,
+                             d->u.commandBuffers.buffers);
+        free(d->u.commandBuffers.buffers);
+        break;
+    case DEFERRED_PIPELINE:
+        vkDestroyPipeline(ld->dev, d->u.pipeline, NULL);
+        break;
+    case DEFERRED_PIPELINE_LAYOUT:
+        vkDestroyPipelineLayout(ld->dev, d->u.pipelineLayout, NULL);
+        break;
+    case DEFERRED_RENDER_PASS:
+        vkDestroyRenderPass(ld->dev, d->u.renderPass, NULL);
+        break;
+    case DEFERRED_SWAPCHAIN:
+        vkDestroySwapchainKHR(ld->dev, d->u.swapchain, NULL);
+        break;
+    case DEFERRED_SAMPLER:
+        vkDestroySampler(ld->dev, d->u.sampler, NULL);
+        break;
+    }
+}
+
+void CollectDeletionQueue(LogicalDevice *ld, DeletionQueue *queue, u64 completedFrame)
+{
+    /* Items go in with non-decreasing frames, so everything due is at the
+       front and destruction happens in the order things were queued */
+    u32 done = 0;
+    while (done < queue->count && queue->items[done].frame <= completedFrame)
+    {
+        DestroyDeferred(ld, &queue->items[done++]);
+    }
+    memmove(queue->items, queue->items + done, sizeof(queue->items[0]) * (queue->count - done));
+    queue->count -= done;
+}
+
+void DestroyDeletionQueue(LogicalDevice *ld, DeletionQueue *queue)
+{
+    for (u32 i = 0; i < queue->count; i++)
+    {
+        DestroyDeferred(ld, &queue->items[i]);
+    }
+    free(queue->items);
+    *queue = (DeletionQueue){0};
+}
@@ -9,17 +9,73 @@ typedef struct QueueIndices
 {
     u32 graphicsIndex;
     u32 presentIndex;
+    /* Same as graphicsIndex when the device has no dedicated transfer family */
+    u32 transferIndex;
 } QueueIndices;
 
+/* Allocations smaller than this are carved out of shared blocks, bigger ones
+   get a block of their own */
+#define GPU_MEMORY_BLOCK_SIZE (64 * 1024 * 1024)
+
+typedef struct GPUMemoryChunk
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    bool free;
+    bool linear;
+} GPUMemoryChunk;
+
+typedef struct GPUMemoryBlock
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    u32 memoryTypeIndex;
+    bool dedicated;
+    /* A VkDeviceMemory can only be mapped once, so mappings are shared by
+       everything living in the block */
+    void *mapped;
+    u32 mapCount;
+    u32 chunkCount;
+    u32 chunkCapacity;
+    GPUMemoryChunk *chunks;
+} GPUMemoryBlock;
+
+typedef struct GPUAllocator
+{
+    VkPhysicalDeviceMemoryProperties memProperties;
+    VkDeviceSize bufferImageGranularity;
+    VkDeviceSize nonCoherentAtomSize;
+    u32 blockCount;
+    GPUMemoryBlock *blocks;
+} GPUAllocator;
+
+typedef struct GPUAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    u32 block;
+} GPUAllocation;
+
 typedef struct LogicalDevice
 {
     VkDevice dev;
     VkPhysicalDevice physdev;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue;
+    bool dedicatedTransfer;
     QueueIndices indices;
+    GPUAllocator allocator;
 } LogicalDevice;
 
+/* Render contexts never have more images than this. State kept per image,
+   like uniform regions, is allocated for this many once, so recreating the
+   swapchain can change the image count without outgrowing it */
+#define MAX_SWAPCHAIN_IMAGES 8
+
+/* Either wraps a swapchain or, when swapchain is VK_NULL_HANDLE, a set of
+   offscreen images we own and cycle through ourselves */
 typedef struct RenderContext
 {
     VkSwapchainKHR swapchain;
@@ -28,7 +84,12 @@ typedef struct RenderContext
     VkImageView *imageViews;
     VkExtent2D e;
     VkSurfaceFormatKHR format;
+    /* What the driver actually gave us, which can differ from what was asked
+       for */
+    VkPresentModeKHR presentMode;
 
+    GPUAllocation *imageMemory;
+    u32 nextImage;
 } RenderContext;
 
 typedef struct SwapChainSupportDetails
@@ -43,17 +104,147 @@ typedef struct SwapChainSupportDetails
 typedef struct GPUBufferData
 {
     VkBuffer buffer;
-    VkDeviceMemory deviceMemory;
+    GPUAllocation alloc;
+    /* Only set for buffers made with CreateMappedGPUBufferData */
+    void *mapped;
+    /* Writes through mapped need FlushGPUBuffer when this is false */
+    bool coherent;
 } GPUBufferData;
 
+/* Host visible buffer split into regionCount equally sized regions that stay
+   mapped for the buffer's lifetime. Regions are meant to be bound with dynamic
+   offsets, one per frame that can be in flight */
+typedef struct GPURingBuffer
+{
+    GPUBufferData buffer;
+    VkDeviceSize regionSize;
+    u32 regionCount;
+} GPURingBuffer;
+
 typedef struct DepthResources
 {
     VkImage image;
-    VkDeviceMemory mem;
+    GPUAllocation mem;
     VkImageView view;
     VkFormat format;
 } DepthResources;
 
+/* Timestamp query pool split into scopes, each a begin/end pair of queries.
+   Results are read back without waiting once the work that wrote them is
+   known to be done. pool is VK_NULL_HANDLE when the device can't time the
+   graphics queue, every GPUTimer call is a no-op then */
+typedef struct GPUTimer
+{
+    VkQueryPool pool;
+    u32 scopeCount;
+    /* Nanoseconds per tick */
+    double period;
+    /* Narrowest of the valid bit masks of the queues we time on */
+    u64 mask;
+    bool transferTimestamps;
+} GPUTimer;
+
+typedef struct PendingMipGeneration
+{
+    VkImage image;
+    u32 x;
+    u32 y;
+    u32 mipLevels;
+} PendingMipGeneration;
+
+/* Records many copies and layout transitions into one command buffer that is
+   submitted once with a fence. Staging buffers handed out by the batch live
+   until the batch is destroyed */
+typedef struct UploadBatch
+{
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    /* Only used when the copies run on a dedicated transfer queue. Ownership of
+       everything written is released at the end of commandBuffer and acquired
+       by acquireCommandBuffer on the graphics queue once transferDone fires */
+    VkCommandPool graphicsPool;
+    VkCommandBuffer acquireCommandBuffer;
+    VkSemaphore transferDone;
+    u32 bufferBarrierCount;
+    u32 bufferBarrierCapacity;
+    VkBufferMemoryBarrier *bufferBarriers;
+    u32 imageBarrierCount;
+    u32 imageBarrierCapacity;
+    VkImageMemoryBarrier *imageBarriers;
+    VkFence fence;
+    bool submitted;
+    bool hasBufferCopies;
+    u32 stagingCount;
+    u32 stagingCapacity;
+    GPUBufferData *stagingBuffers;
+    /* Mip chains left to blit in acquireCommandBuffer */
+    u32 mipGenerationCount;
+    u32 mipGenerationCapacity;
+    PendingMipGeneration *mipGenerations;
+    /* Set by UploadBatchTimeWith */
+    GPUTimer *timer;
+    u32 timerScope;
+} UploadBatch;
+
+typedef enum DeferredDeletionType
+{
+    DEFERRED_GPU_BUFFER,
+    DEFERRED_IMAGE,
+    DEFERRED_IMAGE_VIEW,
+    DEFERRED_FRAMEBUFFER,
+    DEFERRED_COMMAND_BUFFERS,
+    DEFERRED_PIPELINE,
+    DEFERRED_PIPELINE_LAYOUT,
+    DEFERRED_RENDER_PASS,
+    DEFERRED_SWAPCHAIN,
+    DEFERRED_SAMPLER
+} DeferredDeletionType;
+
+typedef struct DeferredDeletion
+{
+    DeferredDeletionType type;
+    /* Last frame that could have used the object */
+    u64 frame;
+    union
+    {
+        GPUBufferData buffer;
+        struct
+        {
+            VkImage image;
+            GPUAllocation mem;
+        } image;
+        VkImageView imageView;
+        VkFramebuffer framebuffer;
+        struct
+        {
+            VkCommandPool pool;
+            u32 count;
+            /* Freed along with the command buffers */
+            VkCommandBuffer *buffers;
+        } commandBuffers;
+        VkPipeline pipeline;
+        VkPipelineLayout pipelineLayout;
+        VkRenderPass renderPass;
+        VkSwapchainKHR swapchain;
+        VkSampler sampler;
+    } u;
+} DeferredDeletion;
+
+/* Objects that may still be in use by frames in flight. Everything queued is
+   tagged with frame, the value of the frame currently being recorded, and
+   destroyed once CollectDeletionQueue is told that frame has completed. Frame
+   values only ever go up */
+typedef struct DeletionQueue
+{
+    u64 frame;
+    u32 count;
+    u32 capacity;
+    DeferredDeletion *items;
+} DeletionQueue;
+
+/* Returns 0 for devices that can't be used, otherwise a score. The device
+   with the highest score gets picked. surf is VK_NULL_HANDLE when running
+   headless */
 typedef int (*SuitableDeviceCheck)(VkPhysicalDevice dev,
                                    VkSurfaceKHR surf,
                                    const char **expectedDeviceExtensions,
@@ -66,6 +257,10 @@ VkPhysicalDevice GetVkPhysicalDevice(VkInstance instance, VkSurfaceKHR surf,
 
 bool GetDeviceQueueGraphicsAndPresentationIndices(VkPhysicalDevice dev, VkSurfaceKHR surf, QueueIndices *indices);
 
+/* Looks for a family that can transfer but not draw. Returns false if the
+   device doesn't have one */
+bool GetDeviceQueueTransferIndex(VkPhysicalDevice dev, u32 *out);
+
 bool CheckDeviceExtensionSupport(VkPhysicalDevice dev,
                                  const char **extensionList,
                                  size_t extensionCount);
@@ -85,8 +280,20 @@ VkShaderModule CreateVkShaderModule(const LogicalDevice *ld,
                                     const void *shaderSource,
                                     usize shaderLen);
 
+/* Loads the cache written by SavePipelineCache. Files from another device or
+   driver version are ignored and an empty cache is returned instead, as it is
+   when path is NULL. *warm says whether anything was loaded. VK_NULL_HANDLE on
+   failure */
+VkPipelineCache LoadPipelineCache(const LogicalDevice *ld, const char *path, bool *warm);
+
+/* Writes to a temporary file that's renamed over path, so a crash never leaves
+   a half written cache behind */
+bool SavePipelineCache(const LogicalDevice *ld, VkPipelineCache cache, const char *path);
+
+/* Viewport and scissor are dynamic state, see RecordViewportAndScissor. The
+   pipeline only depends on the render pass, not on the swapchain extent */
 VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
-                                  const RenderContext *data,
+                                  VkPipelineCache cache,
                                   VkShaderModule vertShader,
                                   VkShaderModule fragShader,
                                   VkRenderPass renderpass,
@@ -96,6 +303,15 @@ VkPipeline CreateGraphicsPipeline(const LogicalDevice *ld,
                                   DepthResources *dr,
                                   VkPipelineLayout *layout);
 
+/* Doesn't depend on a render pass, so unlike graphics pipelines it survives
+   swapchain recreation untouched */
+VkPipeline CreateComputePipeline(const LogicalDevice *ld,
+                                 VkPipelineCache cache,
+                                 VkShaderModule shader,
+                                 VkDescriptorSetLayout *descriptorSetLayouts,
+                                 u32 descriptorSetsCount,
+                                 VkPipelineLayout *layout);
+
 VkRenderPass CreateRenderPass(const LogicalDevice *ld, const RenderContext *data, const DepthResources *dr);
 
 VkFramebuffer *CreateFrameBuffers(const LogicalDevice *ld, const RenderContext *data, VkRenderPass renderpass,
@@ -103,9 +319,23 @@ VkFramebuffer *CreateFrameBuffers(const LogicalDevice *ld, const RenderContext *
 
 VkCommandPool CreateCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flags);
 
+/* VK_NULL_HANDLE if the device has no dedicated transfer queue */
+VkCommandPool CreateTransferCommandPool(LogicalDevice *ld, VkCommandPoolCreateFlags flags);
+
+/* oldSwapchain lets the driver hand resources over from the swapchain being
+   replaced. It is retired either way but still has to be destroyed, after
+   the frames using it are done. presentMode is a preference, unsupported
+   modes fall back towards FIFO. Fails when the driver won't go down to
+   MAX_SWAPCHAIN_IMAGES images */
 errcode CreateRenderContext(LogicalDevice *ld,
                             VkSurfaceKHR surf, u32 windowWidth,
-                            u32 windowHeight, RenderContext *out);
+                            u32 windowHeight, VkSwapchainKHR oldSwapchain,
+                            VkPresentModeKHR presentMode, RenderContext *out);
+
+/* Headless replacement for CreateRenderContext. Images end up in
+   TRANSFER_SRC_OPTIMAL after each frame so they can be read back */
+errcode CreateOffscreenRenderContext(LogicalDevice *ld, u32 width, u32 height,
+                                     u32 imageCount, RenderContext *out);
 
 void DestroySwapChainData(LogicalDevice *ld, RenderContext *rc);
 
@@ -114,14 +344,66 @@ VkResult CreateGPUBufferData(LogicalDevice *ld,
                              VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
                              GPUBufferData *buffer);
 
+/* Same as CreateGPUBufferData but the buffer is mapped once here and stays
+   mapped until DestroyGPUBufferInfo. properties must include HOST_VISIBLE */
+VkResult CreateMappedGPUBufferData(LogicalDevice *ld,
+                                   size_t bufferSize,
+                                   VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                                   GPUBufferData *buffer);
+
 void DestroyGPUBufferInfo(LogicalDevice *ld, GPUBufferData *buffer);
 
+/* Make host writes visible to the device. No-op for coherent memory */
+void FlushGPUBuffer(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size);
+
+/* Make device writes visible to the host. No-op for coherent memory */
+void InvalidateGPUBuffer(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size);
+
+/* Returns a pointer to the start of the allocation. The owning block stays
+   mapped until every MapGPUMemory has a matching UnmapGPUMemory */
+void *MapGPUMemory(LogicalDevice *ld, GPUAllocation *alloc);
+
+void UnmapGPUMemory(LogicalDevice *ld, GPUAllocation *alloc);
+
+/* Maps only size bytes at offset into the buffer, rounded out to
+   nonCoherentAtomSize so they can be flushed, unless the block is already
+   mapped whole. Has to be undone with UnmapGPUBufferRange before anything
+   else maps the block */
+void *MapGPUBufferRange(LogicalDevice *ld, GPUBufferData *buffer, VkDeviceSize offset, VkDeviceSize size);
+
+void UnmapGPUBufferRange(LogicalDevice *ld, GPUBufferData *buffer);
+
 local void OutputDataToBuffer(LogicalDevice *ld, GPUBufferData *buffer, void *data, size_t dataLen, size_t offset)
 {
-    void *bufp;
-    vkMapMemory(ld->dev, buffer->deviceMemory, offset, dataLen, 0, &bufp);
+    if (buffer->mapped)
+    {
+        memcpy((u8 *)buffer->mapped + offset, data, dataLen);
+        FlushGPUBuffer(ld, buffer, offset, dataLen);
+        return;
+    }
+    u8 *bufp = MapGPUBufferRange(ld, buffer, offset, dataLen);
+    if (!bufp)
+    {
+        return;
+    }
     memcpy(bufp, data, dataLen);
-    vkUnmapMemory(ld->dev, buffer->deviceMemory);
+    FlushGPUBuffer(ld, buffer, offset, dataLen);
+    UnmapGPUBufferRange(ld, buffer);
+}
+
+bool CreateGPURingBuffer(LogicalDevice *ld, VkDeviceSize elementSize, u32 regionCount,
+                         VkBufferUsageFlags usage, GPURingBuffer *out);
+
+void DestroyGPURingBuffer(LogicalDevice *ld, GPURingBuffer *ring);
+
+local VkDeviceSize GPURingBufferOffset(GPURingBuffer *ring, u32 region)
+{
+    return ring->regionSize * region;
+}
+
+local void *GPURingBufferRegion(GPURingBuffer *ring, u32 region)
+{
+    return (u8 *)ring->buffer.mapped + GPURingBufferOffset(ring, region);
 }
 
 void CopyGPUBuffer(LogicalDevice *ld,
@@ -129,29 +411,149 @@ void CopyGPUBuffer(LogicalDevice *ld,
                    VkDeviceSize size, VkDeviceSize offsetDest,
                    VkDeviceSize offsetSrc, VkCommandPool commandPool);
 
-VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, RenderContext *swapchain,
+VkDescriptorPool CreateDescriptorPool(LogicalDevice *ld, u32 maxSets,
                                       u32 poolSizeCount, VkDescriptorPoolSize *poolSizes);
 
-VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, RenderContext *data,
+/* setCount sets, one per uniform region */
+VkDescriptorSet *AllocateDescriptorSets(LogicalDevice *ld, u32 setCount,
                                         VkDescriptorPool descriptorPool,
-                                        GPUBufferData *buffers, VkDescriptorSetLayout layout,
+                                        GPURingBuffer *uniformRing, VkDescriptorSetLayout layout,
                                         VkDeviceSize typeSize, VkImageView imageView, VkSampler sampler);
 
 bool FindMemoryType(VkPhysicalDevice physdev, u32 typefilter,
                     VkMemoryPropertyFlags properties, u32 *out);
 
+/* linear is true for buffers and linearly tiled images. It's used to keep
+   linear and optimal resources bufferImageGranularity apart inside a block */
+bool AllocateGPUMemory(LogicalDevice *ld, const VkMemoryRequirements *memReq,
+                       VkMemoryPropertyFlags properties, bool linear, GPUAllocation *out);
+
+void FreeGPUMemory(LogicalDevice *ld, GPUAllocation *alloc);
+
 void DestroyDepthResources(LogicalDevice *ld, DepthResources *dr);
 
+/* The view covers levels 0 to mipLevels - 1 */
 bool CreateImageView(LogicalDevice *ld, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
-                     VkImageView *out);
+                     u32 mipLevels, VkImageView *out);
+
+bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, u32 mipLevels, VkFormat format, VkImageUsageFlags usage,
+                   VkImage *outImage, GPUAllocation *outMem);
 
-bool CreateVkImage(LogicalDevice *ld, u32 x, u32 y, VkFormat format, VkImageUsageFlags usage,
-                   VkImage *outImage, VkDeviceMemory *outMem);
+/* Whether UploadBatchGenerateMips can be used on images of format */
+bool FormatSupportsMipBlits(LogicalDevice *ld, VkFormat format);
 void TransitionImageLayout(LogicalDevice *ld, VkCommandPool commandPool, VkImage image, VkFormat format,
                            VkImageLayout oldLayout, VkImageLayout newLayout);
 
 VkCommandBuffer BeginSingleTimeCommandBuffer(LogicalDevice *ld, VkCommandPool commandPool);
 
 void EndSingleTimeCommandBuffer(LogicalDevice *ld, VkCommandPool commandPool, VkCommandBuffer commandBuffer);
-bool CreateDepthResources(LogicalDevice *ld, RenderContext *rc, VkCommandPool commandPool, DepthResources *out);
+
+/* Covers the whole extent */
+void RecordViewportAndScissor(VkCommandBuffer commandBuffer, VkExtent2D extent);
+
+/* Transitions every mip level */
+void RecordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
+                                 VkImageLayout oldLayout, VkImageLayout newLayout);
+
+/* batch may be NULL. The render pass starts the depth attachment from
+   UNDEFINED, so the transition it records is only needed by other users */
+bool CreateDepthResources(LogicalDevice *ld, RenderContext *rc, UploadBatch *batch, DepthResources *out);
+
+/* transferPool comes from CreateTransferCommandPool. When it is
+   VK_NULL_HANDLE everything is recorded into commandPool and submitted to the
+   graphics queue */
+bool BeginUploadBatch(LogicalDevice *ld, VkCommandPool commandPool, VkCommandPool transferPool,
+                      UploadBatch *out);
+
+/* out is a mapped host visible buffer owned by the batch */
+bool UploadBatchAllocateStaging(LogicalDevice *ld, UploadBatch *batch, VkDeviceSize size,
+                                GPUBufferData *out);
+
+void UploadBatchCopyBuffer(LogicalDevice *ld, UploadBatch *batch, GPUBufferData *dest, GPUBufferData *src,
+                           VkDeviceSize size, VkDeviceSize offsetDest, VkDeviceSize offsetSrc);
+
+/* Copies data into a fresh staging buffer and records the copy into dest */
+bool UploadBatchStageBuffer(LogicalDevice *ld, UploadBatch *batch, GPUBufferData *dest,
+                            const void *data, VkDeviceSize size, VkDeviceSize offsetDest);
+
+/* x and y are the extent of mipLevel */
+void UploadBatchCopyBufferToImage(UploadBatch *batch, GPUBufferData *src, VkDeviceSize offsetSrc,
+                                  VkImage image, u32 mipLevel, u32 x, u32 y);
+
+void UploadBatchTransitionImage(LogicalDevice *ld, UploadBatch *batch, VkImage image, VkFormat format,
+                                VkImageLayout oldLayout, VkImageLayout newLayout);
+
+/* Fills levels 1 to mipLevels - 1 of an x by y image by blitting each level
+   into the next, then leaves every level in SHADER_READ_ONLY_OPTIMAL. Use
+   in place of the last TRANSFER_DST -> SHADER_READ_ONLY transition, once
+   level 0 has been copied in. The image needs TRANSFER_SRC usage and a
+   format FormatSupportsMipBlits accepts. Blits need a graphics queue, so on
+   a dedicated transfer queue they're recorded after the ownership acquire */
+void UploadBatchGenerateMips(LogicalDevice *ld, UploadBatch *batch, VkImage image, u32 x, u32 y, u32 mipLevels);
+
+bool SubmitUploadBatch(LogicalDevice *ld, UploadBatch *batch);
+
+/* Non-blocking. True once the submitted work has finished */
+bool UploadBatchIsComplete(LogicalDevice *ld, UploadBatch *batch);
+
+void WaitUploadBatch(LogicalDevice *ld, UploadBatch *batch);
+
+/* Waits for the batch if it was submitted, then frees it and its staging buffers */
+void DestroyUploadBatch(LogicalDevice *ld, UploadBatch *batch);
+
+/* Brackets everything recorded into the batch's copy command buffer with the
+   timer's scope. Call right after BeginUploadBatch. Does nothing when the
+   queue the batch runs on can't write timestamps */
+void UploadBatchTimeWith(LogicalDevice *ld, UploadBatch *batch, GPUTimer *timer, u32 scope);
+
+/* Returns false and leaves out zeroed when timestamps aren't supported on the
+   graphics queue */
+bool CreateGPUTimer(LogicalDevice *ld, u32 scopeCount, GPUTimer *out);
+
+void DestroyGPUTimer(LogicalDevice *ld, GPUTimer *timer);
+
+/* Resets the scope's queries. Has to be recorded outside of a render pass
+   before the scope is begun again */
+void GPUTimerReset(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope);
+
+void GPUTimerBegin(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope);
+
+void GPUTimerEnd(GPUTimer *timer, VkCommandBuffer commandBuffer, u32 scope);
+
+/* Non-blocking. Returns false if the scope's results aren't available yet */
+bool GPUTimerCollect(LogicalDevice *ld, GPUTimer *timer, u32 scope, double *outMs);
+
+void DeletionQueueSetFrame(DeletionQueue *queue, u64 frame);
+
+void DeferDestroyGPUBuffer(DeletionQueue *queue, GPUBufferData *buffer);
+
+/* mem may be NULL for images we don't own the memory of */
+void DeferDestroyImage(DeletionQueue *queue, VkImage image, GPUAllocation *mem);
+
+void DeferDestroyImageView(DeletionQueue *queue, VkImageView view);
+
+void DeferDestroyFramebuffer(DeletionQueue *queue, VkFramebuffer framebuffer);
+
+/* Takes ownership of buffers, which has to come from malloc */
+void DeferFreeCommandBuffers(DeletionQueue *queue, VkCommandPool pool, u32 count, VkCommandBuffer *buffers);
+
+void DeferDestroyPipeline(DeletionQueue *queue, VkPipeline pipeline);
+
+void DeferDestroyPipelineLayout(DeletionQueue *queue, VkPipelineLayout layout);
+
+void DeferDestroyRenderPass(DeletionQueue *queue, VkRenderPass renderPass);
+
+void DeferDestroySampler(DeletionQueue *queue, VkSampler sampler);
+
+void DeferDestroyDepthResources(DeletionQueue *queue, DepthResources *dr);
+
+/* Deferred version of DestroySwapChainData. The handle arrays are freed right
+   away */
+void DeferDestroySwapChainData(DeletionQueue *queue, RenderContext *rc);
+
+/* Destroys everything queued at or before completedFrame */
+void CollectDeletionQueue(LogicalDevice *ld, DeletionQueue *queue, u64 completedFrame);
+
+/* Destroys everything and frees the queue. Only for when the device is idle */
+void DestroyDeletionQueue(LogicalDevice *ld, DeletionQueue *queue);
 #endif